@@ -1,411 +1,6704 @@
-#include <winsock2.h>
-#include <windows.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <WS2tcpip.h>
-#include <windns.h>
-#include <winerror.h>
-
-typedef enum Protocol {
-    Tcp,
-    Udp,
-} Protocol;
-
-typedef struct PACKET_CONTENTS {
-    char *ipAddress;
-    WORD port;
-    Protocol pt;
-    BOOL debug;
-    long timeout;
-} PACKET_CONTENTS, *PPACKET_CONTENTS;
-
-void InitWinSock();
-void ShowSyntax();
-int ResolveDnsAddress(char *dnsQuery, Protocol pt, char **output, size_t bufferSize);
-size_t SendSynPacket(PPACKET_CONTENTS config);
-void ScanTarget(size_t portStart, size_t portEnd, char *domain, Protocol pt, BOOL debug, long timeout);
-
-const long DEFAULT_TIMEOUT = 200;
-const size_t DEFAULT_START_PORT = 1;
-const size_t DEFAULT_END_PORT = 1024;
-const size_t MAX_PORT = 65535;
-const char *VERSION = "0.0.2";
-const char *AUTHOR = "liquidlegs";
-
-/*
-Function initalizes the winsock2 library.
-Params:
-    None.
-returns WSADATA.
-*/
-void InitWinSock() {
-    WSADATA w;
-    int err = WSAStartup(MAKEWORD(2,2), &w);
-    if(err < 0) printf("Failed to initalize winsock\n");
-}
-
-/*
-Function resolves dns domain names to ip addresses.
-Params:
-    char        *dnsQuery       -       [The domain name to query.]
-    Protocol    pt              -       [The protocol to use.]
-    char        **output        -       [The buffer to receive the result.]
-    size_t      bufferSize      -       [The size of the receiving buffer.]
-Returns int.
-*/
-int ResolveDnsAddress(char *dnsQuery, Protocol pt, char **output, size_t bufferSize) {
-    DNS_STATUS err = 0;                                             // The return err;
-    PDNS_RECORDA record = {0};                                      // Holds the dns results.
-    struct in_addr ip;                                              // Holds the ip address in its network byte order.
-    size_t queryType = 0x00000000;                                  // Standard dns queries use tcp and udp.
-
-    if(strlen(dnsQuery) <= 0) return -1;                            // If the user enters an empty query, function fails and returns -1.
-    if(pt == Tcp) pt = 0x00000002;                                  // A tcp only dns query.
-    if(pt == Udp) return -1;                                        // Winapi doesnt support resolving address over udp only.
-
-    err = DnsQuery_A (                                              // Makes a Dns query.
-        dnsQuery,                                                   // The query string.
-        0x0001,                                                     // The type of record [A].
-        pt,                                                         // The type of query.
-        NULL,                                                       // A reserved parameter.
-        &record,                                                    // The results of the query.
-        NULL                                                        // A reserved parameter.
-    );
-
-    if(record != NULL) {
-        ip.S_un.S_addr = record->Data.A.IpAddress;                  // Stores the ip address in its network byte order.
-        size_t ipBufSize = strlen(inet_ntoa(ip));                   // Gets the length of the ip address string.
-        if(bufferSize < ipBufSize) return ipBufSize;                // Return buffer size if allocated memory isnt enough to store returned result.
-        strcat_s(*output, 30, inet_ntoa(ip));                       // Fill the buffer with the ip address.
-    }
-
-    DnsRecordListFree(record, DnsFreeRecordList);                  // Free allocated memory of the dns results.
-    return err;                                                    // Return result of the dns query.
-}
-
-/*
-Function will attempt to connect to a server socket in hope that it may responnd.
-Params:
-    PPACKET_CONTENTS config     -       [Contains info to be sent on the socket.]
-Returns size_t.
-*/
-size_t SendSynPacket(PPACKET_CONTENTS config) {
-    size_t stream = SOCK_STREAM;                                    // Tcp stream.
-    int protocol = IPPROTO_TCP;                                     // Tcp protocol.
-
-    if(config->pt == Udp) {                                         // If the udp enum is found on the config param.
-        stream = SOCK_DGRAM;                                        // then set the socket to use Udp.
-        protocol = IPPROTO_UDP;
-    }
-    
-    struct sockaddr_in server;                                      // Destination host information.
-    server.sin_addr.S_un.S_addr = inet_addr(config->ipAddress);     // Ipaddress as network byte order.
-    server.sin_family = AF_INET;                                    // Uses Ipv4.
-    server.sin_port = htons(config->port);                          // Server port in network byte order.
-
-    SOCKET s = INVALID_SOCKET;                                      // Socket object.
-    s = WSASocketA(AF_INET, stream, protocol, NULL, 0, 0);          // Create the socket.
-    if(s < 0) {
-        printf("INVALID SOCKET\n");
-        closesocket(s);                                             // Closesocket if invalid.
-        return 1;
-    }
-
-    ULONG block = 1;                                                // Non blocking socket mode.
-    int errBlock = ioctlsocket(s, FIONBIO, &block);                 // Set socket to block requests.
-    if(errBlock < 0) {
-        closesocket(s);                                             // Close socket if something goes wrong.
-        return 1;
-    }
-                                                                   // Attempt to connect to server port.
-    int err = connect(s, (struct sockaddr*)&server, sizeof(server));
-    if(WSAGetLastError() == WSAEWOULDBLOCK) {
-        fd_set w, e;                                                
-        FD_ZERO(&w);                                                // Zero out structures.
-        FD_ZERO(&e);
-        FD_SET(s, &w);                                              // Allow socket to be written to.
-        FD_SET(s, &e);                                              // Tell socket how to handle the connection if it fails.
-        
-        TIMEVAL timeout = {0};                                      // Setup timeout period for scanning ports.
-        timeout.tv_sec = 0;
-        timeout.tv_usec = config->timeout;                          // timeout is equal to microseconds*1000.
-        
-        size_t counter = 0;                                         // Counts how many times the connect function is called.
-        size_t time = 0;                                            // Controls how many times the connect function can be called before it moves on.
-        select(0, NULL, &w, &e, &timeout);                          // Applies timeout to socket.
-        while(WSAGetLastError() != WSAEISCONN && time < 2) {        // Loop until the connectio succeeds or fails.
-            err = connect(s, (struct sockaddr*)&server, sizeof(server));
-            counter++;
-            if(counter >= 10) {
-                time++;
-                counter = 0;
-            }
-        }
-
-        if(WSAGetLastError() == WSAEISCONN) {                       // Report socket open if successful.
-            printf("OPEN [%hu]\n", config->port);
-            closesocket(s);                                         // Close the socket.
-            return 0;                                               // Return status success.
-        }
-        else if(WSAGetLastError() != WSAEISCONN && time >= 1) {     // Report socket closed on failure.
-            if(config->debug == TRUE) printf("CLOSED [%hu]\n", config->port);
-            closesocket(s);                                         // Close the socket.
-            return 1;                                               // Return status fail.
-        }
-    }
-
-    closesocket(s);         // The function probably wont get this far.
-    return 1;               // But if it does, close the socket and return failure.
-}
-
-/*
-Function displays the help menu.
-Params:
-    None.
-Returns nothing.
-*/
-void ShowSyntax() {
-    printf(
-            "\n"
-            "           8  .o88b. d8888b. .d8888.  .o88b.  .d8b.  d8b   db 8\n"
-            "           8 d8P  Y8 88  `8D 88'  YP d8P  Y8 d8' `8b 888o  88 8\n"
-            "           8 8P      88oodD' `8bo.   8P      88ooo88 88V8o 88 8\n"
-            "    C8888D   8b      88~~~     `Y8b. 8b      88~~~88 88 V8o88   C8888D\n"
-            "           8 Y8b  d8 88      db   8D Y8b  d8 88   88 88  V888 8\n"
-            "           8  `Y88P' 88      `8888Y'  `Y88P' YP   YP VP   V8P 8\n\n"
-            "           Author:  [%s]\n"
-            "           Version: [%s]\n\n"
-            "___________________________________Help___________________________________\n\n"
-            "           [ -p      ]              <Scan ports within a range>\n"
-            "           [ -proto  ]              <The protocol you want to use>\n"
-            "           [ -dbg    ]              <Show debug information>\n"
-            "           [ -t      ]              <Set syn request timeout in ms>\n"
-            "           [ -h      ]              <Show this menu>\n\n"
-            "           [Examples]\n"
-            "              stackmypancakes.com -proto tcp -p 1 1024\n"
-            "              doogle.com -dbg -proto udp -p 22 65535\n"
-            "              asdf.com -t 200 -proto tcp -p 440 450\n"
-            "              friendface.com -t 50 -dbg -p 50 100 -proto tcp\n"
-            "__________________________________________________________________________\n\n",
-            AUTHOR, VERSION
-    );
-}
-
-/*
-Function runs the main loop for scanning and preparing ports to be scanned.
-Params:
-    size_t      portStart        -       [The start range to begin the port scan.]
-    size_t      portEnd          -       [The end range to finish the port scan.]
-    char        *domain          -       [The domain name to be resolved.]
-    Protocol    pt               -       [The protocol to use in the scan. tcp/udp.]
-    BOOL        debug            -       [Displays debug information such as closed ports]
-    long        timeout          -       [The maxium amount of time a port should be scanned before moving on to the next.]
-Returns nothing.
-*/
-void ScanTarget(size_t portStart, size_t portEnd, char *domain, Protocol pt, BOOL debug, long timeout) {
-    char *dnsBuf = calloc(30, sizeof(char));                                                    // Buffer to receive the resolved dns name.
-    PACKET_CONTENTS p;                                                                          // Stores information used for the socket.
-
-    if(debug == TRUE) printf("Resolving domain name\n");                                        // Simple debug statements.
-    int retErr = ResolveDnsAddress(domain, Tcp, &dnsBuf, 30);                                   // Resolve domain name to an ip address.
-    if(retErr != 0) {                                                                           // If function fails, exit.
-        printf("Error: Unable to resolve domain. Make sure it is spelt correctly.\n");
-        return;
-    }
-    if(debug == TRUE) printf("Name resolved [%s]\n", dnsBuf);
-
-    if(timeout <= 1) p.timeout = DEFAULT_TIMEOUT*1000;                                          // Sets the portscan timeout period.
-    else p.timeout = timeout*1000;
-
-    p.ipAddress = dnsBuf;                                                                       // Set the ip address.
-    p.pt = pt;                                                                                  // Set the transport protocol.
-    p.debug = debug;                                                                            // Set the debug mode.
-    for(UINT index = portStart; index <= portEnd; index ++) {
-        p.port = index;                                                                         // The port.
-        int err = SendSynPacket(&p);                                                            // Send syn packets to each port.
-        if(debug == TRUE) printf("SendPacket Status [%u]\n", err);
-    }
-    if(dnsBuf != NULL) free(dnsBuf);                                                            // Free the dns buffer from memory.
-}
-
-/*
-Function checks if the port range makes sense.
-Params:
-    size_t arg1     -       [The starting port range.]
-    size_t arg2     -       [The ending port range.]
-Returns BOOL.
-*/
-BOOL arePortsCorrect(size_t arg1, size_t arg2) {
-    if(arg1 > arg2) printf("[StartPort (%u) cannot be greater than EndPort (%u)]\n", arg1, arg2);
-    else if(arg2 < arg1) printf("[StartPort (%u) cannot be less than EndPort (%u)]\n", arg2, arg1);
-    else if(arg2 > 65535) printf("[EndPort (%u) You may not scan ports greater than %u]\n", arg2, MAX_PORT);
-    else if(arg1 <= arg2 && arg2 >= arg1) return TRUE;
-}
-
-int main(int argc, char *argv[]) {
-    long timeout_arg = DEFAULT_TIMEOUT;                                          // The default timeout value.
-    size_t startPt = DEFAULT_START_PORT;                                         // The default start port.
-    size_t endPt = DEFAULT_END_PORT;                                             // The default end port.
-    BOOL ports = FALSE;                                                          // The default port flag.
-    InitWinSock();                                                               // Initalizes the winsock2 library.
-    
-    if(argc <= 1) ShowSyntax();
-    else if(argc == 2) {
-        if(strlen(argv[1]) > 0 && stricmp("-h", argv[1]) == 0) ShowSyntax();
-        else if(strlen(argv[1]) > 0 && stricmp("-h", argv[1]) != 0) {
-            ScanTarget(DEFAULT_START_PORT, DEFAULT_END_PORT, argv[1], Tcp, FALSE, DEFAULT_TIMEOUT);
-        }
-        else ShowSyntax();
-    }
-    else if(argc == 3) {
-        if(stricmp("-dbg", argv[2]) == 0) {
-            ScanTarget(DEFAULT_START_PORT, DEFAULT_END_PORT, argv[1], Tcp, TRUE, DEFAULT_TIMEOUT);
-        }
-        else ShowSyntax();
-    }
-    else if(argc == 4) {
-        if(stricmp("-t", argv[2]) == 0 && strlen(argv[3]) > 0) {
-            timeout_arg = atol(argv[3]);
-            ScanTarget(DEFAULT_START_PORT, DEFAULT_END_PORT, argv[1], Tcp, FALSE, timeout_arg);
-        }
-        else ShowSyntax();
-    }
-    else if(argc == 5) {
-        if(stricmp("-t", argv[2]) == 0 && strlen(argv[3]) > 0 && stricmp("-dbg", argv[4]) == 0) {
-            timeout_arg = atol(argv[3]);
-            ScanTarget(DEFAULT_START_PORT, DEFAULT_END_PORT, argv[1], Tcp, TRUE, timeout_arg);
-        }
-        else if(stricmp("-dbg", argv[2]) == 0 && stricmp("-t", argv[3]) == 0 && strlen(argv[4]) > 0) {
-            timeout_arg = atol(argv[4]);
-            ScanTarget(DEFAULT_START_PORT, DEFAULT_END_PORT, argv[1], Tcp, TRUE, timeout_arg);
-        }
-        else if(stricmp("-p", argv[2]) == 0 && strlen(argv[3]) > 0 && strlen(argv[4]) > 0) {
-            startPt = atoll(argv[3]);
-            endPt = atoll(argv[4]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Tcp, FALSE, DEFAULT_TIMEOUT);
-        }
-        else ShowSyntax();
-    }
-    else if(argc == 6) {
-        if(stricmp("-dbg", argv[2]) == 0 && stricmp("-p", argv[3]) == 0 && strlen(argv[4]) > 0 && strlen(argv[5]) > 0) {
-            startPt = atoll(argv[4]);
-            endPt = atoll(argv[5]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Tcp, TRUE, DEFAULT_TIMEOUT);
-        }
-        else ShowSyntax();
-    }
-    else if(argc == 7) {
-        if(stricmp("-p", argv[2]) == 0 && strlen(argv[3]) > 0 && strlen(argv[4]) > 0 && stricmp("-proto", argv[5]) == 0 && stricmp("tcp", argv[6]) == 0) {
-            startPt = atoll(argv[3]);
-            endPt = atoll(argv[4]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Tcp, FALSE, DEFAULT_TIMEOUT);
-        }
-        else if(stricmp("-p", argv[2]) == 0 && strlen(argv[3]) > 0 && strlen(argv[4]) > 0 && stricmp("-proto", argv[5]) == 0 && stricmp("udp", argv[6]) == 0) {
-            startPt = atoll(argv[3]);
-            endPt = atoll(argv[4]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Udp, FALSE, DEFAULT_TIMEOUT);
-        }
-        else if(stricmp("-t", argv[2]) == 0 && strlen(argv[3]) > 0 && stricmp("-p", argv[4]) == 0 && strlen(argv[5]) > 0 && strlen(argv[6]) > 0) {
-            startPt = atoll(argv[5]);
-            endPt = atoll(argv[6]);
-            timeout_arg = atol(argv[3]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Tcp, FALSE, timeout_arg);
-        }
-        else ShowSyntax();
-    }
-    else if(argc == 8) {
-        if(stricmp("-dbg", argv[2]) && stricmp("-p", argv[3]) == 0 && strlen(argv[4]) > 0 && strlen(argv[5]) > 0 && stricmp("-proto", argv[6]) == 0 && 
-        stricmp("tcp", argv[7]) == 0) {
-            startPt = atoll(argv[4]);
-            endPt = atoll(argv[5]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Tcp, TRUE, DEFAULT_TIMEOUT);
-        }
-        else if(stricmp("-dbg", argv[2]) && stricmp("-p", argv[3]) == 0 && strlen(argv[4]) > 0 && strlen(argv[5]) > 0 && stricmp("-proto", argv[6]) == 0 && 
-        stricmp("udp", argv[7]) == 0) {
-            startPt = atoll(argv[4]);
-            endPt = atoll(argv[5]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Udp, TRUE, DEFAULT_TIMEOUT);
-        }
-        else if(stricmp("-dbg", argv[2]) == 0 && stricmp("-t", argv[3]) == 0 && strlen(argv[4]) > 0 && stricmp("-p", argv[5]) == 0 && strlen(argv[6]) > 0 &&
-        strlen(argv[7]) > 0) {
-            startPt = atoll(argv[6]);
-            endPt = atoll(argv[7]);
-            timeout_arg = atol(argv[4]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Tcp, TRUE, timeout_arg);
-        }
-        else if(stricmp("-t", argv[2]) == 0 && strlen(argv[3]) > 0 && stricmp("-dbg", argv[4]) == 0 && stricmp("-p", argv[5]) == 0 && strlen(argv[6]) > 0 &&
-        strlen(argv[7]) > 0) {
-            startPt = atoll(argv[6]);
-            endPt = atoll(argv[7]);
-            timeout_arg = atol(argv[3]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Tcp, TRUE, timeout_arg);
-        }
-        else ShowSyntax();
-    }
-    else if(argc == 9) {
-        if(stricmp("-t", argv[2]) == 0 && strlen(argv[3]) > 0 && stricmp("-p", argv[4]) == 0 && strlen(argv[5]) > 0 && strlen(argv[6]) > 0 && stricmp("-proto", argv[7]) == 0 && 
-        stricmp("tcp", argv[8]) == 0) {
-            startPt = atoll(argv[5]);
-            endPt = atoll(argv[6]);
-            timeout_arg = atol(argv[3]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Tcp, FALSE, timeout_arg);
-        }
-        else if(stricmp("-t", argv[2]) == 0 && strlen(argv[3]) > 0 && stricmp("-p", argv[4]) == 0 && strlen(argv[5]) > 0 && strlen(argv[6]) > 0 && stricmp("-proto", argv[7]) == 0 && 
-        stricmp("udp", argv[8]) == 0) {
-            startPt = atoll(argv[5]);
-            endPt = atoll(argv[6]);
-            timeout_arg = atol(argv[3]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Udp, FALSE, timeout_arg);
-        }
-        else ShowSyntax();
-    }
-    else if(argc == 10) {
-        if(stricmp("-dbg", argv[2]) == 0 && stricmp("-t", argv[3]) == 0 && strlen(argv[4]) > 0 && stricmp("-p", argv[5]) == 0 && strlen(argv[6]) > 0 && strlen(argv[7]) > 0 &&
-        stricmp("-proto", argv[8]) == 0 && stricmp("tcp", argv[9]) == 0) {
-            startPt = atoll(argv[6]);
-            endPt = atoll(argv[7]);
-            timeout_arg = atol(argv[4]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Tcp, TRUE, timeout_arg);
-        }
-        else if(stricmp("-dbg", argv[2]) == 0 && stricmp("-t", argv[3]) == 0 && strlen(argv[4]) > 0 && stricmp("-p", argv[5]) == 0 && strlen(argv[6]) > 0 && strlen(argv[7]) > 0 &&
-        stricmp("-proto", argv[8]) == 0 && stricmp("udp", argv[9]) == 0) {
-            startPt = atoll(argv[6]);
-            endPt = atoll(argv[7]);
-            timeout_arg = atol(argv[4]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Udp, TRUE, timeout_arg);
-        }
-        else if(stricmp("-t", argv[2]) == 0 && strlen(argv[3]) > 0 && stricmp("-dbg", argv[4]) == 0 && stricmp("-p", argv[5]) == 0 && strlen(argv[6]) > 0 && strlen(argv[7]) > 0 &&
-        stricmp("-proto", argv[8]) == 0 && stricmp("tcp", argv[9]) == 0) {
-            startPt = atoll(argv[6]);
-            endPt = atoll(argv[7]);
-            timeout_arg = atol(argv[3]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Tcp, TRUE, timeout_arg);
-        }
-        else if(stricmp("-t", argv[2]) == 0 && strlen(argv[3]) > 0 && stricmp("-dbg", argv[4]) == 0 && stricmp("-p", argv[5]) == 0 && strlen(argv[6]) > 0 && strlen(argv[7]) > 0 &&
-        stricmp("-proto", argv[8]) == 0 && stricmp("udp", argv[9]) == 0) {
-            startPt = atoll(argv[6]);
-            endPt = atoll(argv[7]);
-            timeout_arg = atol(argv[3]);
-            ports = arePortsCorrect(startPt, endPt);
-            if(ports == TRUE) ScanTarget(startPt, endPt, argv[1], Udp, TRUE, timeout_arg);
-        }
-        else ShowSyntax();
-    }
-    else if(argc > 10) ShowSyntax();
-
-    WSACleanup();                                              // Deallocates memory to the winsock2 library.
-}
+#ifdef _WIN32
+#define _WIN32_WINNT 0x0600                                         // ConnectEx completion ports and inet_ntop need vista or later.
+#include <winsock2.h>
+#include <windows.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <WS2tcpip.h>
+#include <mswsock.h>
+#include <windns.h>
+#include <winerror.h>
+#include <time.h>
+#else
+#define _GNU_SOURCE                                                 // sendmmsg and recvmmsg.
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/errqueue.h>
+
+typedef int SOCKET;                                                 // Posix sockets are plain file descriptors.
+typedef int BOOL;
+typedef uint16_t WORD;
+typedef uint32_t ULONG;
+typedef uint64_t UINT64;
+
+#define TRUE 1
+#define FALSE 0
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#define stricmp strcasecmp
+#define WSACleanup()
+#endif
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION LOCK;
+typedef HANDLE THREAD;
+typedef DWORD (WINAPI *THREAD_ROUTINE)(void *arg);
+#define THREAD_RETURN DWORD WINAPI
+#else
+typedef pthread_mutex_t LOCK;
+typedef pthread_t THREAD;
+typedef void *(*THREAD_ROUTINE)(void *arg);
+#define THREAD_RETURN void *
+#endif
+
+#define BANNER_BUFFER_SIZE 1024                                     // Reply bytes kept per banner connection.
+#define BANNER_TEXT_SIZE 160                                        // Longest banner written out.
+#define BANNER_HEX_BYTES 16                                         // Leading bytes of a binary reply shown in hex.
+#define STATS_RTT_BUCKETS 512                                       // Log linear round trip buckets, 16 per power of two.
+
+typedef enum Protocol {
+    Tcp,
+    Udp,
+} Protocol;
+
+typedef enum PortState {
+    PortOpen,
+    PortClosed,
+    PortFiltered,
+    PortOpenFiltered,
+} PortState;
+
+typedef struct TARGET_RANGE {
+    ULONG first;                                                    // Host byte order, inclusive.
+    ULONG last;
+    size_t before;                                                  // Addresses in the blocks ahead of this one.
+} TARGET_RANGE, *PTARGET_RANGE;
+
+typedef struct TARGET_RANGE6 {
+    UINT64 high;                                                    // The upper 64 bits in host byte order, shared by the block.
+    UINT64 first;                                                   // The lower 64 bits, inclusive.
+    UINT64 last;
+    size_t before;
+} TARGET_RANGE6, *PTARGET_RANGE6;
+
+typedef struct TARGET_SET {
+    PTARGET_RANGE ranges;                                           // Sorted and disjoint once finished.
+    size_t rangeCount;
+    size_t capacity;
+    PTARGET_RANGE6 ranges6;                                         // The same for ipv6, numbered after every ipv4 address.
+    size_t range6Count;
+    size_t capacity6;
+    size_t first6;                                                  // Position of the first ipv6 address.
+    size_t count;                                                   // Addresses across every block.
+} TARGET_SET, *PTARGET_SET;
+
+typedef union TARGET_ADDRESS {
+    struct sockaddr base;
+    struct sockaddr_in v4;
+    struct sockaddr_in6 v6;
+} TARGET_ADDRESS, *PTARGET_ADDRESS;
+
+typedef struct TARGET_ITERATOR {
+    PTARGET_SET set;
+    size_t range;
+    UINT64 offset;
+} TARGET_ITERATOR, *PTARGET_ITERATOR;
+
+typedef struct PERMUTATION {
+    UINT64 size;                                                    // Elements ordered, zero when probing in order.
+    UINT64 prime;                                                   // Smallest prime above size.
+    UINT64 generator;                                               // Primitive root modulo prime.
+    UINT64 first;                                                   // The value at this shard's first position.
+    UINT64 stride;                                                  // generator^shardCount, the step between this shard's positions.
+    UINT64 positions;                                               // Positions of the cycle that belong to this shard.
+} PERMUTATION, *PPERMUTATION;
+
+typedef struct PROBE_CURSOR {
+    UINT64 position;
+    UINT64 value;                                                   // The cycle value at position, random order only.
+} PROBE_CURSOR, *PPROBE_CURSOR;
+
+typedef struct SCAN_CONFIG {
+    size_t portStart;
+    size_t portEnd;
+    Protocol pt;
+    BOOL debug;
+    long timeout;
+    int retries;
+    size_t concurrency;
+    size_t threads;
+    TARGET_SET targets;
+    char *targetFile;
+    char *exclude;
+    char *excludeFile;
+    BOOL synScan;
+    size_t batch;
+    char *ringInterface;
+    char *bench;
+    ULONG dnsServer;
+    WORD dnsPort;
+    BOOL randomOrder;
+    UINT64 seed;
+    BOOL seedSet;
+    size_t shard;
+    size_t shardCount;
+    PERMUTATION permutation;                                        // The probe order, set up once the targets are known.
+    char *jsonFile;
+    char *csvFile;
+    char *binaryFile;
+    struct RESULT_STORE *results;                                   // Where every probe outcome is recorded.
+    BOOL banners;
+    size_t bannerConcurrency;
+    long bannerTimeout;
+    struct BANNER_STAGE *bannerStage;                               // Takes open tcp ports while -banners is on.
+    double rate;                                                    // Probes per second caps, zero for none.
+    double hostRate;
+    double netRate;
+    struct RATE_LIMITER *limiter;                                   // Paces every probe while a cap is set.
+    char *journalFile;                                              // Where results and progress are checkpointed, or NULL.
+    BOOL resume;                                                    // The journal holds an earlier run of this scan.
+    int argc;                                                       // The command line, saved in the journal for -resume.
+    char **argv;
+    BOOL progress;                                                  // Print a progress line to stderr every second.
+    WORD metricsPort;                                               // Serve prometheus metrics on this loopback port, zero for none.
+    struct STATS *stats;                                            // Counters every probe thread adds to.
+} SCAN_CONFIG, *PSCAN_CONFIG;
+
+typedef enum ResolverState {
+    DnsPending,
+    DnsResolved,
+    DnsFailed,
+} ResolverState;
+
+typedef struct RESOLVER_ENTRY {
+    char *name;
+    ResolverState state;
+    ULONG *addresses;                                               // Every A record, in network byte order.
+    size_t addressCount;
+    unsigned char (*addresses6)[16];                                // Every AAAA record.
+    size_t address6Count;
+    UINT64 expires;                                                 // When the answer stops being served from the cache.
+    BOOL listed;                                                    // Already added to the target list.
+    struct RESOLVER_ENTRY *next;                                    // Hash chain.
+    struct RESOLVER_ENTRY *queueNext;                               // Names waiting for a query slot.
+} RESOLVER_ENTRY, *PRESOLVER_ENTRY;
+
+typedef struct RESOLVER_QUERY {
+    PRESOLVER_ENTRY entry;                                          // NULL while the slot is free.
+    int attempt;
+    int waiting;                                                    // Bit 0 while the A answer is missing, bit 1 for AAAA.
+    ULONG ttl;                                                      // Lowest record ttl seen so far.
+    UINT64 deadline;
+    unsigned char question[255];                                    // The name in wire format, which dns caps at 255 bytes.
+    size_t questionLength;
+} RESOLVER_QUERY, *PRESOLVER_QUERY;
+
+typedef struct DNS_RESOLVER {
+    SOCKET s;
+    struct sockaddr_in server;
+    PRESOLVER_ENTRY *buckets;                                       // Cache of every name asked for.
+    PRESOLVER_ENTRY queueHead;
+    PRESOLVER_ENTRY queueTail;
+    PRESOLVER_QUERY queries;
+    size_t window;
+    size_t inFlight;
+    WORD salt;
+    UINT64 timeoutUs;
+} DNS_RESOLVER, *PDNS_RESOLVER;
+
+typedef struct TARGET_LOADER {
+    PSCAN_CONFIG config;
+    TARGET_SET excludes;
+    DNS_RESOLVER resolver;
+    BOOL async;                                                     // Names go through the resolver rather than the system.
+    char **names;                                                   // Host names in the order given.
+    PRESOLVER_ENTRY *entries;
+    size_t nameCount;
+    size_t nameCapacity;
+} TARGET_LOADER, *PTARGET_LOADER;
+
+typedef struct STATS_SHARD {
+    UINT64 sent;                                                    // Probes put on the wire, retransmits included.
+    UINT64 replies;
+    UINT64 timeouts;
+    UINT64 retransmits;
+    UINT64 errors;                                                  // Sockets that could not be opened, connected or sent on.
+    UINT64 skipped;                                                 // Probes a resumed scan already had a result for.
+    UINT64 rttCount;
+    UINT64 rttSum;                                                  // Microseconds.
+    UINT64 rtt[STATS_RTT_BUCKETS];                                  // See StatsBucket.
+} STATS_SHARD, *PSTATS_SHARD;                                       // Written by one thread only, a whole number of cache lines.
+
+typedef struct STATS {
+    PSCAN_CONFIG config;
+    PSTATS_SHARD shards;
+    size_t shardCount;                                              // Shards handed out so far.
+    size_t capacity;
+    UINT64 total;                                                   // Probes the scan plans to send.
+    UINT64 started;
+    UINT64 lastAt;                                                  // When the last progress line was worked out.
+    UINT64 lastSent;
+    UINT64 lastDone;
+    double pace;                                                    // Smoothed first probes per second, for the eta.
+    SOCKET listener;                                                // The -metrics socket, INVALID_SOCKET when off.
+    THREAD reporter;
+    BOOL reporting;
+    size_t closing;
+} STATS, *PSTATS;
+
+typedef struct PROBE_SLOT {
+    SOCKET s;
+    size_t target;                                                  // Index into the target set.
+    WORD port;
+    int attempt;
+    UINT64 sentAt;
+    UINT64 deadline;
+    size_t heapIndex;                                               // Position in the deadline heap, NOT_QUEUED when absent.
+    struct PROBE_SLOT *next;                                        // Free list link.
+#ifdef _WIN32
+    OVERLAPPED ov;
+    WSABUF wsaBuf;
+    char recvByte;
+    BOOL cancelled;
+#endif
+} PROBE_SLOT, *PPROBE_SLOT;
+
+typedef struct RETRY {
+    size_t target;
+    WORD port;
+    int attempt;
+} RETRY, *PRETRY;
+
+typedef struct RTT_ENTRY {
+    size_t target;
+    UINT64 srtt;
+    UINT64 rttvar;
+    UINT64 samples;
+} RTT_ENTRY, *PRTT_ENTRY;
+
+typedef struct SCAN_ENGINE {
+    PSCAN_CONFIG config;
+    PPROBE_SLOT slots;
+    PPROBE_SLOT freeList;
+    PPROBE_SLOT *heap;                                              // In-flight probes ordered by deadline.
+    size_t heapSize;
+    PRETRY retries;                                                 // Ring of timed out probes waiting to be sent again.
+    size_t retryHead;
+    size_t retryCount;
+    PRTT_ENTRY rtt;                                                 // Round trip estimates per target.
+    double cwnd;
+    double ssthresh;
+    UINT64 lastBackoff;
+    size_t window;
+    size_t inFlight;
+    UINT64 initialTimeoutUs;
+    UINT64 paceAt;                                                  // When the held probe may go, in ns, zero when not pacing.
+    BOOL reserved;                                                  // A send slot was reserved for reservedTarget at paceAt.
+    size_t reservedTarget;
+    PSTATS_SHARD stats;
+#ifdef _WIN32
+    HANDLE iocp;
+    LPFN_CONNECTEX connectEx;
+#else
+    int epfd;
+#endif
+} SCAN_ENGINE, *PSCAN_ENGINE;
+
+typedef struct SCAN_WORKER {
+    LOCK lock;                                                      // Guards next and end, which thieves shrink from the back.
+    size_t next;
+    size_t end;
+    THREAD thread;
+    SCAN_ENGINE engine;
+    struct SCAN_SCHEDULER *scheduler;
+} SCAN_WORKER, *PSCAN_WORKER;
+
+typedef struct SCAN_SCHEDULER {
+    PSCAN_CONFIG config;
+    PSCAN_WORKER workers;
+    size_t workerCount;
+    size_t portCount;
+    size_t window;
+} SCAN_SCHEDULER, *PSCAN_SCHEDULER;
+
+#pragma pack(push, 1)
+typedef struct IP_HEADER {
+    unsigned char versionLength;
+    unsigned char tos;
+    WORD totalLength;
+    WORD id;
+    WORD fragment;
+    unsigned char ttl;
+    unsigned char protocol;
+    WORD checksum;
+    ULONG source;
+    ULONG destination;
+} IP_HEADER, *PIP_HEADER;
+
+typedef struct TCP_HEADER {
+    WORD sourcePort;
+    WORD destinationPort;
+    ULONG sequence;
+    ULONG acknowledgement;
+    unsigned char dataOffset;
+    unsigned char flags;
+    WORD window;
+    WORD checksum;
+    WORD urgent;
+} TCP_HEADER, *PTCP_HEADER;
+
+typedef struct SYN_PACKET {
+    IP_HEADER ip;
+    TCP_HEADER tcp;
+    unsigned char options[4];                                       // A single MSS option, like a normal SYN carries.
+} SYN_PACKET, *PSYN_PACKET;
+
+typedef struct SYN_SEGMENT {                                        // An ipv6 SYN, the kernel adds the ip header and checksum.
+    TCP_HEADER tcp;
+    unsigned char options[4];
+} SYN_SEGMENT, *PSYN_SEGMENT;
+#pragma pack(pop)
+
+typedef struct PACKET_RING {
+    SOCKET s;
+    unsigned char *map;                                             // Frames shared with the kernel.
+    size_t frameSize;
+    size_t frameCount;
+    size_t current;
+} PACKET_RING, *PPACKET_RING;
+
+typedef struct NEXT_HOP {
+    ULONG key;                                                      // The next hop in ring mode, else the destination's /24.
+    BOOL valid;
+    UINT64 expires;                                                 // A failed lookup is not tried again before this, NowMicros.
+    ULONG source;                                                   // Local address the kernel would send from.
+    unsigned char mac[6];                                           // Next hop hardware address, ring mode only.
+} NEXT_HOP, *PNEXT_HOP;
+
+typedef struct ROUTE_ENTRY {
+    ULONG destination;                                              // All in network byte order, as /proc/net/route has them.
+    ULONG mask;
+    ULONG gateway;                                                  // Zero for an on-link route.
+} ROUTE_ENTRY, *PROUTE_ENTRY;
+
+typedef struct SYN_SCANNER {
+    PSCAN_CONFIG config;
+    SOCKET sendSocket;
+    SOCKET recvSocket;
+    PSYN_PACKET ring;                                               // Packets waiting for the next batched send.
+    size_t batch;
+    size_t pending;
+    size_t portCount;
+    WORD sourcePort;
+    UINT64 secret;
+    UINT64 sendFinished;
+    PSTATS_SHARD sendStats;                                         // One shard per thread, the sender's and the receiver's.
+    PSTATS_SHARD replyStats;
+#ifdef __linux__
+    atomic_int sending;
+    struct mmsghdr *messages;
+    struct iovec *vectors;
+    struct sockaddr_in *destinations;
+    PACKET_RING txRing;
+    PACKET_RING rxRing;
+    PNEXT_HOP hops;                                                 // Routes looked up so far.
+    PROUTE_ENTRY routes;                                            // The ring interface's routes, read once.
+    size_t routeCount;
+    BOOL ringLoopback;                                              // Loopback frames carry an all zero address.
+    unsigned char localMac[6];
+    SOCKET socket6;                                                 // Sends and receives ipv6 segments, INVALID_SOCKET without ipv6 targets.
+    PSYN_SEGMENT segments6;                                         // The ipv6 batch, flushed alongside the ipv4 one.
+    size_t pending6;
+    struct mmsghdr *messages6;
+    struct iovec *vectors6;
+    struct sockaddr_in6 *destinations6;
+#endif
+} SYN_SCANNER, *PSYN_SCANNER;
+
+typedef struct UDP_PAYLOAD {
+    WORD port;
+    const char *name;
+    const char *data;
+    size_t length;
+} UDP_PAYLOAD, *PUDP_PAYLOAD;
+
+typedef struct UDP_SCANNER {
+    PSCAN_CONFIG config;
+    SOCKET s;
+    int family;                                                     // AF_INET6 makes s dual stack, for ipv6 targets.
+    unsigned char *payloadIndex;                                    // Port to UDP_PAYLOADS entry plus one, zero for an empty probe.
+    size_t portCount;
+    size_t batch;
+    size_t pending;
+    int round;                                                      // Sends after the first round are retransmits.
+    PSTATS_SHARD sendStats;                                         // One shard per thread, the sender's and the listener's.
+    PSTATS_SHARD replyStats;
+#ifdef __linux__
+    atomic_int sending;
+    atomic_ullong answers;
+    struct mmsghdr *messages;
+    struct iovec *vectors;
+    PTARGET_ADDRESS destinations;
+#endif
+} UDP_SCANNER, *PUDP_SCANNER;
+
+typedef struct RESULT_BLOCK {
+    struct RESULT_BLOCK *next;                                      // The block filled before this one.
+    size_t used;                                                    // Bitmaps handed out, bumped atomically.
+} RESULT_BLOCK, *PRESULT_BLOCK;                                     // Followed by a key per bitmap, then the bitmaps.
+
+typedef struct JOURNAL_HEADER {
+    char magic[4];                                                  // CPSJ.
+    ULONG version;
+    UINT64 fingerprint;                                             // The targets, ports and probe order the journal belongs to.
+    UINT64 hostBytes;
+    UINT64 blocks;                                                  // Result blocks stored after the header.
+    UINT64 settled;                                                 // Sender progress that has had its whole reply wait.
+    UINT64 saved;                                                   // Unix time of the last checkpoint.
+    ULONG finished;
+    ULONG argc;                                                     // The command line follows, NUL separated.
+} JOURNAL_HEADER, *PJOURNAL_HEADER;
+
+typedef struct JOURNAL {
+    PJOURNAL_HEADER header;                                         // Mapped over the first JOURNAL_HEADER_SIZE bytes.
+#ifdef _WIN32
+    HANDLE file;
+#else
+    int file;
+#endif
+    size_t sent;                                                    // Sender progress, published as probes go out.
+    size_t pending;                                                 // Progress seen at pendingAt, settled once the reply wait passes.
+    UINT64 pendingAt;
+    UINT64 settleUs;
+    UINT64 savedAt;
+} JOURNAL, *PJOURNAL;
+
+typedef struct RESULT_EVENT {
+    size_t sequence;                                                // The ring lap the cell is ready for, see RingClaim.
+    size_t target;                                                  // Index into the target set.
+    ULONG time;                                                     // Unix seconds.
+    WORD port;
+    unsigned char state;
+    const char *service;                                            // Set with banner, which the writer frees.
+    char *banner;
+} RESULT_EVENT, *PRESULT_EVENT;
+
+typedef struct RESULT_STORE {
+    PSCAN_CONFIG config;
+    size_t *keys;                                                   // Target index plus one per host slot, zero while free.
+    size_t *bitmaps;                                                // Two bits per port for the host in the same slot.
+    size_t mask;
+    size_t limit;                                                   // Hosts the table takes before results are only streamed.
+    size_t hosts;
+    size_t hostBytes;                                               // Bitmap size, rounded up to a cache line.
+    size_t blockHosts;                                              // Bitmaps per block.
+    size_t blockBitmaps;                                            // Offset of the first bitmap in a block.
+    size_t arena;                                                   // The PRESULT_BLOCK bitmaps are carved from.
+    LOCK arenaLock;                                                 // Only taken to swap in a fresh block.
+    PRESULT_EVENT events;                                           // Ring of results waiting for the writer thread.
+    size_t head;
+    size_t tail;
+    size_t counts[4];                                               // Ports classified, per PortState.
+    size_t overflow;
+    size_t closing;
+    BOOL text;                                                      // Print the readable lines on stdout.
+    FILE *json;
+    FILE *csv;
+    FILE *binary;
+    THREAD writer;
+    BOOL writing;                                                   // The writer thread was started.
+    PJOURNAL journal;                                               // Backs the blocks with a mapped file under -journal.
+} RESULT_STORE, *PRESULT_STORE;
+
+typedef enum BannerPhase {
+    BannerConnecting,
+    BannerListening,                                                // Waiting for services that speak first.
+    BannerProbing,                                                  // A hello was sent, waiting for the answer.
+} BannerPhase;
+
+typedef struct BANNER_JOB {
+    size_t sequence;                                                // The ring lap the cell is ready for, see RingClaim.
+    SOCKET s;                                                       // The discovery connection, INVALID_SOCKET to connect again.
+    size_t target;
+    WORD port;
+} BANNER_JOB, *PBANNER_JOB;
+
+typedef struct BANNER_CONNECTION {
+    SOCKET s;                                                       // INVALID_SOCKET while the slot is free.
+    size_t target;
+    WORD port;
+    BannerPhase phase;
+    UINT64 deadline;                                                // When the current phase gives up.
+    UINT64 expires;                                                 // When the whole budget for the port runs out.
+    size_t length;
+    unsigned char buffer[BANNER_BUFFER_SIZE];
+} BANNER_CONNECTION, *PBANNER_CONNECTION;
+
+typedef struct BANNER_SIGNATURE {
+    const char *service;
+    const char *prefix;                                             // Bytes the reply starts with.
+    size_t prefixLength;
+    const char *contains;                                           // Text that must also be in the reply, NULL for none.
+    const char *field;                                              // The banner is the rest of the line after this, NULL for the first line.
+    BOOL binary;                                                    // Show the first bytes in hex instead of text.
+} BANNER_SIGNATURE, *PBANNER_SIGNATURE;
+
+typedef struct BANNER_PROBE {
+    WORD port;                                                      // Zero for the probe every other port gets.
+    const char *name;
+    const char *data;
+    size_t length;
+} BANNER_PROBE, *PBANNER_PROBE;
+
+typedef struct BANNER_STAGE {
+    PSCAN_CONFIG config;
+    PBANNER_JOB jobs;                                               // Open ports handed over by discovery.
+    size_t head;
+    size_t tail;
+    size_t dropped;                                                 // Open ports offered while the queue was full.
+    size_t closing;
+    PBANNER_CONNECTION connections;
+    struct pollfd *polls;
+    size_t window;
+    size_t active;
+    UINT64 timeoutUs;
+    short first[256];                                               // First signature for each leading byte, -1 for none.
+    short *chain;                                                   // Next signature with the same leading byte.
+    unsigned char *probeIndex;                                      // Port to BANNER_PROBES entry plus one, zero for the default.
+    size_t grabbed;
+    THREAD thread;
+    BOOL running;
+} BANNER_STAGE, *PBANNER_STAGE;
+
+typedef struct RATE_LIMITER {
+    UINT64 globalInterval;                                          // Nanoseconds between probes, zero when uncapped.
+    UINT64 hostInterval;
+    UINT64 netInterval;
+    UINT64 global;                                                  // When the next probe is due, see RateTake.
+    UINT64 *hosts;                                                  // The same per target and per /24 or /64, hashed.
+    UINT64 *nets;
+    PTARGET_SET targets;                                            // Maps a target to its network.
+} RATE_LIMITER, *PRATE_LIMITER;
+
+typedef struct BENCH_OUTCOME {
+    UINT64 micros;                                                  // How long discovery took, setup left out.
+    size_t checked;                                                 // Ports whose state the benchmark target controls.
+    size_t correct;
+    size_t falseOpen;                                               // Reported open, served closed or filtered.
+    size_t falseClosed;
+    size_t falseFiltered;                                           // Served open or closed, reported filtered or never classified.
+} BENCH_OUTCOME, *PBENCH_OUTCOME;
+
+typedef struct BENCH_SERVICE {
+    const char *service;                                            // What the banner stage should name it, "none" for no banner.
+    const char *greeting;                                           // Sent on accept.
+    size_t greetingLength;
+    const char *reply;                                              // Sent for every hello that arrives.
+    size_t replyLength;
+} BENCH_SERVICE, *PBENCH_SERVICE;
+
+void InitWinSock();
+void ShowSyntax();
+int ResolveDnsAddress(char *dnsQuery, Protocol pt, char **output, size_t bufferSize);
+BOOL ResolverServer(PSCAN_CONFIG config, struct sockaddr_in *server);
+BOOL ResolverInit(PDNS_RESOLVER resolver, PSCAN_CONFIG config);
+PRESOLVER_ENTRY ResolverQueue(PDNS_RESOLVER resolver, const char *name);
+void ResolverRun(PDNS_RESOLVER resolver);
+void ResolverFree(PDNS_RESOLVER resolver);
+void TargetAddRange(PTARGET_SET set, ULONG first, ULONG last);
+void TargetFinish(PTARGET_SET set, PTARGET_SET excludes);
+void TargetAddRange6(PTARGET_SET set, UINT64 high, UINT64 first, UINT64 last);
+ULONG TargetAt(PTARGET_SET set, size_t index);
+size_t TargetIndex(PTARGET_SET set, ULONG ipAddress);
+void TargetAt6(PTARGET_SET set, size_t index, unsigned char *address);
+size_t TargetIndex6(PTARGET_SET set, const unsigned char *address);
+int TargetAddress(PTARGET_SET set, size_t index, WORD port, int family, PTARGET_ADDRESS address);
+size_t TargetFind(PTARGET_SET set, const struct sockaddr *address);
+void TargetText(PTARGET_SET set, size_t index, char *text);
+BOOL TargetNext(PTARGET_ITERATOR iterator, ULONG *ipAddress);
+void TargetFree(PTARGET_SET set);
+BOOL LoadTargets(PSCAN_CONFIG config, char *list);
+void TargetBenchmark(PSCAN_CONFIG config);
+void PermutationInit(PPERMUTATION permutation, UINT64 size, UINT64 seed, size_t shard, size_t shardCount);
+UINT64 ProbeCount(PSCAN_CONFIG config);
+void ProbeSeek(PSCAN_CONFIG config, PPROBE_CURSOR cursor, UINT64 position);
+BOOL ProbeNext(PSCAN_CONFIG config, PPROBE_CURSOR cursor, UINT64 end, size_t *probe);
+void PermutationBenchmark(PSCAN_CONFIG config);
+UINT64 NowNanos();
+UINT64 NowMicros();
+void LockInit(LOCK *lock);
+void LockAcquire(LOCK *lock);
+void LockRelease(LOCK *lock);
+void LockFree(LOCK *lock);
+BOOL ThreadStart(THREAD *thread, THREAD_ROUTINE routine, void *arg);
+void ThreadJoin(THREAD thread);
+size_t AtomicLoad(volatile size_t *value);
+void AtomicStore(volatile size_t *target, size_t value);
+size_t AtomicAdd(volatile size_t *target, size_t value);
+BOOL AtomicCas(volatile size_t *target, size_t expected, size_t desired);
+UINT64 AtomicLoad64(volatile UINT64 *value);
+BOOL AtomicCas64(volatile UINT64 *target, UINT64 expected, UINT64 desired);
+unsigned char AtomicOrByte(volatile unsigned char *target, unsigned char value);
+BOOL AtomicCasByte(volatile unsigned char *target, unsigned char expected, unsigned char desired);
+void *RingClaim(volatile size_t *tail, void *cells, size_t stride, size_t capacity, size_t *position);
+void *RingTake(void *cells, size_t stride, size_t capacity, size_t head);
+size_t CpuCount();
+size_t ClampConcurrency(size_t requested);
+BOOL ResultInit(PRESULT_STORE store, PSCAN_CONFIG config);
+int ResultGet(PRESULT_STORE store, size_t target, WORD port);
+BOOL ResultSet(PRESULT_STORE store, size_t target, WORD port, PortState state);
+void ResultBanner(PRESULT_STORE store, size_t target, WORD port, const char *service, char *banner);
+THREAD_RETURN ResultWriter(void *arg);
+void ResultClose(PRESULT_STORE store);
+void ResultBenchmark(PSCAN_CONFIG config);
+BOOL ReportPortState(PSCAN_CONFIG config, size_t target, WORD port, PortState state);
+char **JournalArguments(const char *path, int *argc);
+BOOL JournalOpen(PRESULT_STORE store);
+PRESULT_BLOCK JournalBlock(PJOURNAL journal, UINT64 index);
+size_t JournalStart(PSCAN_CONFIG config);
+void JournalCheckpoint(PRESULT_STORE store);
+void JournalReplay(PSCAN_CONFIG config);
+void JournalClose(PRESULT_STORE store);
+BOOL EngineInit(PSCAN_ENGINE engine, PSCAN_CONFIG config, size_t window);
+size_t EngineCapacity(PSCAN_ENGINE engine);
+int EngineLaunch(PSCAN_ENGINE engine, size_t target, WORD port);
+void EngineRelaunch(PSCAN_ENGINE engine);
+void EnginePoll(PSCAN_ENGINE engine);
+void EngineFree(PSCAN_ENGINE engine);
+BOOL SchedulerTake(PSCAN_WORKER worker, size_t *first, size_t *last);
+THREAD_RETURN ScanWorker(void *arg);
+WORD Checksum(const void *data, size_t length, ULONG sum);
+ULONG SynCookie(PSYN_SCANNER scanner, ULONG ipAddress, WORD port);
+ULONG SynCookie6(PSYN_SCANNER scanner, const unsigned char *address, WORD port);
+BOOL SynSetup(PSYN_SCANNER scanner, PSCAN_CONFIG config);
+void SynBuildPacket(PSYN_SCANNER scanner, size_t target, WORD port, ULONG id);
+void SynFlush(PSYN_SCANNER scanner);
+void SynHandleReply(PSYN_SCANNER scanner, const unsigned char *buffer, size_t length);
+void SynTeardown(PSYN_SCANNER scanner);
+THREAD_RETURN SynSender(void *arg);
+THREAD_RETURN SynReceiver(void *arg);
+void SynScan(PSCAN_CONFIG config);
+void SynBenchmark(PSCAN_CONFIG config);
+void SleepMicros(UINT64 micros);
+THREAD_RETURN UdpSender(void *arg);
+THREAD_RETURN UdpListener(void *arg);
+void UdpScan(PSCAN_CONFIG config);
+BOOL BannerInit(PBANNER_STAGE stage, PSCAN_CONFIG config);
+BOOL BannerOffer(PBANNER_STAGE stage, size_t target, WORD port, SOCKET s);
+THREAD_RETURN BannerWorker(void *arg);
+void BannerClose(PBANNER_STAGE stage);
+BOOL StatsInit(PSTATS stats, PSCAN_CONFIG config);
+PSTATS_SHARD StatsShard(PSTATS stats);
+void StatsMerge(PSTATS stats, PSTATS_SHARD merged);
+void StatsLine(PSTATS stats, FILE *output);
+THREAD_RETURN StatsReporter(void *arg);
+void StatsClose(PSTATS stats);
+BOOL RateInit(PRATE_LIMITER limiter, PSCAN_CONFIG config);
+UINT64 RateReserve(PRATE_LIMITER limiter, size_t target);
+void RateWait(UINT64 at);
+void RateFree(PRATE_LIMITER limiter);
+void RateBenchmark(PSCAN_CONFIG config);
+void ConnectScan(PSCAN_CONFIG config);
+void ScanRun(PSCAN_CONFIG config);
+void BenchTarget(PSCAN_CONFIG config);
+void ScanBenchmark(PSCAN_CONFIG config);
+void BannerBenchmark(PSCAN_CONFIG config);
+void ScanTarget(char *domain, PSCAN_CONFIG config);
+
+const long DEFAULT_TIMEOUT = 200;
+const int DEFAULT_RETRIES = 2;
+const int MAX_RETRIES = 10;
+const UINT64 MIN_TIMEOUT_US = 100000;
+const UINT64 MAX_TIMEOUT_US = 3000000;
+const UINT64 MIN_RTTVAR_US = 1000;
+const double INITIAL_CWND = 64;
+const double MIN_CWND = 4;
+const size_t DEFAULT_START_PORT = 1;
+const size_t DEFAULT_END_PORT = 1024;
+const size_t MAX_PORT = 65535;
+const unsigned long MIN_PREFIX6 = 96;                               // Shortest ipv6 prefix taken, as many addresses as all of ipv4.
+const size_t DEFAULT_CONCURRENCY = 1024;
+const size_t MAX_CONCURRENCY = 65536;
+const size_t MAX_THREADS = 256;
+const size_t CHUNK_SIZE = 256;
+const size_t DEFAULT_BATCH = 64;
+const size_t MAX_BATCH = 1024;
+const size_t PACKET_RING_BLOCK = 1 << 16;
+const size_t PACKET_RING_BLOCKS = 64;
+const size_t PACKET_FRAME_SIZE = 2048;
+const double BENCH_SECONDS = 2.0;
+const size_t BENCH_OPEN_EVERY = 16;                                 // Every 16th port the scan benchmark target serves is open,
+const size_t BENCH_FILTERED_EVERY = 512;                            // and every 512th, eight ports later, drops what it is sent.
+const int BENCH_SCAN_RUNS = 3;                                      // Runs per scan mode.
+const int UDP_RETRIES = 2;
+const size_t RESOLVER_WINDOW = 256;                                 // Names queried at once.
+const size_t RESOLVER_BUCKETS = 4096;
+const UINT64 RESOLVER_TIMEOUT = 1000;                               // Milliseconds before the first resend.
+const int RESOLVER_RETRIES = 2;
+const ULONG RESOLVER_NEGATIVE_TTL = 30;                             // Seconds a failed name is remembered.
+const ULONG RESOLVER_MAX_TTL = 86400;
+const WORD RECORD_A = 1;
+const WORD RECORD_AAAA = 28;
+const size_t RESULT_MAX_HOSTS = 1 << 22;                            // Hosts the store keeps port states for.
+const size_t RESULT_BLOCK_SIZE = 4 << 20;
+const size_t RESULT_QUEUE_SIZE = 1 << 16;                           // Results buffered for the writer, a power of two.
+const UINT64 RESULT_IDLE_US = 1000;                                 // How long the writer naps when the ring is empty.
+const size_t JOURNAL_HEADER_SIZE = 1 << 16;                         // Blocks start on a windows mapping granule.
+const ULONG JOURNAL_VERSION = 1;
+const UINT64 JOURNAL_INTERVAL_US = 1000000;                         // How often progress is checkpointed.
+const UINT64 STATS_INTERVAL_US = 1000000;                           // How often -progress prints.
+const size_t STATS_EXTRA_SHARDS = 8;                                // Senders, receivers and the banner stage, beyond the workers.
+const double STATS_BOUNDS[] = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+const char *RESULT_LABELS[] = {"OPEN", "CLOSED", "FILTERED", "OPEN|FILTERED"};
+const char *RESULT_NAMES[] = {"open", "closed", "filtered", "open|filtered"};
+const size_t DEFAULT_BANNER_CONCURRENCY = 64;
+const size_t MAX_BANNER_CONCURRENCY = 4096;
+const long DEFAULT_BANNER_TIMEOUT = 2000;                           // Milliseconds a port gets to connect and answer.
+const size_t BANNER_QUEUE_SIZE = 1 << 12;                           // Open ports waiting for a connection slot, a power of two.
+const UINT64 RATE_BURST = 4;                                        // Probes a bucket may send back to back after falling behind.
+const size_t RATE_BUCKETS = 1 << 16;                                // Per target and per /24 buckets, a power of two.
+#ifdef _WIN32
+const UINT64 RATE_SPIN_NS = 2000000;                                // Waits shorter than this spin, Sleep is too coarse for them.
+#else
+const UINT64 RATE_SPIN_NS = 200000;
+#endif
+
+#define UDP_PROBE(port, name, data) {port, name, data, sizeof(data) - 1}
+
+/*
+Protocol specific udp probes. Most udp services ignore an empty datagram, but
+answer a well formed request, which is what tells an open port apart from a
+filtered one.
+*/
+const UDP_PAYLOAD UDP_PAYLOADS[] = {
+    UDP_PROBE(53, "dns", "\x43\x50\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00\x07version\x04" "bind\x00\x00\x10\x00\x03"),
+    UDP_PROBE(111, "rpcbind", "\x43\x50\x53\x4e\x00\x00\x00\x00\x00\x00\x00\x02\x00\x01\x86\xa0\x00\x00\x00\x02\x00\x00\x00\x00"
+                              "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"),
+    UDP_PROBE(123, "ntp", "\xe3\x00\x04\xfa\x00\x01\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+                          "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"),
+    UDP_PROBE(137, "netbios", "\x43\x50\x00\x10\x00\x01\x00\x00\x00\x00\x00\x00\x20" "CKAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\x00\x00\x21\x00\x01"),
+    UDP_PROBE(161, "snmp", "\x30\x29\x02\x01\x00\x04\x06public\xa0\x1c\x02\x04\x43\x50\x53\x4e\x02\x01\x00\x02\x01\x00"
+                           "\x30\x0e\x30\x0c\x06\x08\x2b\x06\x01\x02\x01\x01\x01\x00\x05\x00"),
+    UDP_PROBE(1900, "ssdp", "M-SEARCH * HTTP/1.1\r\nHOST: 239.255.255.250:1900\r\nMAN: \"ssdp:discover\"\r\nMX: 1\r\nST: ssdp:all\r\n\r\n"),
+    UDP_PROBE(5353, "mdns", "\x00\x00\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x09_services\x07_dns-sd\x04_udp\x05local\x00\x00\x0c\x00\x01"),
+    UDP_PROBE(11211, "memcached", "\x00\x01\x00\x00\x00\x01\x00\x00stats\r\n"),
+};
+#define TCP_PROBE(port, name, data) {port, name, data, sizeof(data) - 1}
+#define TLS_CLIENT_HELLO "\x16\x03\x01\x00\x6f\x01\x00\x00\x6b\x03\x03\x43\x44\x45\x46\x47\x48\x49\x4a\x4b\x4c\x4d\x4e\x4f\x50\x51\x52" \
+                         "\x53\x54\x55\x56\x57\x58\x59\x5a\x5b\x5c\x5d\x5e\x5f\x60\x61\x62\x00\x00\x16\xc0\x2f\xc0\x2b\xc0\x30\xc0\x2c\xcc\xa8" \
+                         "\xcc\xa9\xc0\x13\xc0\x09\x00\x9c\x00\x2f\x00\x35\x01\x00\x00\x2c\x00\x0a\x00\x08\x00\x06\x00\x1d\x00\x17\x00\x18\x00\x0b" \
+                         "\x00\x02\x01\x00\x00\x0d\x00\x16\x00\x14\x04\x03\x05\x03\x06\x03\x08\x04\x08\x05\x08\x06\x04\x01\x05\x01\x06\x01\x02\x01"
+
+/*
+Hellos sent to tcp ports that stay silent after connecting. Services that speak
+first, like ssh and smtp, have already answered by then. The tls hello is a
+plain TLS 1.2 ClientHello with common ecdhe and rsa suites and no server name.
+*/
+const BANNER_PROBE BANNER_PROBES[] = {
+    TCP_PROBE(0, "http", "GET / HTTP/1.0\r\n\r\n"),
+    TCP_PROBE(22, "ssh", "SSH-2.0-cpscan\r\n"),
+    TCP_PROBE(25, "smtp", "EHLO cpscan\r\n"),
+    TCP_PROBE(587, "smtp", "EHLO cpscan\r\n"),
+    TCP_PROBE(443, "tls", TLS_CLIENT_HELLO),
+    TCP_PROBE(465, "tls", TLS_CLIENT_HELLO),
+    TCP_PROBE(636, "tls", TLS_CLIENT_HELLO),
+    TCP_PROBE(993, "tls", TLS_CLIENT_HELLO),
+    TCP_PROBE(995, "tls", TLS_CLIENT_HELLO),
+    TCP_PROBE(8443, "tls", TLS_CLIENT_HELLO),
+};
+
+#define BANNER_MATCH(service, prefix, contains, field, binary) {service, prefix, sizeof(prefix) - 1, contains, field, binary}
+
+/*
+What a reply has to look like to name the service behind it, most specific
+first. BannerInit indexes the table by leading byte, so a reply is only
+compared with the few entries that can match it.
+*/
+const BANNER_SIGNATURE BANNER_SIGNATURES[] = {
+    BANNER_MATCH("ssh", "SSH-", NULL, NULL, FALSE),
+    BANNER_MATCH("smtp", "220", "SMTP", NULL, FALSE),
+    BANNER_MATCH("ftp", "220", "FTP", NULL, FALSE),
+    BANNER_MATCH("http", "HTTP/", "\nServer:", "\nServer:", FALSE),
+    BANNER_MATCH("http", "HTTP/", "\r\n\r\n", NULL, FALSE),
+    BANNER_MATCH("pop3", "+OK", NULL, NULL, FALSE),
+    BANNER_MATCH("imap", "* OK", NULL, NULL, FALSE),
+    BANNER_MATCH("redis", "-ERR", "command", NULL, FALSE),
+    BANNER_MATCH("vnc", "RFB ", NULL, NULL, FALSE),
+    BANNER_MATCH("tls", "\x16\x03", NULL, NULL, TRUE),                 // A handshake record, the ServerHello.
+    BANNER_MATCH("tls", "\x15\x03", NULL, NULL, TRUE),                 // An alert, still a tls endpoint.
+};
+
+#define BENCH_LISTENER(service, greeting, reply) {service, greeting, sizeof(greeting) - 1, reply, sizeof(reply) - 1}
+
+/*
+Services the banner benchmark serves on loopback, one per port from the start
+of the range. None of them closes its connections, so every banner has to be
+ended by the stage itself, by a match, a whole line or the -bt budget.
+*/
+const BENCH_SERVICE BENCH_SERVICES[] = {
+    BENCH_LISTENER("ssh", "SSH-2.0-OpenSSH_9.6\r\n", ""),
+    BENCH_LISTENER("smtp", "220 mail.example.com ESMTP SMTP ready\r\n", ""),
+    BENCH_LISTENER("ftp", "220 FTP server ready\r\n", ""),
+    BENCH_LISTENER("pop3", "+OK POP3 server ready\r\n", ""),
+    BENCH_LISTENER("imap", "* OK IMAP4rev1 server ready\r\n", ""),
+    BENCH_LISTENER("vnc", "RFB 003.008\n", ""),
+    BENCH_LISTENER("http", "", "HTTP/1.1 200 OK\r\nServer: bench/1.0\r\nContent-Length: 0\r\n\r\n"),
+    BENCH_LISTENER("redis", "", "-ERR unknown command 'GET'\r\n"),
+    BENCH_LISTENER("tls", "", "\x16\x03\x03\x00\x04\x0e\x00\x00\x00"),  // A ServerHelloDone record, binary and no newline.
+    BENCH_LISTENER("unknown", "\x00\x00\x00\x1c\xff\x53\x4d\x42\x72\x00\x00\x00\x00\x18\x53\xc8\x00\x00\x00\x00", ""),  // Binary nobody names.
+    BENCH_LISTENER("none", "", ""),                                  // Accepts and never says a word.
+};
+const char *VERSION = "0.0.2";
+const char *AUTHOR = "liquidlegs";
+
+#define ENGINE_EVENT_BATCH 256                                      // Completions drained per wait call.
+#define RTT_TABLE_SIZE 1024                                         // Targets each engine keeps round trip estimates for.
+#define NOT_QUEUED ((size_t)-1)
+#define NEXT_HOP_CACHE_SIZE 4096                                    // Routes a SYN scan remembers.
+#define RESOLVER_NAME_MAX 253                                       // Longest host name dns can carry.
+#define RESOLVER_PACKET_SIZE 4096
+
+/*
+Function initalizes the winsock2 library.
+Params:
+    None.
+returns WSADATA.
+*/
+void InitWinSock() {
+#ifdef _WIN32
+    WSADATA w;
+    int err = WSAStartup(MAKEWORD(2,2), &w);
+    if(err < 0) printf("Failed to initalize winsock\n");
+#else
+    signal(SIGPIPE, SIG_IGN);                                       // Posix sockets need no setup, but writes to reset peers must not kill us.
+#endif
+}
+
+/*
+Function resolves dns domain names to ip addresses.
+Params:
+    char        *dnsQuery       -       [The domain name to query.]
+    Protocol    pt              -       [The protocol to use.]
+    char        **output        -       [The buffer to receive the result.]
+    size_t      bufferSize      -       [The size of the receiving buffer.]
+Returns int.
+*/
+int ResolveDnsAddress(char *dnsQuery, Protocol pt, char **output, size_t bufferSize) {
+#ifdef _WIN32
+    DNS_STATUS err = 0;                                             // The return err;
+    PDNS_RECORDA record = {0};                                      // Holds the dns results.
+    struct in_addr ip;                                              // Holds the ip address in its network byte order.
+    size_t queryType = 0x00000000;                                  // Standard dns queries use tcp and udp.
+
+    if(strlen(dnsQuery) <= 0) return -1;                            // If the user enters an empty query, function fails and returns -1.
+    if(pt == Tcp) pt = 0x00000002;                                  // A tcp only dns query.
+    if(pt == Udp) return -1;                                        // Winapi doesnt support resolving address over udp only.
+
+    err = DnsQuery_A (                                              // Makes a Dns query.
+        dnsQuery,                                                   // The query string.
+        0x0001,                                                     // The type of record [A].
+        pt,                                                         // The type of query.
+        NULL,                                                       // A reserved parameter.
+        &record,                                                    // The results of the query.
+        NULL                                                        // A reserved parameter.
+    );
+
+    if(record != NULL) {
+        ip.S_un.S_addr = record->Data.A.IpAddress;                  // Stores the ip address in its network byte order.
+        size_t ipBufSize = strlen(inet_ntoa(ip));                   // Gets the length of the ip address string.
+        if(bufferSize < ipBufSize) return ipBufSize;                // Return buffer size if allocated memory isnt enough to store returned result.
+        strcat_s(*output, 30, inet_ntoa(ip));                       // Fill the buffer with the ip address.
+    }
+
+    DnsRecordListFree(record, DnsFreeRecordList);                  // Free allocated memory of the dns results.
+    return err;                                                    // Return result of the dns query.
+#else
+    struct addrinfo hints = {0};                                    // Ipv4 or ipv6, in the order the system prefers.
+    struct addrinfo *result = NULL;                                 // Holds the dns results.
+    char text[INET6_ADDRSTRLEN] = {0};
+
+    if(strlen(dnsQuery) <= 0) return -1;                            // If the user enters an empty query, function fails and returns -1.
+    if(pt == Udp) return -1;                                        // Keep the same contract as the winapi resolver.
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(dnsQuery, NULL, &hints, &result);         // Makes a Dns query through the system resolver.
+    if(err != 0 || result == NULL) return -1;
+
+    if(result->ai_family == AF_INET6) inet_ntop(AF_INET6, &((struct sockaddr_in6*)result->ai_addr)->sin6_addr, text, sizeof(text));
+    else inet_ntop(AF_INET, &((struct sockaddr_in*)result->ai_addr)->sin_addr, text, sizeof(text));
+    size_t ipBufSize = strlen(text);                                // Gets the length of the ip address string.
+    if(bufferSize <= ipBufSize) {
+        freeaddrinfo(result);
+        return ipBufSize;                                           // Return buffer size if allocated memory isnt enough to store returned result.
+    }
+    strcat(*output, text);                                          // Fill the buffer with the ip address.
+    freeaddrinfo(result);                                           // Free allocated memory of the dns results.
+    return 0;
+#endif
+}
+
+/*
+Function finds the dns server the resolver should send its queries to. An
+address given with -dns wins, otherwise the first ipv4 server the system is
+configured with is used.
+Params:
+    PSCAN_CONFIG        config      -       [The scan settings holding the -dns override.]
+    struct sockaddr_in  *server     -       [Receives the server address.]
+Returns BOOL, FALSE when no server is known.
+*/
+BOOL ResolverServer(PSCAN_CONFIG config, struct sockaddr_in *server) {
+    memset(server, 0, sizeof(struct sockaddr_in));
+    server->sin_family = AF_INET;
+    server->sin_port = htons(config->dnsPort != 0 ? config->dnsPort : 53);
+    if(config->dnsServer != 0) {
+        server->sin_addr.s_addr = config->dnsServer;
+        return TRUE;
+    }
+#ifdef _WIN32
+    char buffer[256];                                               // Room for a few server addresses.
+    DWORD length = sizeof(buffer);
+    PIP4_ARRAY servers = (PIP4_ARRAY)buffer;
+    if(DnsQueryConfig(DnsConfigDnsServerList, 0, NULL, NULL, buffer, &length) != 0 || servers->AddrCount == 0) return FALSE;
+    server->sin_addr.s_addr = servers->AddrArray[0];
+    return TRUE;
+#else
+    char line[256];
+    FILE *file = fopen("/etc/resolv.conf", "r");
+    if(file == NULL) return FALSE;
+    while(fgets(line, sizeof(line), file) != NULL) {
+        char address[64];
+        if(sscanf(line, " nameserver %63s", address) == 1 && inet_pton(AF_INET, address, &server->sin_addr) == 1) {
+            fclose(file);
+            return TRUE;
+        }
+    }
+    fclose(file);
+    return FALSE;
+#endif
+}
+
+/*
+Function hashes a host name without regard to case, for the resolver cache.
+Params:
+    const char  *name       -       [The host name.]
+Returns ULONG.
+*/
+static ULONG ResolverHash(const char *name) {
+    ULONG hash = 2166136261u;                                       // FNV-1a.
+    for(; *name != 0; name++) {
+        char c = *name >= 'A' && *name <= 'Z' ? *name + 32 : *name;
+        hash = (hash ^ (unsigned char)c) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+Function sets up the resolver socket and cache.
+Params:
+    PDNS_RESOLVER   resolver    -       [The resolver to initalize.]
+    PSCAN_CONFIG    config      -       [The scan settings holding the -dns override.]
+Returns BOOL, FALSE when there is no server to ask and names must go through the system resolver.
+*/
+BOOL ResolverInit(PDNS_RESOLVER resolver, PSCAN_CONFIG config) {
+    memset(resolver, 0, sizeof(DNS_RESOLVER));
+    resolver->s = INVALID_SOCKET;
+    if(ResolverServer(config, &resolver->server) == FALSE) return FALSE;
+
+    resolver->s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(resolver->s == INVALID_SOCKET) return FALSE;
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket(resolver->s, FIONBIO, &nonBlocking);
+#else
+    fcntl(resolver->s, F_SETFL, fcntl(resolver->s, F_GETFL) | O_NONBLOCK);
+#endif
+    int bufferSize = 1 << 20;                                       // Replies arrive in bursts when many queries are in flight.
+    setsockopt(resolver->s, SOL_SOCKET, SO_RCVBUF, (char*)&bufferSize, sizeof(bufferSize));
+
+    resolver->window = RESOLVER_WINDOW;
+    resolver->timeoutUs = RESOLVER_TIMEOUT * 1000;
+    resolver->salt = (WORD)(NowMicros() * 2654435761u >> 11);      // Query ids are not guessable from the slot number alone.
+    resolver->buckets = calloc(RESOLVER_BUCKETS, sizeof(PRESOLVER_ENTRY));
+    resolver->queries = calloc(resolver->window, sizeof(RESOLVER_QUERY));
+    return resolver->buckets != NULL && resolver->queries != NULL;
+}
+
+/*
+Function asks the resolver for a name. Names already cached and not yet expired,
+or already waiting for an answer, are not queried again.
+Params:
+    PDNS_RESOLVER   resolver    -       [The resolver to queue the name on.]
+    const char      *name       -       [The host name to resolve.]
+Returns PRESOLVER_ENTRY, the cache entry that will hold the answer.
+*/
+PRESOLVER_ENTRY ResolverQueue(PDNS_RESOLVER resolver, const char *name) {
+    PRESOLVER_ENTRY *bucket = &resolver->buckets[ResolverHash(name) % RESOLVER_BUCKETS];
+    PRESOLVER_ENTRY entry = *bucket;
+    while(entry != NULL && stricmp(entry->name, name) != 0) entry = entry->next;
+    if(entry != NULL && (entry->state == DnsPending || entry->expires > NowMicros())) return entry;
+
+    if(entry == NULL) {
+        entry = calloc(1, sizeof(RESOLVER_ENTRY));
+        entry->name = calloc(strlen(name) + 1, sizeof(char));
+        strcpy(entry->name, name);
+        entry->next = *bucket;
+        *bucket = entry;
+    }
+    entry->addressCount = 0;                                        // Expired, forget the old answer.
+    entry->address6Count = 0;
+    entry->state = DnsPending;
+    entry->queueNext = NULL;
+    if(resolver->queueTail != NULL) resolver->queueTail->queueNext = entry;
+    else resolver->queueHead = entry;
+    resolver->queueTail = entry;
+    return entry;
+}
+
+/*
+Function sends the A and AAAA questions for a query slot.
+Params:
+    PDNS_RESOLVER   resolver    -       [The resolver owning the slot.]
+    size_t          index       -       [The query slot.]
+Returns nothing.
+*/
+static void ResolverSend(PDNS_RESOLVER resolver, size_t index) {
+    PRESOLVER_QUERY query = &resolver->queries[index];
+    unsigned char packet[RESOLVER_PACKET_SIZE];
+    for(WORD type = 0; type < 2; type++) {                          // Bit 0 of the id picks A or AAAA.
+        if((query->waiting & (1 << type)) == 0) continue;
+        WORD id = htons((WORD)((index << 1 | type) ^ resolver->salt));
+        WORD flags = htons(0x0100);                                 // Standard query, recursion desired.
+        WORD one = htons(1);
+        WORD qtype = htons(type == 0 ? RECORD_A : RECORD_AAAA);
+        memset(packet, 0, 12);
+        memcpy(packet, &id, 2);
+        memcpy(packet + 2, &flags, 2);
+        memcpy(packet + 4, &one, 2);
+        memcpy(packet + 12, query->question, query->questionLength);
+        memcpy(packet + 12 + query->questionLength, &qtype, 2);
+        memcpy(packet + 14 + query->questionLength, &one, 2);    // Class IN.
+        sendto(resolver->s, (char*)packet, (int)(16 + query->questionLength), 0,
+               (struct sockaddr*)&resolver->server, sizeof(resolver->server));
+    }
+    query->deadline = NowMicros() + (resolver->timeoutUs << query->attempt);
+}
+
+/*
+Function takes the next queued name and starts querying it in a free slot.
+Params:
+    PDNS_RESOLVER   resolver    -       [The resolver to start a query on.]
+    size_t          index       -       [The free query slot.]
+Returns BOOL, FALSE when no name is waiting.
+*/
+static BOOL ResolverStart(PDNS_RESOLVER resolver, size_t index) {
+    while(resolver->queueHead != NULL) {
+        PRESOLVER_ENTRY entry = resolver->queueHead;
+        resolver->queueHead = entry->queueNext;
+        if(resolver->queueHead == NULL) resolver->queueTail = NULL;
+
+        PRESOLVER_QUERY query = &resolver->queries[index];
+        size_t length = 0;
+        BOOL valid = strlen(entry->name) <= RESOLVER_NAME_MAX;
+        for(const char *label = entry->name; valid == TRUE && *label != 0; ) {      // Encode the name as length prefixed labels.
+            const char *dot = strchr(label, '.');
+            size_t labelLength = dot != NULL ? (size_t)(dot - label) : strlen(label);
+            if(labelLength == 0 || labelLength > 63) valid = FALSE;
+            else {
+                query->question[length++] = (unsigned char)labelLength;
+                memcpy(query->question + length, label, labelLength);
+                length += labelLength;
+                label += labelLength + (dot != NULL ? 1 : 0);
+            }
+        }
+        if(valid == FALSE || length == 0) {
+            entry->state = DnsFailed;
+            entry->expires = NowMicros() + RESOLVER_NEGATIVE_TTL * 1000000;
+            continue;
+        }
+        query->question[length++] = 0;
+        query->questionLength = length;
+        query->entry = entry;
+        query->attempt = 0;
+        query->waiting = 3;
+        query->ttl = RESOLVER_MAX_TTL;
+        resolver->inFlight++;
+        ResolverSend(resolver, index);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+Function steps over a possibly compressed name in a dns message.
+Params:
+    const unsigned char *packet     -       [The dns message.]
+    size_t              length      -       [The message length.]
+    size_t              offset      -       [Where the name starts.]
+Returns size_t, the offset after the name or 0 when the message is malformed.
+*/
+static size_t DnsSkipName(const unsigned char *packet, size_t length, size_t offset) {
+    while(offset < length) {
+        if(packet[offset] == 0) return offset + 1;
+        if((packet[offset] & 0xC0) == 0xC0) return offset + 2 <= length ? offset + 2 : 0;  // A pointer always ends the name.
+        offset += packet[offset] + 1;
+    }
+    return 0;
+}
+
+/*
+Function reads one dns reply and stores every address record in its cache entry.
+Params:
+    PDNS_RESOLVER           resolver    -       [The resolver that sent the question.]
+    const unsigned char     *packet     -       [The reply.]
+    size_t                  length      -       [The reply length.]
+Returns nothing.
+*/
+static void ResolverHandleReply(PDNS_RESOLVER resolver, const unsigned char *packet, size_t length) {
+    if(length < 12 || (packet[2] & 0x80) == 0) return;             // Not a response.
+    WORD id = (WORD)((packet[0] << 8 | packet[1]) ^ resolver->salt);
+    size_t index = id >> 1, type = id & 1;
+    if(index >= resolver->window) return;
+    PRESOLVER_QUERY query = &resolver->queries[index];
+    if(query->entry == NULL || (query->waiting & (1 << type)) == 0) return;
+    if(length < 12 + query->questionLength || (packet[4] << 8 | packet[5]) != 1) return;
+    for(size_t i = 0; i < query->questionLength; i++) {             // A late reply for the slot's previous name must not match.
+        unsigned char a = packet[12 + i], b = query->question[i];
+        if(a >= 'A' && a <= 'Z') a += 32;
+        if(b >= 'A' && b <= 'Z') b += 32;
+        if(a != b) return;
+    }
+
+    PRESOLVER_ENTRY entry = query->entry;
+    size_t answers = packet[6] << 8 | packet[7];
+    size_t offset = 12 + query->questionLength + 4;
+    for(size_t i = 0; i < answers && offset < length; i++) {
+        offset = DnsSkipName(packet, length, offset);
+        if(offset == 0 || offset + 10 > length) break;
+        WORD recordType = packet[offset] << 8 | packet[offset + 1];
+        ULONG ttl = (ULONG)packet[offset + 4] << 24 | packet[offset + 5] << 16 | packet[offset + 6] << 8 | packet[offset + 7];
+        size_t dataLength = packet[offset + 8] << 8 | packet[offset + 9];
+        offset += 10;
+        if(offset + dataLength > length) break;
+        if(recordType == RECORD_A && dataLength == 4) {          // Cnames come first, the addresses they point at follow.
+            entry->addresses = realloc(entry->addresses, (entry->addressCount + 1) * sizeof(ULONG));
+            memcpy(&entry->addresses[entry->addressCount++], packet + offset, 4);
+        }
+        else if(recordType == RECORD_AAAA && dataLength == 16) {
+            entry->addresses6 = realloc(entry->addresses6, (entry->address6Count + 1) * sizeof(*entry->addresses6));
+            memcpy(entry->addresses6[entry->address6Count++], packet + offset, 16);
+        }
+        if(ttl < query->ttl) query->ttl = ttl;
+        offset += dataLength;
+    }
+
+    query->waiting &= ~(1 << type);
+    if(query->waiting != 0) return;
+    BOOL found = entry->addressCount > 0 || entry->address6Count > 0;
+    entry->state = found ? DnsResolved : DnsFailed;
+    entry->expires = NowMicros() + (UINT64)(found ? query->ttl : RESOLVER_NEGATIVE_TTL) * 1000000;
+    query->entry = NULL;
+    resolver->inFlight--;
+}
+
+/*
+Function resolves every queued name, keeping up to RESOLVER_WINDOW names in flight
+over one udp socket. Unanswered questions are sent again with a doubling wait.
+Params:
+    PDNS_RESOLVER   resolver    -       [The resolver holding the queued names.]
+Returns nothing.
+*/
+void ResolverRun(PDNS_RESOLVER resolver) {
+    unsigned char packet[RESOLVER_PACKET_SIZE];
+    for(size_t i = 0; i < resolver->window && resolver->queueHead != NULL; i++) {
+        if(resolver->queries[i].entry == NULL) ResolverStart(resolver, i);
+    }
+
+    while(resolver->inFlight > 0) {
+        UINT64 now = NowMicros(), wake = now + resolver->timeoutUs;
+        for(size_t i = 0; i < resolver->window; i++) {
+            if(resolver->queries[i].entry != NULL && resolver->queries[i].deadline < wake) wake = resolver->queries[i].deadline;
+        }
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(resolver->s, &readable);
+        struct timeval wait = {0};
+        if(wake > now) {
+            wait.tv_sec = (long)((wake - now) / 1000000);
+            wait.tv_usec = (long)((wake - now) % 1000000);
+        }
+        if(select((int)resolver->s + 1, &readable, NULL, NULL, &wait) > 0) {
+            int length;
+            while((length = recv(resolver->s, (char*)packet, sizeof(packet), 0)) > 0) {
+                ResolverHandleReply(resolver, packet, (size_t)length);
+            }
+        }
+
+        now = NowMicros();
+        for(size_t i = 0; i < resolver->window; i++) {             // Retry or give up on the silent ones, then refill.
+            PRESOLVER_QUERY query = &resolver->queries[i];
+            if(query->entry != NULL && query->deadline <= now) {
+                if(query->attempt < RESOLVER_RETRIES) {
+                    query->attempt++;
+                    ResolverSend(resolver, i);
+                    continue;
+                }
+                PRESOLVER_ENTRY entry = query->entry;
+                BOOL found = entry->addressCount > 0 || entry->address6Count > 0;
+                entry->state = found ? DnsResolved : DnsFailed;   // One of the two questions may still have been answered.
+                entry->expires = now + (UINT64)(found ? query->ttl : RESOLVER_NEGATIVE_TTL) * 1000000;
+                query->entry = NULL;
+                resolver->inFlight--;
+            }
+            if(query->entry == NULL && resolver->queueHead != NULL) ResolverStart(resolver, i);
+        }
+    }
+}
+
+/*
+Function releases the resolver socket and every cached name.
+Params:
+    PDNS_RESOLVER   resolver    -       [The resolver to free.]
+Returns nothing.
+*/
+void ResolverFree(PDNS_RESOLVER resolver) {
+    if(resolver->s != INVALID_SOCKET) closesocket(resolver->s);
+    if(resolver->buckets != NULL) {
+        for(size_t i = 0; i < RESOLVER_BUCKETS; i++) {
+            for(PRESOLVER_ENTRY entry = resolver->buckets[i], next = NULL; entry != NULL; entry = next) {
+                next = entry->next;
+                free(entry->name);
+                free(entry->addresses);
+                free(entry->addresses6);
+                free(entry);
+            }
+        }
+    }
+    free(resolver->buckets);
+    free(resolver->queries);
+    memset(resolver, 0, sizeof(DNS_RESOLVER));
+    resolver->s = INVALID_SOCKET;
+}
+
+/*
+Function adds a block of addresses to a target set. Blocks are only sorted and
+merged by TargetFinish, so adding is cheap however large the block is.
+Params:
+    PTARGET_SET     set         -       [The set to add to.]
+    ULONG           first       -       [The first address in host byte order.]
+    ULONG           last        -       [The last address in host byte order.]
+Returns nothing.
+*/
+void TargetAddRange(PTARGET_SET set, ULONG first, ULONG last) {
+    if(set->rangeCount >= set->capacity) {
+        set->capacity = set->capacity == 0 ? 64 : set->capacity * 2;
+        set->ranges = realloc(set->ranges, set->capacity * sizeof(TARGET_RANGE));
+    }
+    set->ranges[set->rangeCount].first = first;
+    set->ranges[set->rangeCount].last = last;
+    set->rangeCount++;
+}
+
+/*
+Function adds a block of ipv6 addresses to a target set. A block never
+crosses a /64, so it is kept as the shared upper half and a range of the
+lower one.
+Params:
+    PTARGET_SET     set         -       [The set to add to.]
+    UINT64          high        -       [The upper 64 bits in host byte order.]
+    UINT64          first       -       [The first lower 64 bits.]
+    UINT64          last        -       [The last lower 64 bits.]
+Returns nothing.
+*/
+void TargetAddRange6(PTARGET_SET set, UINT64 high, UINT64 first, UINT64 last) {
+    if(set->range6Count >= set->capacity6) {
+        set->capacity6 = set->capacity6 == 0 ? 16 : set->capacity6 * 2;
+        set->ranges6 = realloc(set->ranges6, set->capacity6 * sizeof(TARGET_RANGE6));
+    }
+    set->ranges6[set->range6Count].high = high;
+    set->ranges6[set->range6Count].first = first;
+    set->ranges6[set->range6Count].last = last;
+    set->range6Count++;
+}
+
+/*
+Function orders address blocks by their first address for qsort.
+Params:
+    const void  *a      -       [The first block.]
+    const void  *b      -       [The second block.]
+Returns int.
+*/
+static int TargetRangeCompare(const void *a, const void *b) {
+    ULONG x = ((const TARGET_RANGE*)a)->first;
+    ULONG y = ((const TARGET_RANGE*)b)->first;
+    return x < y ? -1 : x > y;
+}
+
+/*
+Function sorts a set's blocks and joins the ones that overlap or touch.
+Params:
+    PTARGET_SET     set         -       [The set to merge.]
+Returns nothing.
+*/
+static void TargetMerge(PTARGET_SET set) {
+    if(set->rangeCount == 0) return;
+    qsort(set->ranges, set->rangeCount, sizeof(TARGET_RANGE), TargetRangeCompare);
+    size_t kept = 0;
+    for(size_t i = 1; i < set->rangeCount; i++) {
+        if((UINT64)set->ranges[kept].last + 1 >= set->ranges[i].first) {
+            if(set->ranges[i].last > set->ranges[kept].last) set->ranges[kept].last = set->ranges[i].last;
+        }
+        else set->ranges[++kept] = set->ranges[i];
+    }
+    set->rangeCount = kept + 1;
+}
+
+/*
+Function orders ipv6 blocks by their first address for qsort.
+Params:
+    const void  *a      -       [The first block.]
+    const void  *b      -       [The second block.]
+Returns int.
+*/
+static int TargetRange6Compare(const void *a, const void *b) {
+    const TARGET_RANGE6 *x = a, *y = b;
+    if(x->high != y->high) return x->high < y->high ? -1 : 1;
+    return x->first < y->first ? -1 : x->first > y->first;
+}
+
+/*
+Function sorts a set's ipv6 blocks and joins the ones that overlap or touch.
+Params:
+    PTARGET_SET     set         -       [The set to merge.]
+Returns nothing.
+*/
+static void TargetMerge6(PTARGET_SET set) {
+    if(set->range6Count == 0) return;
+    qsort(set->ranges6, set->range6Count, sizeof(TARGET_RANGE6), TargetRange6Compare);
+    size_t kept = 0;
+    for(size_t i = 1; i < set->range6Count; i++) {
+        PTARGET_RANGE6 last = &set->ranges6[kept];
+        if(last->high == set->ranges6[i].high && (last->last == UINT64_MAX || last->last + 1 >= set->ranges6[i].first)) {
+            if(set->ranges6[i].last > last->last) last->last = set->ranges6[i].last;
+        }
+        else set->ranges6[++kept] = set->ranges6[i];
+    }
+    set->range6Count = kept + 1;
+}
+
+/*
+Function turns the blocks added to a set into its final form: sorted, merged,
+with the excluded blocks cut out, and with a running count so any position in
+the set maps back to an address without expanding it.
+Params:
+    PTARGET_SET     set         -       [The targets.]
+    PTARGET_SET     excludes    -       [Addresses to leave out, merged as a side effect.]
+Returns nothing.
+*/
+void TargetFinish(PTARGET_SET set, PTARGET_SET excludes) {
+    TargetMerge(set);
+    TargetMerge(excludes);
+
+    TARGET_SET kept = {0};
+    size_t next = 0;
+    for(size_t i = 0; i < set->rangeCount; i++) {
+        PTARGET_RANGE range = &set->ranges[i];
+        UINT64 current = range->first;
+        while(next < excludes->rangeCount && excludes->ranges[next].last < range->first) next++;
+        for(size_t j = next; j < excludes->rangeCount && excludes->ranges[j].first <= range->last; j++) {
+            if(excludes->ranges[j].first > current) TargetAddRange(&kept, (ULONG)current, excludes->ranges[j].first - 1);
+            if((UINT64)excludes->ranges[j].last + 1 > current) current = (UINT64)excludes->ranges[j].last + 1;
+            if(excludes->ranges[j].last >= range->last) break;        // It may cover the next block too.
+        }
+        if(current <= range->last) TargetAddRange(&kept, (ULONG)current, range->last);
+    }
+
+    TargetMerge6(set);                                              // Ipv6 blocks share their upper half with any exclude that cuts them.
+    TargetMerge6(excludes);
+    next = 0;
+    for(size_t i = 0; i < set->range6Count; i++) {
+        PTARGET_RANGE6 range = &set->ranges6[i];
+        UINT64 current = range->first;
+        BOOL left = TRUE;                                           // Something of the block is still to be kept.
+        while(next < excludes->range6Count && (excludes->ranges6[next].high < range->high ||
+              (excludes->ranges6[next].high == range->high && excludes->ranges6[next].last < range->first))) next++;
+        for(size_t j = next; j < excludes->range6Count && excludes->ranges6[j].high == range->high &&
+            excludes->ranges6[j].first <= range->last; j++) {
+            if(excludes->ranges6[j].first > current) TargetAddRange6(&kept, range->high, current, excludes->ranges6[j].first - 1);
+            if(excludes->ranges6[j].last >= range->last) {
+                left = FALSE;
+                break;
+            }
+            if(excludes->ranges6[j].last + 1 > current) current = excludes->ranges6[j].last + 1;
+        }
+        if(left == TRUE) TargetAddRange6(&kept, range->high, current, range->last);
+    }
+
+    free(set->ranges);
+    free(set->ranges6);
+    *set = kept;
+    set->count = 0;
+    for(size_t i = 0; i < set->rangeCount; i++) {
+        set->ranges[i].before = set->count;
+        set->count += (size_t)(set->ranges[i].last - set->ranges[i].first) + 1;
+    }
+    set->first6 = set->count;
+    for(size_t i = 0; i < set->range6Count; i++) {
+        set->ranges6[i].before = set->count;
+        set->count += (size_t)(set->ranges6[i].last - set->ranges6[i].first) + 1;
+    }
+}
+
+/*
+Function returns the ipv4 address at a position in a finished target set.
+Params:
+    PTARGET_SET     set         -       [The finished set.]
+    size_t          index       -       [The position, below set->first6.]
+Returns ULONG, in network byte order.
+*/
+ULONG TargetAt(PTARGET_SET set, size_t index) {
+    size_t low = 0, high = set->rangeCount - 1;                     // Find the last block starting at or before index.
+    while(low < high) {
+        size_t mid = (low + high + 1) / 2;
+        if(set->ranges[mid].before <= index) low = mid;
+        else high = mid - 1;
+    }
+    return htonl(set->ranges[low].first + (ULONG)(index - set->ranges[low].before));
+}
+
+/*
+Function finds the position of an address in a finished target set.
+Params:
+    PTARGET_SET     set         -       [The finished set.]
+    ULONG           ipAddress   -       [The address in network byte order.]
+Returns size_t, the position or (size_t)-1 if the address is not in the set.
+*/
+size_t TargetIndex(PTARGET_SET set, ULONG ipAddress) {
+    ULONG address = ntohl(ipAddress);
+    size_t low = 0, high = set->rangeCount;                         // Find the first block ending at or after the address.
+    while(low < high) {
+        size_t mid = (low + high) / 2;
+        if(set->ranges[mid].last < address) low = mid + 1;
+        else high = mid;
+    }
+    if(low >= set->rangeCount || set->ranges[low].first > address) return (size_t)-1;
+    return set->ranges[low].before + (address - set->ranges[low].first);
+}
+
+/*
+Function reads an ipv6 address as its upper and lower 64 bits.
+Params:
+    const unsigned char     *address    -       [The 16 address bytes in network order.]
+    UINT64                  *high       -       [Receives the upper half in host byte order.]
+    UINT64                  *low        -       [Receives the lower half.]
+Returns nothing.
+*/
+static void Address6Split(const unsigned char *address, UINT64 *high, UINT64 *low) {
+    *high = *low = 0;
+    for(int i = 0; i < 8; i++) {
+        *high = *high << 8 | address[i];
+        *low = *low << 8 | address[i + 8];
+    }
+}
+
+/*
+Function returns the ipv6 address at a position in a finished target set.
+Params:
+    PTARGET_SET     set         -       [The finished set.]
+    size_t          index       -       [The position, from set->first6 up to set->count.]
+    unsigned char   *address    -       [Receives the 16 address bytes in network order.]
+Returns nothing.
+*/
+void TargetAt6(PTARGET_SET set, size_t index, unsigned char *address) {
+    size_t low = 0, high = set->range6Count - 1;                    // Find the last block starting at or before index.
+    while(low < high) {
+        size_t mid = (low + high + 1) / 2;
+        if(set->ranges6[mid].before <= index) low = mid;
+        else high = mid - 1;
+    }
+    UINT64 upper = set->ranges6[low].high, lower = set->ranges6[low].first + (UINT64)(index - set->ranges6[low].before);
+    for(int i = 7; i >= 0; i--, upper >>= 8, lower >>= 8) {
+        address[i] = (unsigned char)upper;
+        address[i + 8] = (unsigned char)lower;
+    }
+}
+
+/*
+Function finds the position of an ipv6 address in a finished target set.
+Params:
+    PTARGET_SET             set         -       [The finished set.]
+    const unsigned char     *address    -       [The 16 address bytes in network order.]
+Returns size_t, the position or (size_t)-1 if the address is not in the set.
+*/
+size_t TargetIndex6(PTARGET_SET set, const unsigned char *address) {
+    TARGET_RANGE6 key = {0};
+    size_t low = 0, high = set->range6Count;                        // Find the first block ending at or after the address.
+    Address6Split(address, &key.high, &key.first);
+    while(low < high) {
+        size_t mid = (low + high) / 2;
+        PTARGET_RANGE6 range = &set->ranges6[mid];
+        if(range->high < key.high || (range->high == key.high && range->last < key.first)) low = mid + 1;
+        else high = mid;
+    }
+    if(low >= set->range6Count || set->ranges6[low].high != key.high || set->ranges6[low].first > key.first) return (size_t)-1;
+    return set->ranges6[low].before + (size_t)(key.first - set->ranges6[low].first);
+}
+
+/*
+Function builds the socket address of a target, in whichever family it has.
+Params:
+    PTARGET_SET         set         -       [The finished set.]
+    size_t              index       -       [The target's position.]
+    WORD                port        -       [The port to address.]
+    int                 family      -       [AF_INET6 to write ipv4 targets as mapped addresses for a dual stack socket, else AF_UNSPEC.]
+    PTARGET_ADDRESS     address     -       [Receives the address.]
+Returns int, the length of the address.
+*/
+int TargetAddress(PTARGET_SET set, size_t index, WORD port, int family, PTARGET_ADDRESS address) {
+    memset(address, 0, sizeof(TARGET_ADDRESS));
+    if(index < set->first6 && family != AF_INET6) {
+        address->v4.sin_family = AF_INET;
+        address->v4.sin_addr.s_addr = TargetAt(set, index);
+        address->v4.sin_port = htons(port);
+        return sizeof(struct sockaddr_in);
+    }
+    address->v6.sin6_family = AF_INET6;
+    address->v6.sin6_port = htons(port);
+    if(index >= set->first6) TargetAt6(set, index, (unsigned char*)&address->v6.sin6_addr);
+    else {
+        ULONG ipAddress = TargetAt(set, index);
+        unsigned char *bytes = (unsigned char*)&address->v6.sin6_addr;
+        bytes[10] = bytes[11] = 0xff;                               // ::ffff:a.b.c.d
+        memcpy(bytes + 12, &ipAddress, 4);
+    }
+    return sizeof(struct sockaddr_in6);
+}
+
+/*
+Function finds the target a socket address belongs to. Mapped ipv4 addresses
+from a dual stack socket count as the ipv4 target.
+Params:
+    PTARGET_SET             set         -       [The finished set.]
+    const struct sockaddr   *address    -       [A sockaddr_in or sockaddr_in6.]
+Returns size_t, the position or (size_t)-1 if the address is not in the set.
+*/
+size_t TargetFind(PTARGET_SET set, const struct sockaddr *address) {
+    static const unsigned char mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    if(address->sa_family == AF_INET) return TargetIndex(set, ((const struct sockaddr_in*)address)->sin_addr.s_addr);
+    if(address->sa_family != AF_INET6) return (size_t)-1;
+    const unsigned char *bytes = (const unsigned char*)&((const struct sockaddr_in6*)address)->sin6_addr;
+    if(memcmp(bytes, mapped, sizeof(mapped)) == 0) {
+        ULONG ipAddress;
+        memcpy(&ipAddress, bytes + 12, 4);
+        return TargetIndex(set, ipAddress);
+    }
+    return TargetIndex6(set, bytes);
+}
+
+/*
+Function writes a target's address as text.
+Params:
+    PTARGET_SET     set         -       [The finished set.]
+    size_t          index       -       [The target's position.]
+    char            *text       -       [Receives the address, INET6_ADDRSTRLEN bytes.]
+Returns nothing.
+*/
+void TargetText(PTARGET_SET set, size_t index, char *text) {
+    if(index < set->first6) {
+        ULONG ipAddress = TargetAt(set, index);
+        inet_ntop(AF_INET, &ipAddress, text, INET6_ADDRSTRLEN);
+    }
+    else {
+        unsigned char address[16];
+        TargetAt6(set, index, address);
+        inet_ntop(AF_INET6, address, text, INET6_ADDRSTRLEN);
+    }
+}
+
+/*
+Function walks a finished target set one address at a time.
+Params:
+    PTARGET_ITERATOR    iterator    -       [The walk position, zeroed with its set filled in to start.]
+    ULONG               *ipAddress  -       [Receives the next address in network byte order.]
+Returns BOOL, FALSE once every address has been returned.
+*/
+BOOL TargetNext(PTARGET_ITERATOR iterator, ULONG *ipAddress) {
+    while(iterator->range < iterator->set->rangeCount) {
+        PTARGET_RANGE range = &iterator->set->ranges[iterator->range];
+        UINT64 address = range->first + iterator->offset;
+        if(address <= range->last) {
+            iterator->offset++;
+            *ipAddress = htonl((ULONG)address);
+            return TRUE;
+        }
+        iterator->range++;
+        iterator->offset = 0;
+    }
+    return FALSE;
+}
+
+/*
+Function releases a target set.
+Params:
+    PTARGET_SET     set         -       [The set to free.]
+Returns nothing.
+*/
+void TargetFree(PTARGET_SET set) {
+    free(set->ranges);
+    free(set->ranges6);
+    memset(set, 0, sizeof(TARGET_SET));
+}
+
+/*
+Function reads an address, a cidr block or a range written as first-last or
+as first-lastoctet.
+Params:
+    const char  *text       -       [The text to read.]
+    ULONG       *first      -       [Receives the first address in host byte order.]
+    ULONG       *last       -       [Receives the last address in host byte order.]
+Returns int, 1 for an address, 0 when the text is not one (a host name) or -1 when it is malformed.
+*/
+static int TargetParseRange(const char *text, ULONG *first, ULONG *last) {
+    char buffer[64];
+    struct in_addr address;
+    if(strlen(text) >= sizeof(buffer)) return 0;
+    strcpy(buffer, text);
+
+    char *split = strpbrk(buffer, "/-");
+    if(split != NULL) *split++ = 0;
+    if(inet_pton(AF_INET, buffer, &address) != 1) return 0;        // Host names may contain dashes too.
+    *first = *last = ntohl(address.s_addr);
+    if(split == NULL) return 1;
+
+    char *end = NULL;
+    unsigned long value = strtoul(split, &end, 10);
+    if(text[split - buffer - 1] == '/') {
+        if(*split == 0 || *end != 0 || value > 32) return -1;
+        ULONG mask = value == 0 ? 0 : 0xffffffffu << (32 - value);
+        *first &= mask;
+        *last = *first | ~mask;
+        return 1;
+    }
+    if(inet_pton(AF_INET, split, &address) == 1) *last = ntohl(address.s_addr);
+    else if(*split != 0 && *end == 0 && value <= 255) *last = (*first & 0xffffff00u) | (ULONG)value;
+    else return -1;
+    return *first <= *last ? 1 : -1;
+}
+
+/*
+Function reads an ipv6 address or prefix. Prefixes longer than a /96 are
+refused, since a sweep of one could never finish.
+Params:
+    const char  *text       -       [The text to read.]
+    UINT64      *high       -       [Receives the upper 64 bits in host byte order.]
+    UINT64      *first      -       [Receives the first lower 64 bits.]
+    UINT64      *last       -       [Receives the last lower 64 bits.]
+Returns int, 1 for an address, 0 when the text is not one or -1 when it is malformed or too large.
+*/
+static int TargetParseRange6(const char *text, UINT64 *high, UINT64 *first, UINT64 *last) {
+    char buffer[64];
+    unsigned char address[16];
+    if(strlen(text) >= sizeof(buffer)) return 0;
+    strcpy(buffer, text);
+
+    char *split = strchr(buffer, '/');
+    if(split != NULL) *split++ = 0;
+    if(inet_pton(AF_INET6, buffer, address) != 1) return 0;
+    Address6Split(address, high, first);
+    *last = *first;
+    if(split == NULL) return 1;
+
+    char *end = NULL;
+    unsigned long value = strtoul(split, &end, 10);
+    if(*split == 0 || *end != 0 || value > 128 || value < MIN_PREFIX6) return -1;
+    UINT64 mask = value == 128 ? UINT64_MAX : ~(UINT64_MAX >> (value - 64));
+    *first &= mask;
+    *last = *first | ~mask;
+    return 1;
+}
+
+/*
+Function adds one target or exclude entry. Addresses and blocks go straight
+into their set, host names are queued on the resolver.
+Params:
+    PTARGET_LOADER  loader      -       [The loader collecting targets.]
+    const char      *item       -       [The entry.]
+    BOOL            exclude     -       [TRUE when the entry is to be left out.]
+Returns nothing.
+*/
+static void TargetAddItem(PTARGET_LOADER loader, const char *item, BOOL exclude) {
+    PTARGET_SET set = exclude ? &loader->excludes : &loader->config->targets;
+    ULONG first = 0, last = 0;
+    UINT64 high = 0, first6 = 0, last6 = 0;
+    int kind = TargetParseRange(item, &first, &last);
+    if(kind == 1) {
+        TargetAddRange(set, first, last);
+        return;
+    }
+    if(kind == 0 && strchr(item, ':') != NULL) {                    // Host names never hold a colon.
+        kind = TargetParseRange6(item, &high, &first6, &last6);
+        if(kind == 1) TargetAddRange6(set, high, first6, last6);
+        else printf("Error: [%s] is not a valid ipv6 address or prefix, which must be /%u or longer.\n", item, (unsigned)MIN_PREFIX6);
+        return;
+    }
+    if(kind < 0) printf("Error: [%s] is not a valid address, range or cidr block.\n", item);
+    else if(exclude == TRUE) printf("Error: Exclude [%s] must be an address, range or cidr block.\n", item);
+    else {
+        if(loader->nameCount >= loader->nameCapacity) {
+            loader->nameCapacity = loader->nameCapacity == 0 ? 16 : loader->nameCapacity * 2;
+            loader->names = realloc(loader->names, loader->nameCapacity * sizeof(char*));
+            loader->entries = realloc(loader->entries, loader->nameCapacity * sizeof(PRESOLVER_ENTRY));
+        }
+        loader->names[loader->nameCount] = calloc(strlen(item) + 1, sizeof(char));
+        strcpy(loader->names[loader->nameCount], item);
+        loader->entries[loader->nameCount] = loader->async == TRUE ? ResolverQueue(&loader->resolver, item) : NULL;
+        loader->nameCount++;
+    }
+}
+
+/*
+Function splits text into entries on commas and whitespace. A # starts a
+comment that runs to the end of the text.
+Params:
+    PTARGET_LOADER  loader      -       [The loader collecting targets.]
+    const char      *text       -       [The text, left as it is so a journal can save the command line.]
+    BOOL            exclude     -       [TRUE when the entries are to be left out.]
+Returns nothing.
+*/
+static void TargetAddText(PTARGET_LOADER loader, const char *text, BOOL exclude) {
+    size_t length = strlen(text);
+    char *copy = malloc(length + 1);                                // Strtok writes into what it splits.
+    if(copy == NULL) return;
+    memcpy(copy, text, length + 1);
+    char *comment = strchr(copy, '#');
+    if(comment != NULL) *comment = 0;
+    for(char *item = strtok(copy, ", \t\r\n"); item != NULL; item = strtok(NULL, ", \t\r\n")) TargetAddItem(loader, item, exclude);
+    free(copy);
+}
+
+/*
+Function reads entries from a file a line at a time, so the list is never held
+in memory as text.
+Params:
+    PTARGET_LOADER  loader      -       [The loader collecting targets.]
+    const char      *path       -       [The file to read, - for stdin.]
+    BOOL            exclude     -       [TRUE when the entries are to be left out.]
+Returns BOOL.
+*/
+static BOOL TargetAddFile(PTARGET_LOADER loader, const char *path, BOOL exclude) {
+    char line[1024];
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if(file == NULL) {
+        printf("Error: Unable to open target list [%s].\n", path);
+        return FALSE;
+    }
+    while(fgets(line, sizeof(line), file) != NULL) TargetAddText(loader, line, exclude);
+    if(file != stdin) fclose(file);
+    return TRUE;
+}
+
+/*
+Function builds the target set from the command line list, -iL and the
+exclude options. Host names from every source are resolved together, then
+each address they have is added before the excludes are cut out.
+Params:
+    PSCAN_CONFIG    config      -       [Receives the targets.]
+    char            *list       -       [Targets separated by commas, or NULL.]
+Returns BOOL, FALSE when nothing is left to scan.
+*/
+BOOL LoadTargets(PSCAN_CONFIG config, char *list) {
+    TARGET_LOADER loader;
+    memset(&loader, 0, sizeof(TARGET_LOADER));
+    loader.config = config;
+    loader.async = ResolverInit(&loader.resolver, config);         // Without a dns server fall back to the system resolver.
+
+    BOOL loaded = TRUE;
+    if(list != NULL) TargetAddText(&loader, list, FALSE);
+    if(config->targetFile != NULL) loaded &= TargetAddFile(&loader, config->targetFile, FALSE);
+    if(config->exclude != NULL) TargetAddText(&loader, config->exclude, TRUE);
+    if(config->excludeFile != NULL) loaded &= TargetAddFile(&loader, config->excludeFile, TRUE);
+
+    if(loader.async == TRUE && loader.nameCount > 0) {
+        char server[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &loader.resolver.server.sin_addr, server, sizeof(server));
+        if(config->debug == TRUE) printf("Resolving domain names through [%s:%u]\n", server, (unsigned)ntohs(loader.resolver.server.sin_port));
+        ResolverRun(&loader.resolver);
+    }
+
+    for(size_t i = 0; i < loader.nameCount; i++) {
+        char text[INET6_ADDRSTRLEN];
+        size_t foundCount = 0;
+        ULONG first = 0, last = 0;
+        UINT64 high = 0, first6 = 0, last6 = 0;
+        PRESOLVER_ENTRY entry = loader.entries[i];
+        if(entry != NULL && entry->listed == TRUE) {                // The same name given twice.
+            free(loader.names[i]);
+            continue;
+        }
+        if(entry != NULL && entry->state == DnsResolved) {          // Every A and AAAA record is scanned.
+            entry->listed = TRUE;
+            for(size_t j = 0; j < entry->addressCount; j++, foundCount++) {
+                if(config->debug == TRUE) printf("Name resolved [%s]\n", inet_ntop(AF_INET, &entry->addresses[j], text, sizeof(text)));
+                TargetAddRange(&config->targets, ntohl(entry->addresses[j]), ntohl(entry->addresses[j]));
+            }
+            for(size_t j = 0; j < entry->address6Count; j++, foundCount++) {
+                if(config->debug == TRUE) printf("Name resolved [%s]\n", inet_ntop(AF_INET6, entry->addresses6[j], text, sizeof(text)));
+                Address6Split(entry->addresses6[j], &high, &first6);
+                TargetAddRange6(&config->targets, high, first6, first6);
+            }
+        }
+        else if(entry != NULL) entry->listed = TRUE;
+        if(foundCount == 0 && (entry == NULL || config->dnsServer == 0)) {     // Hosts files and search domains only apply through the system resolver.
+            char *dnsBuf = calloc(INET6_ADDRSTRLEN, sizeof(char));  // Buffer to receive the resolved address.
+            if(config->debug == TRUE) printf("Resolving domain name\n");   // Simple debug statements.
+            if(ResolveDnsAddress(loader.names[i], Tcp, &dnsBuf, INET6_ADDRSTRLEN) == 0 && TargetParseRange(dnsBuf, &first, &last) == 1) {
+                TargetAddRange(&config->targets, first, last);
+                foundCount = 1;
+            }
+            else if(dnsBuf[0] != 0 && TargetParseRange6(dnsBuf, &high, &first6, &last6) == 1) {
+                TargetAddRange6(&config->targets, high, first6, last6);
+                foundCount = 1;
+            }
+            if(foundCount == 1 && config->debug == TRUE) printf("Name resolved [%s]\n", dnsBuf);
+            free(dnsBuf);                                           // Free the dns buffer from memory.
+        }
+        if(foundCount == 0) printf("Error: Unable to resolve domain [%s]. Make sure it is spelt correctly.\n", loader.names[i]);
+        free(loader.names[i]);
+    }
+
+    TargetFinish(&config->targets, &loader.excludes);
+    if(config->debug == TRUE) {
+        printf("Loaded [%llu] addresses in [%u] ranges, [%llu] of them ipv6\n", (unsigned long long)config->targets.count,
+               (unsigned)(config->targets.rangeCount + config->targets.range6Count), (unsigned long long)(config->targets.count - config->targets.first6));
+    }
+    if(loaded == TRUE && config->targets.count == 0) printf("Error: No targets left to scan.\n");
+    ResolverFree(&loader.resolver);
+    TargetFree(&loader.excludes);
+    free(loader.names);
+    free(loader.entries);
+    return loaded == TRUE && config->targets.count > 0;
+}
+
+/*
+Function measures how fast the target set hands out addresses, walking it in
+order with the iterator and jumping around it the way scan workers do. The
+iterator only walks the ipv4 blocks.
+Params:
+    PSCAN_CONFIG    config      -       [The loaded targets.]
+Returns nothing.
+*/
+void TargetBenchmark(PSCAN_CONFIG config) {
+    volatile ULONG sink = 0;                                        // Keeps the loops from being optimised away.
+    TARGET_ITERATOR iterator = {0};
+    ULONG ipAddress = 0;
+    iterator.set = &config->targets;
+    for(int mode = config->targets.first6 > 0 ? 0 : 1; mode < 2; mode++) {
+        UINT64 addresses = 0;
+        UINT64 start = NowMicros(), elapsed = 0;
+        while(elapsed < (UINT64)(BENCH_SECONDS * 1000000)) {
+            if(mode == 0) {
+                for(size_t n = 0; n < (1 << 20); n++, addresses++) {
+                    if(TargetNext(&iterator, &ipAddress) == FALSE) {   // Start over once the whole set has been walked.
+                        iterator.range = 0;
+                        iterator.offset = 0;
+                        TargetNext(&iterator, &ipAddress);
+                    }
+                    sink ^= ipAddress;
+                }
+            }
+            else {
+                for(size_t n = 0; n < (1 << 20); n++, addresses++) {
+                    size_t index = (size_t)((addresses * 2654435761u) % config->targets.count);
+                    if(index < config->targets.first6) sink ^= TargetAt(&config->targets, index);
+                    else {
+                        unsigned char address[16];
+                        TargetAt6(&config->targets, index, address);
+                        sink ^= address[15];
+                    }
+                }
+            }
+            elapsed = NowMicros() - start;
+        }
+        printf("BENCH targets mode=%s ranges=%u addresses=%llu seconds=%.3f rate=%.0f\n", mode == 0 ? "iterate" : "index",
+               (unsigned)(config->targets.rangeCount + config->targets.range6Count), (unsigned long long)addresses, elapsed / 1e6, addresses * 1e6 / elapsed);
+        fflush(stdout);
+    }
+}
+
+/*
+Function multiplies two numbers modulo a third without overflowing.
+Params:
+    UINT64  a       -       [The first factor, below m.]
+    UINT64  b       -       [The second factor, below m.]
+    UINT64  m       -       [The modulus.]
+Returns UINT64.
+*/
+static UINT64 MulMod(UINT64 a, UINT64 b, UINT64 m) {
+#ifdef __SIZEOF_INT128__
+    return (UINT64)((unsigned __int128)a * b % m);
+#else
+    UINT64 result = 0;                                              // Shift and add, the moduli used here stay below 2^62.
+    while(b > 0) {
+        if(b & 1) result = (result + a) % m;
+        a = (a << 1) % m;
+        b >>= 1;
+    }
+    return result;
+#endif
+}
+
+/*
+Function raises a number to a power modulo a third.
+Params:
+    UINT64  base        -       [The base, below m.]
+    UINT64  exponent    -       [The power.]
+    UINT64  m           -       [The modulus.]
+Returns UINT64.
+*/
+static UINT64 PowMod(UINT64 base, UINT64 exponent, UINT64 m) {
+    UINT64 result = 1 % m;
+    while(exponent > 0) {
+        if(exponent & 1) result = MulMod(result, base, m);
+        base = MulMod(base, base, m);
+        exponent >>= 1;
+    }
+    return result;
+}
+
+/*
+Function tests a number for primality with the deterministic Miller-Rabin bases for 64 bit numbers.
+Params:
+    UINT64  n       -       [The number to test.]
+Returns BOOL.
+*/
+static BOOL IsPrime(UINT64 n) {
+    const UINT64 bases[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+    if(n < 2) return FALSE;
+    for(size_t i = 0; i < sizeof(bases) / sizeof(bases[0]); i++) {
+        if(n % bases[i] == 0) return n == bases[i];
+    }
+    UINT64 d = n - 1;
+    int shifts = 0;
+    while((d & 1) == 0) {
+        d >>= 1;
+        shifts++;
+    }
+    for(size_t i = 0; i < sizeof(bases) / sizeof(bases[0]); i++) {
+        UINT64 x = PowMod(bases[i], d, n);
+        if(x == 1 || x == n - 1) continue;
+        int r = 1;
+        for(; r < shifts; r++) {
+            x = MulMod(x, x, n);
+            if(x == n - 1) break;
+        }
+        if(r == shifts) return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+Function mixes a seed into a well spread 64 bit value.
+Params:
+    UINT64  x       -       [The value to mix.]
+Returns UINT64.
+*/
+static UINT64 MixSeed(UINT64 x) {
+    x ^= x >> 33;                                                   // Murmur3 finalizer, as SynCookie uses.
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/*
+Function sets up a pseudo random order over size elements. The elements are
+numbered 1 to size inside the multiplicative group modulo the smallest prime
+above size, and a primitive root picked from the seed walks the whole group
+from a seeded start, so every element comes up exactly once and the only state
+is the current value. A shard takes every shardCount-th step of that one
+cycle, so shards given the same seed split the work without talking.
+Params:
+    PPERMUTATION    permutation -       [Receives the order.]
+    UINT64          size        -       [How many elements to order.]
+    UINT64          seed        -       [Picks the generator and starting point.]
+    size_t          shard       -       [This shard, below shardCount.]
+    size_t          shardCount  -       [How many shards split the cycle.]
+Returns nothing.
+*/
+void PermutationInit(PPERMUTATION permutation, UINT64 size, UINT64 seed, size_t shard, size_t shardCount) {
+    UINT64 factors[64];
+    size_t factorCount = 0;
+    memset(permutation, 0, sizeof(PERMUTATION));
+    permutation->size = size;
+    permutation->prime = size + 1;
+    while(IsPrime(permutation->prime) == FALSE) permutation->prime++;
+
+    UINT64 order = permutation->prime - 1, rest = order;            // Factor the group order to test generators.
+    for(UINT64 f = 2; f * f <= rest; f++) {
+        if(rest % f != 0) continue;
+        factors[factorCount++] = f;
+        while(rest % f == 0) rest /= f;
+    }
+    if(rest > 1) factors[factorCount++] = rest;
+
+    permutation->generator = order;                                 // The only choice when the group has one or two elements.
+    if(permutation->prime > 3) {
+        UINT64 candidate = 2 + MixSeed(seed) % (permutation->prime - 3);
+        while(TRUE) {
+            BOOL primitive = TRUE;
+            for(size_t i = 0; i < factorCount && primitive == TRUE; i++) {
+                if(PowMod(candidate, order / factors[i], permutation->prime) == 1) primitive = FALSE;
+            }
+            if(primitive == TRUE) break;
+            candidate = candidate + 1 < permutation->prime ? candidate + 1 : 2;
+        }
+        permutation->generator = candidate;
+    }
+
+    UINT64 start = 1 + MixSeed(seed ^ 0x9e3779b97f4a7c15ULL) % order;
+    permutation->first = MulMod(start, PowMod(permutation->generator, shard, permutation->prime), permutation->prime);
+    permutation->stride = PowMod(permutation->generator, shardCount, permutation->prime);
+    permutation->positions = order > shard ? (order - 1 - shard) / shardCount + 1 : 0;
+}
+
+/*
+Function returns how many positions this process walks: every (target, port)
+pair in order, or this shard's share of the permuted cycle.
+Params:
+    PSCAN_CONFIG    config      -       [The scan settings holding the targets and order.]
+Returns UINT64.
+*/
+UINT64 ProbeCount(PSCAN_CONFIG config) {
+    if(config->permutation.size > 0) return config->permutation.positions;
+    return (UINT64)config->targets.count * (config->portEnd - config->portStart + 1);
+}
+
+/*
+Function moves a cursor to a position, so workers can start anywhere in the order.
+Params:
+    PSCAN_CONFIG    config      -       [The scan settings holding the order.]
+    PPROBE_CURSOR   cursor      -       [The cursor to move.]
+    UINT64          position    -       [The position to move to.]
+Returns nothing.
+*/
+void ProbeSeek(PSCAN_CONFIG config, PPROBE_CURSOR cursor, UINT64 position) {
+    PPERMUTATION permutation = &config->permutation;
+    cursor->position = position;
+    if(permutation->size > 0) {
+        cursor->value = MulMod(permutation->first, PowMod(permutation->stride, position, permutation->prime), permutation->prime);
+    }
+}
+
+/*
+Function returns the next (target, port) pair to probe, as target * portCount + port offset.
+Params:
+    PSCAN_CONFIG    config      -       [The scan settings holding the order.]
+    PPROBE_CURSOR   cursor      -       [The cursor to advance.]
+    UINT64          end         -       [The position to stop at.]
+    size_t          *probe      -       [Receives the pair.]
+Returns BOOL, FALSE once the cursor reaches end.
+*/
+BOOL ProbeNext(PSCAN_CONFIG config, PPROBE_CURSOR cursor, UINT64 end, size_t *probe) {
+    PPERMUTATION permutation = &config->permutation;
+    while(cursor->position < end) {
+        cursor->position++;
+        if(permutation->size == 0) {
+            *probe = (size_t)(cursor->position - 1);
+            return TRUE;
+        }
+        UINT64 value = cursor->value;
+        cursor->value = MulMod(cursor->value, permutation->stride, permutation->prime);
+        if(value <= permutation->size) {                            // Values between size and the prime are skipped.
+            *probe = (size_t)(value - 1);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+Function checks that the permutation visits every element of several spaces
+exactly once, across one and several shards, and reports how fast it steps.
+Small spaces are also split into one shard more than they have elements, so
+at least one shard owns no position at all.
+Params:
+    PSCAN_CONFIG    config      -       [The scan settings, whose target and port space is checked too.]
+Returns nothing.
+*/
+void PermutationBenchmark(PSCAN_CONFIG config) {
+    UINT64 sizes[] = {1, 2, 3, 1000, 65535, 65536 * 3 + 7, 1 << 24, 100000007, 0};
+    size_t shardCounts[] = {1, 3, 8, 0};
+    SCAN_CONFIG check = *config;
+    sizes[sizeof(sizes) / sizeof(sizes[0]) - 1] = (UINT64)config->targets.count * (config->portEnd - config->portStart + 1);
+
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        UINT64 size = sizes[s];
+        if(size == 0 || size > ((UINT64)1 << 31)) continue;        // The visited bitmap has to fit in memory.
+        unsigned char *visited = calloc((size_t)(size / 8 + 1), 1);
+        if(visited == NULL) continue;
+        shardCounts[sizeof(shardCounts) / sizeof(shardCounts[0]) - 1] = size <= 1000 ? (size_t)size + 1 : 0;
+        for(size_t c = 0; c < sizeof(shardCounts) / sizeof(shardCounts[0]); c++) {
+            UINT64 steps = 0, duplicates = 0, missing = 0, empty = 0;
+            if(shardCounts[c] == 0) continue;
+            UINT64 start = NowMicros();
+            memset(visited, 0, (size_t)(size / 8 + 1));
+            for(size_t shard = 0; shard < shardCounts[c]; shard++) {
+                PROBE_CURSOR cursor = {0};
+                size_t probe = 0;
+                PermutationInit(&check.permutation, size, config->seed, shard, shardCounts[c]);
+                empty += ProbeCount(&check) == 0;                   // A scan of such a shard has nothing to send.
+                ProbeSeek(&check, &cursor, 0);
+                while(ProbeNext(&check, &cursor, check.permutation.positions, &probe) == TRUE) {
+                    if(visited[probe / 8] & (1 << (probe % 8))) duplicates++;
+                    visited[probe / 8] |= 1 << (probe % 8);
+                    steps++;
+                }
+            }
+            UINT64 elapsed = NowMicros() - start;
+            for(UINT64 i = 0; i < size; i++) if((visited[i / 8] & (1 << (i % 8))) == 0) missing++;
+            printf("BENCH permute size=%llu shards=%u empty=%llu visited=%llu duplicates=%llu missing=%llu seconds=%.3f rate=%.0f result=%s\n",
+                   (unsigned long long)size, (unsigned)shardCounts[c], (unsigned long long)empty, (unsigned long long)steps, (unsigned long long)duplicates,
+                   (unsigned long long)missing, elapsed / 1e6, elapsed > 0 ? steps * 1e6 / elapsed : 0.0,
+                   duplicates == 0 && missing == 0 && steps == size ? "pass" : "FAIL");
+            fflush(stdout);
+        }
+        free(visited);
+    }
+}
+
+/*
+Function returns a monotonic clock reading in nanoseconds.
+Params:
+    None.
+Returns UINT64.
+*/
+UINT64 NowNanos() {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency = {0};                           // Ticks per second of the performance counter.
+    LARGE_INTEGER counter;
+    if(frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (UINT64)(counter.QuadPart / frequency.QuadPart) * 1000000000 +
+           (UINT64)(counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000000000 + (UINT64)ts.tv_nsec;
+#endif
+}
+
+/*
+Function returns a monotonic clock reading in microseconds.
+Params:
+    None.
+Returns UINT64.
+*/
+UINT64 NowMicros() {
+    return NowNanos() / 1000;
+}
+
+/*
+Function initalizes a lock shared between scan threads.
+Params:
+    LOCK    *lock       -       [The lock to initalize.]
+Returns nothing.
+*/
+void LockInit(LOCK *lock) {
+#ifdef _WIN32
+    InitializeCriticalSectionAndSpinCount(lock, 4000);
+#else
+    pthread_mutex_init(lock, NULL);
+#endif
+}
+
+/*
+Function takes a lock, waiting if another thread holds it.
+Params:
+    LOCK    *lock       -       [The lock to take.]
+Returns nothing.
+*/
+void LockAcquire(LOCK *lock) {
+#ifdef _WIN32
+    EnterCriticalSection(lock);
+#else
+    pthread_mutex_lock(lock);
+#endif
+}
+
+/*
+Function releases a lock taken with LockAcquire.
+Params:
+    LOCK    *lock       -       [The lock to release.]
+Returns nothing.
+*/
+void LockRelease(LOCK *lock) {
+#ifdef _WIN32
+    LeaveCriticalSection(lock);
+#else
+    pthread_mutex_unlock(lock);
+#endif
+}
+
+/*
+Function destroys a lock once no thread uses it.
+Params:
+    LOCK    *lock       -       [The lock to destroy.]
+Returns nothing.
+*/
+void LockFree(LOCK *lock) {
+#ifdef _WIN32
+    DeleteCriticalSection(lock);
+#else
+    pthread_mutex_destroy(lock);
+#endif
+}
+
+/*
+Function starts a new thread.
+Params:
+    THREAD          *thread     -       [Receives the thread handle.]
+    THREAD_ROUTINE  routine     -       [The function the thread runs.]
+    void            *arg        -       [The argument passed to the routine.]
+Returns BOOL.
+*/
+BOOL ThreadStart(THREAD *thread, THREAD_ROUTINE routine, void *arg) {
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, routine, arg, 0, NULL);
+    return *thread != NULL;
+#else
+    return pthread_create(thread, NULL, routine, arg) == 0;
+#endif
+}
+
+/*
+Function waits for a thread to finish and releases its handle.
+Params:
+    THREAD  thread      -       [The thread to wait on.]
+Returns nothing.
+*/
+void ThreadJoin(THREAD thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+/*
+Function reads a value other threads may be writing.
+Params:
+    volatile size_t     *value      -       [The shared value.]
+Returns size_t.
+*/
+size_t AtomicLoad(volatile size_t *value) {
+#ifdef _WIN32
+    return (size_t)InterlockedCompareExchangePointer((PVOID volatile*)value, NULL, NULL);   // Pointers and size_t share a width on windows.
+#else
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/*
+Function publishes a value to other threads, after every write made before it.
+Params:
+    volatile size_t     *target     -       [The shared value.]
+    size_t              value       -       [What to store.]
+Returns nothing.
+*/
+void AtomicStore(volatile size_t *target, size_t value) {
+#ifdef _WIN32
+    InterlockedExchangePointer((PVOID volatile*)target, (PVOID)value);
+#else
+    __atomic_store_n(target, value, __ATOMIC_RELEASE);
+#endif
+}
+
+/*
+Function adds to a shared counter.
+Params:
+    volatile size_t     *target     -       [The shared counter.]
+    size_t              value       -       [The amount to add, (size_t)-1 subtracts one.]
+Returns size_t, the value before the add.
+*/
+size_t AtomicAdd(volatile size_t *target, size_t value) {
+#ifdef _WIN32
+    size_t old;
+    do old = AtomicLoad(target);
+    while(InterlockedCompareExchangePointer((PVOID volatile*)target, (PVOID)(old + value), (PVOID)old) != (PVOID)old);
+    return old;
+#else
+    return __atomic_fetch_add(target, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+/*
+Function replaces a shared value only if nobody changed it first.
+Params:
+    volatile size_t     *target     -       [The shared value.]
+    size_t              expected    -       [The value it must still hold.]
+    size_t              desired     -       [The value to put in its place.]
+Returns BOOL.
+*/
+BOOL AtomicCas(volatile size_t *target, size_t expected, size_t desired) {
+#ifdef _WIN32
+    return InterlockedCompareExchangePointer((PVOID volatile*)target, (PVOID)desired, (PVOID)expected) == (PVOID)expected;
+#else
+    return __atomic_compare_exchange_n(target, &expected, desired, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/*
+Function reads a 64 bit value other threads may be writing, in one piece even
+on 32 bit builds.
+Params:
+    volatile UINT64     *value      -       [The shared value.]
+Returns UINT64.
+*/
+UINT64 AtomicLoad64(volatile UINT64 *value) {
+#ifdef _WIN32
+    return (UINT64)InterlockedCompareExchange64((volatile LONG64*)value, 0, 0);
+#else
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/*
+Function replaces a shared 64 bit value only if nobody changed it first.
+Params:
+    volatile UINT64     *target     -       [The shared value.]
+    UINT64              expected    -       [The value it must still hold.]
+    UINT64              desired     -       [The value to put in its place.]
+Returns BOOL.
+*/
+BOOL AtomicCas64(volatile UINT64 *target, UINT64 expected, UINT64 desired) {
+#ifdef _WIN32
+    return (UINT64)InterlockedCompareExchange64((volatile LONG64*)target, (LONG64)desired, (LONG64)expected) == expected;
+#else
+    return __atomic_compare_exchange_n(target, &expected, desired, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/*
+Function sets bits in a shared byte.
+Params:
+    volatile unsigned char  *target     -       [The shared byte.]
+    unsigned char           value       -       [The bits to set.]
+Returns unsigned char, the byte before the bits were set.
+*/
+unsigned char AtomicOrByte(volatile unsigned char *target, unsigned char value) {
+#ifdef _WIN32
+    return (unsigned char)InterlockedOr8((volatile char*)target, (char)value);
+#else
+    return __atomic_fetch_or(target, value, __ATOMIC_RELAXED);
+#endif
+}
+
+/*
+Function replaces a shared byte only if nobody changed it first.
+Params:
+    volatile unsigned char  *target     -       [The shared byte.]
+    unsigned char           expected    -       [The value it must still hold.]
+    unsigned char           desired     -       [The value to put in its place.]
+Returns BOOL.
+*/
+BOOL AtomicCasByte(volatile unsigned char *target, unsigned char expected, unsigned char desired) {
+#ifdef _WIN32
+    return (unsigned char)_InterlockedCompareExchange8((volatile char*)target, (char)desired, (char)expected) == expected;
+#else
+    return __atomic_compare_exchange_n(target, &expected, desired, FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+#endif
+}
+
+/*
+Function claims the next cell of a bounded ring that many threads add to and
+one thread drains. Every cell starts with a sequence number equal to the
+position it is free for; a producer claims it by moving the tail past it, and
+publishes it by setting the sequence one past its position.
+Params:
+    volatile size_t     *tail       -       [The next position to claim.]
+    void                *cells      -       [The ring, each cell starting with its size_t sequence.]
+    size_t              stride      -       [The size of a cell.]
+    size_t              capacity    -       [The number of cells, a power of two.]
+    size_t              *position   -       [Receives the claimed position, to publish the cell with.]
+Returns void *, the claimed cell or NULL when the ring is full.
+*/
+void *RingClaim(volatile size_t *tail, void *cells, size_t stride, size_t capacity, size_t *position) {
+    size_t current = AtomicLoad(tail);
+    while(TRUE) {
+        size_t *sequence = (size_t*)((unsigned char*)cells + (current & (capacity - 1)) * stride);
+        size_t lap = AtomicLoad(sequence);
+        if(lap == current && AtomicCas(tail, current, current + 1) == TRUE) {
+            *position = current;
+            return sequence;
+        }
+        if(lap != current && lap - current > (size_t)-1 / 2) return NULL;  // Behind the tail, still holding last lap's entry.
+        current = AtomicLoad(tail);
+    }
+}
+
+/*
+Function returns the cell at the consumer's position once it was published.
+The consumer frees it for the next lap by setting its sequence to head plus
+capacity.
+Params:
+    void    *cells      -       [The ring.]
+    size_t  stride      -       [The size of a cell.]
+    size_t  capacity    -       [The number of cells, a power of two.]
+    size_t  head        -       [The consumer's position.]
+Returns void *, NULL while the ring is empty.
+*/
+void *RingTake(void *cells, size_t stride, size_t capacity, size_t head) {
+    size_t *sequence = (size_t*)((unsigned char*)cells + (head & (capacity - 1)) * stride);
+    return AtomicLoad(sequence) == head + 1 ? sequence : NULL;
+}
+
+/*
+Function returns the number of processors available to the scanner.
+Params:
+    None.
+Returns size_t.
+*/
+size_t CpuCount() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t)count : 1;
+#endif
+}
+
+/*
+Function limits the requested concurrency to what the process may open.
+Params:
+    size_t  requested   -       [The number of probes the user wants in flight.]
+Returns size_t.
+*/
+size_t ClampConcurrency(size_t requested) {
+    if(requested < 1) requested = 1;
+    if(requested > MAX_CONCURRENCY) requested = MAX_CONCURRENCY;
+#ifndef _WIN32
+    struct rlimit limit;                                            // Every probe in flight holds a descriptor.
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        if(limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+            getrlimit(RLIMIT_NOFILE, &limit);
+        }
+        if(limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur > 64 && requested > limit.rlim_cur - 64) {
+            requested = limit.rlim_cur - 64;
+        }
+    }
+#endif
+    return requested;
+}
+
+/*
+Function opens the result store and the writer thread that streams results to
+stdout and to the -oJ, -oC and -oB files. A file named - is stdout, which
+then carries only that format.
+Params:
+    PRESULT_STORE   store       -       [The store to set up.]
+    PSCAN_CONFIG    config      -       [The targets, port range and output files.]
+Returns BOOL.
+*/
+BOOL ResultInit(PRESULT_STORE store, PSCAN_CONFIG config) {
+    const char *paths[] = {config->jsonFile, config->csvFile, config->binaryFile};
+    FILE **files[] = {&store->json, &store->csv, &store->binary};
+    size_t portCount = config->portEnd - config->portStart + 1;
+    size_t capacity = 16;
+
+    memset(store, 0, sizeof(RESULT_STORE));
+    store->config = config;
+    store->text = TRUE;
+    for(int i = 0; i < 3; i++) {
+        if(paths[i] == NULL) continue;
+        if(strcmp(paths[i], "-") == 0) {
+            *files[i] = stdout;
+            store->text = FALSE;
+        }
+        else if((*files[i] = fopen(paths[i], i == 2 ? "wb" : "w")) == NULL) {
+            printf("Error: Unable to open [%s] for writing.\n", paths[i]);
+            for(int j = 0; j < i; j++) if(*files[j] != NULL && *files[j] != stdout) fclose(*files[j]);
+            return FALSE;
+        }
+    }
+    if(store->csv != NULL) fprintf(store->csv, "ip,port,proto,state,time,service,banner\n");
+    if(store->binary != NULL) {                                     // Magic, version, ip protocol and two reserved bytes.
+        unsigned char version = config->targets.first6 < config->targets.count ? 2 : 1;  // Version 2 records carry 16 byte addresses.
+        unsigned char header[8] = {'C', 'P', 'S', 'R', version, config->pt == Udp ? IPPROTO_UDP : IPPROTO_TCP, 0, 0};
+        fwrite(header, 1, sizeof(header), store->binary);
+    }
+
+    store->limit = config->targets.count < RESULT_MAX_HOSTS ? config->targets.count : RESULT_MAX_HOSTS;
+    while(capacity < store->limit * 2) capacity *= 2;               // Half full at most, so probe runs stay short.
+    store->mask = capacity - 1;
+    store->hostBytes = ((portCount * 2 + 7) / 8 + 63) & ~(size_t)63;
+    store->blockHosts = (RESULT_BLOCK_SIZE - 128) / (store->hostBytes + sizeof(size_t));  // Room for the block header and key padding.
+    store->blockBitmaps = (((sizeof(RESULT_BLOCK) + 63) & ~(size_t)63) + store->blockHosts * sizeof(size_t) + 63) & ~(size_t)63;
+    store->keys = calloc(capacity, sizeof(size_t));
+    store->bitmaps = calloc(capacity, sizeof(size_t));
+    store->events = calloc(RESULT_QUEUE_SIZE, sizeof(RESULT_EVENT));
+    LockInit(&store->arenaLock);
+    if(store->keys == NULL || store->bitmaps == NULL || store->events == NULL) {
+        printf("Error: Unable to allocate the result store.\n");
+        ResultClose(store);
+        return FALSE;
+    }
+    for(size_t i = 0; i < RESULT_QUEUE_SIZE; i++) store->events[i].sequence = i;
+    if(config->journalFile != NULL && JournalOpen(store) == FALSE) {
+        ResultClose(store);
+        return FALSE;
+    }
+
+    if(ThreadStart(&store->writer, ResultWriter, store) == FALSE) {
+        printf("Error: Unable to start the result writer thread.\n");
+        ResultClose(store);
+        return FALSE;
+    }
+    store->writing = TRUE;
+    return TRUE;
+}
+
+/*
+Function hands out zeroed space for one host's bitmap from the arena. Threads
+bump the current block's count without a lock, and only the thread that
+finds the block full takes the lock to chain a new one. Under -journal the
+blocks are mapped from the journal file instead of the heap.
+Params:
+    PRESULT_STORE   store       -       [The store to carve from.]
+    size_t          **key       -       [Receives the block's key cell for the bitmap, set once the host is claimed.]
+Returns unsigned char *, NULL when memory runs out.
+*/
+static unsigned char *ResultCarve(PRESULT_STORE store, size_t **key) {
+    size_t keys = (sizeof(RESULT_BLOCK) + 63) & ~(size_t)63;        // Keys, then bitmaps, each begin on a cache line.
+    while(TRUE) {
+        PRESULT_BLOCK block = (PRESULT_BLOCK)AtomicLoad(&store->arena);
+        if(block != NULL) {
+            size_t index = AtomicAdd(&block->used, 1);
+            if(index < store->blockHosts) {
+                *key = (size_t*)((unsigned char*)block + keys) + index;
+                return (unsigned char*)block + store->blockBitmaps + index * store->hostBytes;
+            }
+        }
+
+        LockAcquire(&store->arenaLock);
+        if(AtomicLoad(&store->arena) == (size_t)block) {            // Nobody replaced the full block yet.
+            PRESULT_BLOCK fresh = NULL;
+            if(store->journal != NULL) fresh = JournalBlock(store->journal, store->journal->header->blocks);
+            else {
+#ifdef _WIN32
+                fresh = _aligned_malloc(RESULT_BLOCK_SIZE, 64);
+                if(fresh != NULL) memset(fresh, 0, RESULT_BLOCK_SIZE);
+#else
+                if(posix_memalign((void**)&fresh, 64, RESULT_BLOCK_SIZE) != 0) fresh = NULL;
+                else memset(fresh, 0, RESULT_BLOCK_SIZE);
+#endif
+            }
+            if(fresh == NULL) {
+                LockRelease(&store->arenaLock);
+                return NULL;
+            }
+            fresh->next = block;
+            if(store->journal != NULL) store->journal->header->blocks++;
+            AtomicStore(&store->arena, (size_t)fresh);
+        }
+        LockRelease(&store->arenaLock);
+    }
+}
+
+/*
+Function finds the port bitmap of a host, adding the host on its first result.
+Hosts live in an open addressed table claimed with compare and swap, so only
+hosts that answered cost memory and no thread waits on another.
+Params:
+    PRESULT_STORE   store       -       [The store to look in.]
+    size_t          target      -       [The host's index in the target set.]
+    BOOL            create      -       [Add the host when it is missing.]
+Returns unsigned char *, NULL when the host is missing or the table is full.
+*/
+static unsigned char *ResultHost(PRESULT_STORE store, size_t target, BOOL create) {
+    size_t key = target + 1;
+    size_t slot = (size_t)MixSeed(key) & store->mask;
+    unsigned char *fresh = NULL;
+    size_t *freshKey = NULL;
+
+    while(TRUE) {
+        size_t found = AtomicLoad(&store->keys[slot]);
+        if(found == key) {
+            size_t bitmap;
+            while((bitmap = AtomicLoad(&store->bitmaps[slot])) == 0);  // The thread that claimed it is publishing the bitmap.
+            return (unsigned char*)bitmap;                           // A carved bitmap left over from a lost race is simply unused.
+        }
+        if(found == 0) {
+            if(create == FALSE || AtomicLoad(&store->hosts) >= store->limit) return NULL;
+            if(fresh == NULL && (fresh = ResultCarve(store, &freshKey)) == NULL) return NULL;
+            if(AtomicCas(&store->keys[slot], 0, key) == FALSE) continue;  // Lost the slot, see who took it.
+            *freshKey = key;                                         // Lets a journal find the host again after a restart.
+            AtomicAdd(&store->hosts, 1);
+            AtomicStore(&store->bitmaps[slot], (size_t)fresh);
+            return fresh;
+        }
+        slot = (slot + 1) & store->mask;
+    }
+}
+
+/*
+Function reads what a port was classified as.
+Params:
+    PRESULT_STORE   store       -       [The store to look in.]
+    size_t          target      -       [The host's index in the target set.]
+    WORD            port        -       [The port, inside the scanned range.]
+Returns int, 0 while unclassified, then 1 open, 2 closed or 3 filtered and open|filtered.
+*/
+int ResultGet(PRESULT_STORE store, size_t target, WORD port) {
+    unsigned char *bitmap = ResultHost(store, target, FALSE);
+    size_t offset = (port - store->config->portStart) * 2;
+    if(bitmap == NULL) return 0;
+    return (AtomicOrByte(&bitmap[offset / 8], 0) >> (offset % 8)) & 3;
+}
+
+/*
+Function queues a result for the writer thread. Probe threads never touch the
+output files, they only wait here when the writer is a whole ring behind.
+Params:
+    PRESULT_STORE   store       -       [The store owning the ring.]
+    size_t          target      -       [The probed host's index in the target set.]
+    WORD            port        -       [The probed port.]
+    PortState       state       -       [What the probe found.]
+    const char      *service    -       [The service a banner came from, NULL for a port result.]
+    char            *banner     -       [The banner text, freed by the writer, or NULL.]
+Returns nothing.
+*/
+static void ResultPush(PRESULT_STORE store, size_t target, WORD port, PortState state, const char *service, char *banner) {
+    size_t position = 0;
+    PRESULT_EVENT event;
+    while((event = RingClaim(&store->tail, store->events, sizeof(RESULT_EVENT), RESULT_QUEUE_SIZE, &position)) == NULL) SleepMicros(100);
+    event->target = target;
+    event->port = port;
+    event->state = (unsigned char)state;
+    event->time = (ULONG)time(NULL);
+    event->service = service;
+    event->banner = banner;
+    AtomicStore(&event->sequence, position + 1);                    // Hand it to the writer.
+}
+
+/*
+Function records the outcome of a probe. The first result for a port sets its
+two bits with a compare and swap and is counted and streamed, later ones for
+the same port, such as a retransmitted SYN-ACK or a reset after it, are
+dropped and leave the first state alone.
+Params:
+    PRESULT_STORE   store       -       [The store to record in.]
+    size_t          target      -       [The host's index in the target set.]
+    WORD            port        -       [The probed port, inside the scanned range.]
+    PortState       state       -       [What the probe found.]
+Returns BOOL, TRUE the first time the port is classified.
+*/
+BOOL ResultSet(PRESULT_STORE store, size_t target, WORD port, PortState state) {
+    unsigned char *bitmap = ResultHost(store, target, TRUE);
+    size_t offset = (port - store->config->portStart) * 2;
+    unsigned char code = state == PortOpen ? 1 : state == PortClosed ? 2 : 3;
+
+    if(bitmap != NULL) {                                            // Only an empty field is written, so the first result stays.
+        unsigned char old;
+        do {
+            old = AtomicOrByte(&bitmap[offset / 8], 0);             // An atomic read, the neighbours' fields change under us.
+            if((old >> (offset % 8)) & 3) return FALSE;
+        } while(AtomicCasByte(&bitmap[offset / 8], old, (unsigned char)(old | code << (offset % 8))) == FALSE);
+    }
+    else AtomicAdd(&store->overflow, 1);                            // Streamed, but not kept or deduplicated.
+
+    AtomicAdd(&store->counts[state], 1);
+    if(state == PortOpen || store->config->debug == TRUE) ResultPush(store, target, port, state, NULL, NULL);
+    return TRUE;
+}
+
+/*
+Function queues the banner read from an open port for the writer thread.
+Params:
+    PRESULT_STORE   store       -       [The store owning the ring.]
+    size_t          target      -       [The host's index in the target set.]
+    WORD            port        -       [The open port.]
+    const char      *service    -       [The service the banner matched, or "unknown".]
+    char            *banner     -       [Printable banner text, which the writer frees.]
+Returns nothing.
+*/
+void ResultBanner(PRESULT_STORE store, size_t target, WORD port, const char *service, char *banner) {
+    ResultPush(store, target, port, PortOpen, service, banner);
+}
+
+/*
+Function writes a banner to the text, json and csv outputs. The binary format
+only carries port states.
+Params:
+    PRESULT_STORE   store       -       [The store holding the output files.]
+    PRESULT_EVENT   event       -       [The banner to write, its text is freed.]
+    const char      *address    -       [The address as text.]
+    const char      *host       -       [The address as it goes before a port, ipv6 in brackets.]
+Returns nothing.
+*/
+static void ResultWriteBanner(PRESULT_STORE store, PRESULT_EVENT event, const char *address, const char *host) {
+    if(store->text == TRUE) {
+        if(store->config->targets.count <= 1) printf("BANNER [%hu] %s %s\n", event->port, event->service, event->banner);
+        else printf("BANNER [%s:%hu] %s %s\n", host, event->port, event->service, event->banner);
+    }
+    if(store->json != NULL) {                                       // Banners are printable ascii, only quotes and backslashes need escaping.
+        fprintf(store->json, "{\"ip\":\"%s\",\"port\":%hu,\"proto\":\"tcp\",\"service\":\"%s\",\"banner\":\"", address, event->port, event->service);
+        for(char *c = event->banner; *c != 0; c++) {
+            if(*c == '"' || *c == '\\') fputc('\\', store->json);
+            fputc(*c, store->json);
+        }
+        fprintf(store->json, "\",\"time\":%lu}\n", (unsigned long)event->time);
+    }
+    if(store->csv != NULL) {
+        fprintf(store->csv, "%s,%hu,tcp,open,%lu,%s,\"", address, event->port, (unsigned long)event->time, event->service);
+        for(char *c = event->banner; *c != 0; c++) {
+            if(*c == '"') fputc('"', store->csv);
+            fputc(*c, store->csv);
+        }
+        fprintf(store->csv, "\"\n");
+    }
+    free(event->banner);
+}
+
+/*
+Function writes one result in every format that was asked for.
+Params:
+    PRESULT_STORE   store       -       [The store holding the output files.]
+    PRESULT_EVENT   event       -       [The result to write.]
+Returns nothing.
+*/
+static void ResultWrite(PRESULT_STORE store, PRESULT_EVENT event) {
+    PSCAN_CONFIG config = store->config;
+    const char *proto = config->pt == Udp ? "udp" : "tcp";
+    BOOL v6 = event->target >= config->targets.first6;
+    char address[INET6_ADDRSTRLEN] = {0};
+    char host[INET6_ADDRSTRLEN + 2] = {0};
+
+    TargetText(&config->targets, event->target, address);
+    snprintf(host, sizeof(host), v6 ? "[%s]" : "%s", address);
+    if(event->banner != NULL) {
+        ResultWriteBanner(store, event, address, host);
+        return;
+    }
+    if(store->text == TRUE) {
+        if(config->targets.count <= 1) printf("%s [%hu]\n", RESULT_LABELS[event->state], event->port);  // Single host scans keep the original output.
+        else printf("%s [%s:%hu]\n", RESULT_LABELS[event->state], host, event->port);
+    }
+    if(store->json != NULL) {
+        fprintf(store->json, "{\"ip\":\"%s\",\"port\":%hu,\"proto\":\"%s\",\"state\":\"%s\",\"time\":%lu}\n",
+                address, event->port, proto, RESULT_NAMES[event->state], (unsigned long)event->time);
+    }
+    if(store->csv != NULL) {
+        fprintf(store->csv, "%s,%hu,%s,%s,%lu,,\n", address, event->port, proto, RESULT_NAMES[event->state], (unsigned long)event->time);
+    }
+    if(store->binary != NULL) {                                     // Address, port, state, a reserved byte and time, all big endian.
+        unsigned char record[24];
+        size_t width = config->targets.first6 < config->targets.count ? 16 : 4;  // Version 2 maps ipv4 into ::ffff:0:0/96.
+        if(v6 == TRUE) TargetAt6(&config->targets, event->target, record);
+        else {
+            ULONG ipAddress = TargetAt(&config->targets, event->target);
+            memset(record, 0, width - 4);
+            if(width == 16) record[10] = record[11] = 0xff;
+            memcpy(record + width - 4, &ipAddress, 4);
+        }
+        record[width] = (unsigned char)(event->port >> 8);
+        record[width + 1] = (unsigned char)event->port;
+        record[width + 2] = event->state;
+        record[width + 3] = 0;
+        for(int i = 0; i < 4; i++) record[width + 4 + i] = (unsigned char)(event->time >> (24 - i * 8));
+        fwrite(record, 1, width + 8, store->binary);
+    }
+}
+
+/*
+Function drains the result ring into the outputs until the store closes,
+flushing the files whenever the ring runs dry. It also takes the journal's
+checkpoints, so probe threads never do.
+Params:
+    void    *arg        -       [The PRESULT_STORE to write for.]
+Returns THREAD_RETURN.
+*/
+THREAD_RETURN ResultWriter(void *arg) {
+    PRESULT_STORE store = arg;
+    while(TRUE) {
+        size_t closing = AtomicLoad(&store->closing);               // Read first, so nothing queued before the close is missed.
+        size_t written = 0;
+        PRESULT_EVENT event;
+        if(store->journal != NULL && NowMicros() - store->journal->savedAt >= JOURNAL_INTERVAL_US) JournalCheckpoint(store);
+        while((event = RingTake(store->events, sizeof(RESULT_EVENT), RESULT_QUEUE_SIZE, store->head)) != NULL) {
+            ResultWrite(store, event);
+            AtomicStore(&event->sequence, store->head + RESULT_QUEUE_SIZE);  // Free for the next lap.
+            store->head++;
+            written++;
+        }
+        if(written > 0) continue;
+
+        fflush(stdout);
+        if(store->json != NULL) fflush(store->json);
+        if(store->csv != NULL) fflush(store->csv);
+        if(store->binary != NULL) fflush(store->binary);
+        if(closing != 0) break;
+        SleepMicros(RESULT_IDLE_US);
+    }
+    return 0;
+}
+
+/*
+Function waits for the writer to drain every queued result, closes the output
+files and frees the store. Call it once no probe thread is running.
+Params:
+    PRESULT_STORE   store       -       [The store to close.]
+Returns nothing.
+*/
+void ResultClose(PRESULT_STORE store) {
+    FILE *files[] = {store->json, store->csv, store->binary};
+    PRESULT_BLOCK block = store->journal != NULL ? NULL : (PRESULT_BLOCK)store->arena;  // Journal blocks are unmapped by JournalClose.
+
+    AtomicStore(&store->closing, 1);
+    if(store->writing == TRUE) ThreadJoin(store->writer);
+    for(int i = 0; i < 3; i++) if(files[i] != NULL && files[i] != stdout) fclose(files[i]);
+
+    if(store->config->debug == TRUE && store->writing == TRUE) {
+        printf("Results [%u] hosts answered, [%llu] open, [%llu] closed, [%llu] filtered, [%llu] open|filtered, [%llu] bytes of port states\n",
+               (unsigned)store->hosts, (unsigned long long)store->counts[PortOpen], (unsigned long long)store->counts[PortClosed],
+               (unsigned long long)store->counts[PortFiltered], (unsigned long long)store->counts[PortOpenFiltered],
+               (unsigned long long)(store->hosts * store->hostBytes));
+        if(store->overflow > 0) {
+            printf("Results [%llu] for hosts past the first [%u] were streamed but not kept\n", (unsigned long long)store->overflow, (unsigned)store->limit);
+        }
+    }
+    while(block != NULL) {
+        PRESULT_BLOCK next = block->next;
+#ifdef _WIN32
+        _aligned_free(block);
+#else
+        free(block);
+#endif
+        block = next;
+    }
+    if(store->journal != NULL) JournalClose(store);
+    LockFree(&store->arenaLock);
+    free(store->keys);
+    free(store->bitmaps);
+    free(store->events);
+    memset(store, 0, sizeof(RESULT_STORE));
+}
+
+/*
+Function measures how fast results go into the store. The store pass records
+closed ports, which are kept but not streamed unless -dbg is set, and the
+stream pass records open ports so every one also goes through the ring to the
+writer. Each pass then records the other state over the first ports it
+filled and counts the ports that changed, which must stay zero since the
+first result wins. Pass -oJ, -oC or -oB to include formatting and file writes.
+Params:
+    PSCAN_CONFIG    config      -       [The targets and port range to fill.]
+Returns nothing.
+*/
+void ResultBenchmark(PSCAN_CONFIG config) {
+    const PortState states[] = {PortClosed, PortOpen};
+    const char *names[] = {"store", "stream"};
+    size_t portCount = config->portEnd - config->portStart + 1;
+    UINT64 pairs = (UINT64)config->targets.count * portCount;
+
+    for(int pass = 0; pass < 2; pass++) {
+        RESULT_STORE store;
+        if(ResultInit(&store, config) == FALSE) return;
+        store.text = FALSE;                                         // The terminal would be the bottleneck.
+
+        UINT64 records = 0, start = NowMicros(), elapsed = 0;
+        while(elapsed < (UINT64)(BENCH_SECONDS * 1000000) && records < pairs) {
+            for(size_t n = 0; n < 4096 && records < pairs; n++, records++) {
+                size_t target = (size_t)(records / portCount);
+                ResultSet(&store, target, (WORD)(config->portStart + records % portCount), states[pass]);
+            }
+            elapsed = NowMicros() - start;
+        }
+        size_t overwritten = 0;
+        for(UINT64 r = 0; r < records && r < 4096; r++) {          // A late conflicting answer must not change the kept state.
+            size_t target = (size_t)(r / portCount);
+            WORD port = (WORD)(config->portStart + r % portCount);
+            ResultSet(&store, target, port, states[1 - pass]);
+            if(r / portCount < store.limit && ResultGet(&store, target, port) != (states[pass] == PortOpen ? 1 : 2)) overwritten++;
+        }
+        size_t hosts = store.hosts, bytes = store.hosts * store.hostBytes;
+        BOOL debug = config->debug;
+        config->debug = FALSE;                                      // Keep the summary line out of the bench output.
+        ResultClose(&store);
+        config->debug = debug;
+        elapsed = NowMicros() - start;
+
+        printf("BENCH results path=%s records=%llu hosts=%u seconds=%.3f rate=%.0f bytes_per_host=%u kb=%llu overwritten=%u\n", names[pass],
+               (unsigned long long)records, (unsigned)hosts, elapsed / 1e6, records * 1e6 / (elapsed > 0 ? elapsed : 1),
+               (unsigned)(hosts > 0 ? bytes / hosts : 0), (unsigned long long)(bytes / 1024), (unsigned)overwritten);
+        fflush(stdout);
+    }
+}
+
+/*
+Function records the outcome of a single probe in the result store, which
+streams it to the outputs the first time the port is classified.
+Params:
+    PSCAN_CONFIG    config      -       [The scan settings, holding the targets and the store.]
+    size_t          target      -       [The probed host's index in the target set, (size_t)-1 for a stray reply.]
+    WORD            port        -       [The probed port.]
+    PortState       state       -       [What the probe found.]
+Returns BOOL, TRUE the first time the port is classified.
+*/
+BOOL ReportPortState(PSCAN_CONFIG config, size_t target, WORD port, PortState state) {
+    if(port < config->portStart || port > config->portEnd) return FALSE;
+    if(target == (size_t)-1) return FALSE;
+    return ResultSet(config->results, target, port, state);
+}
+
+/*
+Function reads the command line saved in a journal, so -resume can run the
+same scan again.
+Params:
+    const char  *path       -       [The journal file.]
+    int         *argc       -       [Receives the argument count.]
+Returns char **, the arguments and their text in one allocation to free, or NULL.
+*/
+char **JournalArguments(const char *path, int *argc) {
+    JOURNAL_HEADER header;
+    size_t length = JOURNAL_HEADER_SIZE - sizeof(JOURNAL_HEADER);
+    FILE *file = fopen(path, "rb");
+    char **argv = NULL, *text = NULL, *end = NULL;
+
+    if(file == NULL) {
+        printf("Error: Unable to open [%s].\n", path);
+        return NULL;
+    }
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "CPSJ", 4) != 0 || header.version != JOURNAL_VERSION ||
+       header.argc < 2 || header.argc > length / 2 || (argv = malloc(header.argc * sizeof(char*) + length + 1)) == NULL) {
+        printf("Error: [%s] is not a cpscan journal.\n", path);
+        fclose(file);
+        return NULL;
+    }
+    text = (char*)(argv + header.argc);
+    end = text + fread(text, 1, length, file);
+    *end = 0;                                                       // A cut short file still ends in a terminator.
+    fclose(file);
+
+    for(ULONG i = 0; i < header.argc; i++) {
+        if(text >= end) {
+            printf("Error: The command line in [%s] is cut short.\n", path);
+            free(argv);
+            return NULL;
+        }
+        argv[i] = text;
+        text += strlen(text) + 1;
+    }
+    *argc = (int)header.argc;
+    return argv;
+}
+
+/*
+Function hashes everything that decides which probe sits at which position,
+so a journal is never resumed against a different scan.
+Params:
+    PSCAN_CONFIG    config      -       [The loaded targets, port range and probe order.]
+Returns UINT64.
+*/
+static UINT64 JournalFingerprint(PSCAN_CONFIG config) {
+    UINT64 fields[] = {config->portStart, config->portEnd, config->pt, config->synScan, config->randomOrder,
+                       config->randomOrder == TRUE ? config->seed : 0, config->shard, config->shardCount, config->targets.count};
+    UINT64 hash = MixSeed(JOURNAL_VERSION);
+
+    for(size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) hash = MixSeed(hash ^ fields[i]);
+    for(size_t i = 0; i < config->targets.rangeCount; i++) {
+        hash = MixSeed(hash ^ ((UINT64)config->targets.ranges[i].first << 32 | config->targets.ranges[i].last));
+    }
+    for(size_t i = 0; i < config->targets.range6Count; i++) {
+        PTARGET_RANGE6 range = &config->targets.ranges6[i];
+        hash = MixSeed(MixSeed(MixSeed(hash ^ range->high) ^ range->first) ^ range->last);
+    }
+    return hash;
+}
+
+/*
+Function maps part of the journal file, growing the file first when needed.
+Grown space reads as zeroes.
+Params:
+    PJOURNAL    journal     -       [The open journal.]
+    UINT64      offset      -       [Where the view starts, a multiple of the mapping granularity.]
+    size_t      length      -       [How many bytes to map.]
+Returns void *, NULL when the file could not be grown or mapped.
+*/
+static void *JournalMap(PJOURNAL journal, UINT64 offset, size_t length) {
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMappingA(journal->file, NULL, PAGE_READWRITE, (DWORD)((offset + length) >> 32), (DWORD)(offset + length), NULL);
+    void *view = NULL;
+    if(mapping == NULL) return NULL;
+    view = MapViewOfFile(mapping, FILE_MAP_WRITE, (DWORD)(offset >> 32), (DWORD)offset, length);
+    CloseHandle(mapping);                                           // The view keeps the mapping open.
+    return view;
+#else
+    struct stat info;
+    void *view = NULL;
+    if(fstat(journal->file, &info) != 0) return NULL;
+    if((UINT64)info.st_size < offset + length && ftruncate(journal->file, (off_t)(offset + length)) != 0) return NULL;
+    view = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, journal->file, (off_t)offset);
+    return view == MAP_FAILED ? NULL : view;
+#endif
+}
+
+/*
+Function asks the system to write a mapped view back to the journal file
+without waiting for it. Dirty pages outlive a killed process either way, this
+only narrows what a power cut can lose.
+Params:
+    void    *view       -       [The mapped view.]
+    size_t  length      -       [Its length.]
+Returns nothing.
+*/
+static void JournalFlush(void *view, size_t length) {
+#ifdef _WIN32
+    FlushViewOfFile(view, length);
+#else
+    msync(view, length, MS_ASYNC);
+#endif
+}
+
+/*
+Function maps one result block of the journal.
+Params:
+    PJOURNAL    journal     -       [The open journal.]
+    UINT64      index       -       [The block's number, counting from the header.]
+Returns PRESULT_BLOCK, NULL when the file could not be grown or mapped.
+*/
+PRESULT_BLOCK JournalBlock(PJOURNAL journal, UINT64 index) {
+    return JournalMap(journal, JOURNAL_HEADER_SIZE + index * RESULT_BLOCK_SIZE, RESULT_BLOCK_SIZE);
+}
+
+/*
+Function opens the -journal file for the result store. A new scan writes a
+fresh header with its command line. A resumed scan checks that the journal
+belongs to the same targets, ports and probe order, then maps its blocks back
+and rebuilds the host table from the key stored beside every bitmap.
+Params:
+    PRESULT_STORE   store       -       [The store, with its host table allocated and empty.]
+Returns BOOL.
+*/
+BOOL JournalOpen(PRESULT_STORE store) {
+    PSCAN_CONFIG config = store->config;
+    PJOURNAL journal = calloc(1, sizeof(JOURNAL));
+    PJOURNAL_HEADER header = NULL;
+    UINT64 fingerprint = JournalFingerprint(config);
+    size_t keys = (sizeof(RESULT_BLOCK) + 63) & ~(size_t)63;
+
+    if(journal == NULL) return FALSE;
+    store->journal = journal;
+#ifdef _WIN32
+    journal->file = CreateFileA(config->journalFile, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                                config->resume == TRUE ? OPEN_EXISTING : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(journal->file == INVALID_HANDLE_VALUE) {
+#else
+    journal->file = open(config->journalFile, O_RDWR | O_CLOEXEC | (config->resume == TRUE ? 0 : O_CREAT | O_TRUNC), 0644);
+    if(journal->file < 0) {
+#endif
+        printf("Error: Unable to open the journal [%s].\n", config->journalFile);
+        return FALSE;
+    }
+    if((header = journal->header = JournalMap(journal, 0, JOURNAL_HEADER_SIZE)) == NULL) {
+        printf("Error: Unable to map the journal [%s].\n", config->journalFile);
+        return FALSE;
+    }
+
+    if(config->resume == FALSE) {                                   // The command line, plus the seed a random order picked.
+        char seed[32], *text = (char*)(header + 1), *end = (char*)header + JOURNAL_HEADER_SIZE;
+        int extra = config->randomOrder == TRUE && config->seedSet == FALSE ? 2 : 0;
+        snprintf(seed, sizeof(seed), "%llu", (unsigned long long)config->seed);
+        for(int i = 0; i < config->argc + extra; i++) {
+            const char *argument = i < config->argc ? config->argv[i] : i == config->argc ? "-seed" : seed;
+            if((size_t)(end - text) <= strlen(argument)) {
+                printf("Error: The command line is too long to keep in the journal.\n");
+                return FALSE;
+            }
+            memcpy(text, argument, strlen(argument) + 1);
+            text += strlen(argument) + 1;
+        }
+        memcpy(header->magic, "CPSJ", 4);
+        header->version = JOURNAL_VERSION;
+        header->fingerprint = fingerprint;
+        header->hostBytes = store->hostBytes;
+        header->argc = (ULONG)(config->argc + extra);
+    }
+    else if(memcmp(header->magic, "CPSJ", 4) != 0 || header->version != JOURNAL_VERSION || header->fingerprint != fingerprint ||
+            header->hostBytes != store->hostBytes) {
+        printf("Error: [%s] was written for a different scan, the targets, ports or probe order changed.\n", config->journalFile);
+        return FALSE;
+    }
+
+    for(UINT64 i = 0; i < header->blocks; i++) {                    // Put every kept host back in the table.
+        PRESULT_BLOCK block = JournalBlock(journal, i);
+        if(block == NULL) {
+            printf("Error: Unable to map block [%llu] of the journal.\n", (unsigned long long)i);
+            return FALSE;
+        }
+        block->next = (PRESULT_BLOCK)store->arena;                  // The old chain pointed into the last run's mappings.
+        store->arena = (size_t)block;
+        for(size_t j = 0; j < block->used && j < store->blockHosts; j++) {
+            size_t key = ((size_t*)((unsigned char*)block + keys))[j];
+            size_t slot = (size_t)MixSeed(key) & store->mask;
+            if(key == 0 || key > config->targets.count || store->hosts >= store->limit) continue;
+            while(store->keys[slot] != 0 && store->keys[slot] != key) slot = (slot + 1) & store->mask;
+            if(store->keys[slot] == key) continue;
+            store->keys[slot] = key;
+            store->bitmaps[slot] = (size_t)((unsigned char*)block + store->blockBitmaps + j * store->hostBytes);
+            store->hosts++;
+        }
+    }
+    header->finished = 0;
+    journal->sent = journal->pending = (size_t)header->settled;
+    journal->settleUs = config->timeout <= 1 ? DEFAULT_TIMEOUT*1000 : (UINT64)config->timeout*1000;
+    journal->savedAt = journal->pendingAt = NowMicros();
+    return TRUE;
+}
+
+/*
+Function returns where the senders start, the settled progress of the
+journal when resuming and zero otherwise.
+Params:
+    PSCAN_CONFIG    config      -       [The scan settings, holding the store.]
+Returns size_t, a probe position, or for udp a round times the probe count plus a position.
+*/
+size_t JournalStart(PSCAN_CONFIG config) {
+    PJOURNAL journal = config->results->journal;
+    return journal != NULL && config->resume == TRUE ? (size_t)journal->header->settled : 0;
+}
+
+/*
+Function takes a checkpoint. The port bitmaps already live in the journal, so
+this only moves the settled progress forward to what the senders had reached
+a whole reply wait ago, and flushes the mapped views.
+Params:
+    PRESULT_STORE   store       -       [The store owning the journal.]
+Returns nothing.
+*/
+void JournalCheckpoint(PRESULT_STORE store) {
+    PJOURNAL journal = store->journal;
+    UINT64 now = NowMicros();
+
+    if(now - journal->pendingAt >= journal->settleUs) {             // Probes sent before pendingAt have had time to be answered.
+        journal->header->settled = journal->pending;
+        journal->pending = AtomicLoad(&journal->sent);
+        journal->pendingAt = now;
+    }
+    journal->header->saved = (UINT64)time(NULL);
+    for(PRESULT_BLOCK block = (PRESULT_BLOCK)AtomicLoad(&store->arena); block != NULL; block = block->next) JournalFlush(block, RESULT_BLOCK_SIZE);
+    JournalFlush(journal->header, JOURNAL_HEADER_SIZE);
+    journal->savedAt = now;
+}
+
+/*
+Function streams the results a resumed journal already holds, so the outputs
+of the resumed run are complete, and hands its open tcp ports to the banner
+stage again. Filtered and open|filtered share a code in the bitmap, they come
+back as filtered for tcp and open|filtered for udp.
+Params:
+    PSCAN_CONFIG    config      -       [The scan settings, holding the store and the banner stage.]
+Returns nothing.
+*/
+void JournalReplay(PSCAN_CONFIG config) {
+    PRESULT_STORE store = config->results;
+    size_t portCount = config->portEnd - config->portStart + 1;
+    UINT64 restored = 0;
+
+    for(size_t slot = 0; slot <= store->mask; slot++) {
+        unsigned char *bitmap = (unsigned char*)store->bitmaps[slot];
+        if(store->keys[slot] == 0) continue;
+        size_t target = store->keys[slot] - 1;
+        for(size_t i = 0; i < portCount; i++) {
+            int code = (bitmap[i / 4] >> (i % 4 * 2)) & 3;
+            PortState state = code == 1 ? PortOpen : code == 2 ? PortClosed : config->pt == Udp ? PortOpenFiltered : PortFiltered;
+            WORD port = (WORD)(config->portStart + i);
+            if(code == 0) continue;
+            store->counts[state]++;
+            restored++;
+            if(state == PortOpen || config->debug == TRUE) ResultPush(store, target, port, state, NULL, NULL);
+            if(state == PortOpen && config->bannerStage != NULL) BannerOffer(config->bannerStage, target, port, INVALID_SOCKET);
+        }
+    }
+    if(config->debug == TRUE) {
+        printf("Resuming [%s] with [%u] hosts and [%llu] results restored, senders continue from [%llu]\n", config->journalFile,
+               (unsigned)store->hosts, (unsigned long long)restored, (unsigned long long)store->journal->header->settled);
+    }
+}
+
+/*
+Function takes a last checkpoint and unmaps the journal. A scan that ran to
+the end is marked finished, with every probe settled.
+Params:
+    PRESULT_STORE   store       -       [The store owning the journal, its writer already stopped.]
+Returns nothing.
+*/
+void JournalClose(PRESULT_STORE store) {
+    PJOURNAL journal = store->journal;
+    PRESULT_BLOCK block = (PRESULT_BLOCK)store->arena;
+
+    if(journal->header != NULL && store->writing == TRUE) {
+        journal->pendingAt = 0;                                     // Nothing is in flight any more.
+        journal->pending = AtomicLoad(&journal->sent);
+        JournalCheckpoint(store);
+        journal->header->finished = 1;
+    }
+    while(block != NULL) {
+        PRESULT_BLOCK next = block->next;
+#ifdef _WIN32
+        UnmapViewOfFile(block);
+#else
+        munmap(block, RESULT_BLOCK_SIZE);
+#endif
+        block = next;
+    }
+#ifdef _WIN32
+    if(journal->header != NULL) UnmapViewOfFile(journal->header);
+    if(journal->file != NULL && journal->file != INVALID_HANDLE_VALUE) CloseHandle(journal->file);
+#else
+    if(journal->header != NULL) munmap(journal->header, JOURNAL_HEADER_SIZE);
+    if(journal->file >= 0) close(journal->file);
+#endif
+    free(journal);
+    store->journal = NULL;
+}
+
+/*
+Function sets up the scan counters, and the thread behind -progress and
+-metrics when either is on. Every probe thread takes a shard of its own, so
+counting never shares a cache line and the reader merges shards without a lock.
+Params:
+    PSTATS          stats       -       [The statistics to set up.]
+    PSCAN_CONFIG    config      -       [The probe count, -progress and -metrics.]
+Returns BOOL.
+*/
+BOOL StatsInit(PSTATS stats, PSCAN_CONFIG config) {
+    memset(stats, 0, sizeof(STATS));
+    stats->config = config;
+    stats->listener = INVALID_SOCKET;
+    stats->capacity = MAX_THREADS + STATS_EXTRA_SHARDS;
+    stats->total = ProbeCount(config);
+    stats->started = stats->lastAt = NowMicros();
+#ifdef _WIN32
+    stats->shards = _aligned_malloc(stats->capacity * sizeof(STATS_SHARD), 64);
+#else
+    if(posix_memalign((void**)&stats->shards, 64, stats->capacity * sizeof(STATS_SHARD)) != 0) stats->shards = NULL;
+#endif
+    if(stats->shards == NULL) {
+        printf("Error: Unable to allocate the scan statistics.\n");
+        return FALSE;
+    }
+    memset(stats->shards, 0, stats->capacity * sizeof(STATS_SHARD));
+
+    if(config->metricsPort != 0) {                                  // Loopback only, the metrics are for the machine running the scan.
+        struct sockaddr_in local = {0};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        local.sin_port = htons(config->metricsPort);
+        stats->listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+#ifndef _WIN32
+        int reuse = 1;                                              // Windows would let another process take the port instead.
+        if(stats->listener != INVALID_SOCKET) setsockopt(stats->listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#endif
+        if(stats->listener == INVALID_SOCKET || bind(stats->listener, (struct sockaddr*)&local, sizeof(local)) != 0 ||
+           listen(stats->listener, 16) != 0) {
+            printf("Error: Unable to serve metrics on port [%hu].\n", config->metricsPort);
+            if(stats->listener != INVALID_SOCKET) closesocket(stats->listener);
+            stats->listener = INVALID_SOCKET;
+        }
+    }
+    if(config->progress == TRUE || stats->listener != INVALID_SOCKET) {
+        if(ThreadStart(&stats->reporter, StatsReporter, stats) == FALSE) printf("Error: Unable to start the statistics thread.\n");
+        else stats->reporting = TRUE;
+    }
+    return TRUE;
+}
+
+/*
+Function hands a probe thread its own shard of counters.
+Params:
+    PSTATS  stats       -       [The statistics, or NULL for benchmarks that run without them.]
+Returns PSTATS_SHARD.
+*/
+PSTATS_SHARD StatsShard(PSTATS stats) {
+    static STATS_SHARD scratch;                                     // Benchmarks count into this, and nothing reads it.
+    size_t index = 0;
+    if(stats == NULL) return &scratch;
+    index = AtomicAdd(&stats->shardCount, 1);
+    return &stats->shards[index < stats->capacity ? index : stats->capacity - 1];  // Threads past the last shard share it.
+}
+
+/*
+Function adds to a counter in the calling thread's shard. Only that thread
+writes it, so a plain load and store is enough and no locked instruction is
+needed, while the reader still sees whole values.
+Params:
+    UINT64  *counter    -       [The counter.]
+    UINT64  value       -       [How much to add.]
+Returns nothing.
+*/
+static void StatAdd(UINT64 *counter, UINT64 value) {
+#ifdef _WIN32
+    *(volatile UINT64*)counter += value;                            // Aligned 64 bit stores are whole on x64.
+#else
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+#endif
+}
+
+/*
+Function finds the round trip bucket for a sample. Samples under 32 us get a
+bucket each, and above that every power of two is split into 16 buckets, so
+a bucket is never more than about 6% wide from 1 us to hours.
+Params:
+    UINT64  micros      -       [The round trip in microseconds.]
+Returns size_t.
+*/
+static size_t StatsBucket(UINT64 micros) {
+    size_t shift = 0;
+    while((micros >> shift) >= 32) shift++;
+    return 16 * shift + (size_t)(micros >> shift) < STATS_RTT_BUCKETS ? 16 * shift + (size_t)(micros >> shift) : STATS_RTT_BUCKETS - 1;
+}
+
+/*
+Function returns the largest round trip a bucket holds.
+Params:
+    size_t  index       -       [The bucket.]
+Returns UINT64, microseconds.
+*/
+static UINT64 StatsBucketLimit(size_t index) {
+    size_t shift = index < 32 ? 0 : index / 16 - 1;
+    return ((UINT64)(index - 16 * shift + 1) << shift) - 1;
+}
+
+/*
+Function records a round trip sample in the calling thread's shard.
+Params:
+    PSTATS_SHARD    shard       -       [The thread's shard.]
+    UINT64          micros      -       [The round trip in microseconds.]
+Returns nothing.
+*/
+static void StatsRtt(PSTATS_SHARD shard, UINT64 micros) {
+    StatAdd(&shard->rtt[StatsBucket(micros)], 1);
+    StatAdd(&shard->rttCount, 1);
+    StatAdd(&shard->rttSum, micros);
+}
+
+/*
+Function sums every shard into one, while the probe threads keep counting.
+Params:
+    PSTATS          stats       -       [The statistics to read.]
+    PSTATS_SHARD    merged      -       [Receives the totals.]
+Returns nothing.
+*/
+void StatsMerge(PSTATS stats, PSTATS_SHARD merged) {
+    size_t shards = AtomicLoad(&stats->shardCount), fields = sizeof(STATS_SHARD) / sizeof(UINT64);
+    memset(merged, 0, sizeof(STATS_SHARD));
+    if(shards > stats->capacity) shards = stats->capacity;
+    for(size_t i = 0; i < shards; i++) {                            // A shard is nothing but counters, so sum it field by field.
+        UINT64 *from = (UINT64*)&stats->shards[i], *to = (UINT64*)merged;
+        for(size_t j = 0; j < fields; j++) to[j] += AtomicLoad64(&from[j]);
+    }
+}
+
+/*
+Function finds a round trip percentile in a merged histogram.
+Params:
+    PSTATS_SHARD    merged      -       [The merged shard.]
+    double          fraction    -       [The percentile as a fraction, such as 0.99.]
+Returns UINT64, microseconds, or zero without samples.
+*/
+static UINT64 StatsPercentile(PSTATS_SHARD merged, double fraction) {
+    UINT64 rank = (UINT64)(merged->rttCount * fraction + 0.5), seen = 0;
+    if(merged->rttCount == 0) return 0;
+    if(rank < 1) rank = 1;
+    for(size_t i = 0; i < STATS_RTT_BUCKETS; i++) {
+        seen += merged->rtt[i];
+        if(seen >= rank) return StatsBucketLimit(i);
+    }
+    return StatsBucketLimit(STATS_RTT_BUCKETS - 1);
+}
+
+/*
+Function prints one progress line: how far the scan is, the send rate over
+the last interval, the counters, round trip percentiles and the time left.
+Params:
+    PSTATS  stats       -       [The statistics to report.]
+    FILE    *output     -       [Where to print, stderr so results on stdout stay clean.]
+Returns nothing.
+*/
+void StatsLine(PSTATS stats, FILE *output) {
+    STATS_SHARD merged;
+    UINT64 now = NowMicros(), done = 0, eta = 0;
+    double seconds = (now - stats->lastAt) / 1e6, rate = 0;
+
+    StatsMerge(stats, &merged);
+    done = merged.sent - merged.retransmits + merged.skipped;       // First probes, plus the ones a resumed scan had already done.
+    if(done > stats->total) done = stats->total;
+    if(seconds > 0) {
+        double pace = (done - stats->lastDone) / seconds;
+        rate = (merged.sent - stats->lastSent) / seconds;
+        stats->pace = stats->lastDone == 0 && stats->pace == 0 ? pace : 0.7 * stats->pace + 0.3 * pace;
+    }
+    if(done < stats->total && stats->pace > 0) eta = (UINT64)((stats->total - done) / stats->pace);
+
+    fprintf(output, "Progress [%.1f%%] [%llu/%llu] probes, [%.0f] sent per second, [%llu] replies, [%llu] timeouts, [%llu] retransmits, "
+                    "[%llu] errors, rtt p50 [%.2f] ms p99 [%.2f] ms, eta [%llu] s\n",
+            stats->total > 0 ? done * 100.0 / stats->total : 100.0, (unsigned long long)done, (unsigned long long)stats->total, rate,
+            (unsigned long long)merged.replies, (unsigned long long)merged.timeouts, (unsigned long long)merged.retransmits,
+            (unsigned long long)merged.errors, StatsPercentile(&merged, 0.5) / 1000.0, StatsPercentile(&merged, 0.99) / 1000.0,
+            (unsigned long long)eta);
+    fflush(output);
+    stats->lastAt = now;
+    stats->lastSent = merged.sent;
+    stats->lastDone = done;
+}
+
+/*
+Function appends formatted text to a buffer, dropping what does not fit.
+Params:
+    char        *text       -       [The buffer.]
+    size_t      size        -       [Its size.]
+    size_t      *length     -       [How much is used, moved forward.]
+    const char  *format     -       [The printf format.]
+Returns nothing.
+*/
+static void StatsPrint(char *text, size_t size, size_t *length, const char *format, ...) {
+    va_list args;
+    int written = 0;
+    if(*length + 1 >= size) return;
+    va_start(args, format);
+    written = vsnprintf(text + *length, size - *length, format, args);
+    va_end(args);
+    if(written > 0) *length = *length + written < size - 1 ? *length + written : size - 1;
+}
+
+/*
+Function writes the statistics in the prometheus text format.
+Params:
+    PSTATS  stats       -       [The statistics to export.]
+    char    *text       -       [The buffer.]
+    size_t  size        -       [Its size.]
+Returns size_t, the length written.
+*/
+static size_t StatsMetrics(PSTATS stats, char *text, size_t size) {
+    const char *names[] = {"probes_sent", "replies", "timeouts", "retransmits", "socket_errors", "probes_skipped"};
+    const char *help[] = {"Probes put on the wire, retransmits included.", "Probes the target answered.", "Probe deadlines that passed without an answer.",
+                          "Probes sent again after a timeout.", "Sockets that could not be opened, connected or sent on.",
+                          "Probes a resumed scan already had a result for."};
+    PRESULT_STORE results = stats->config->results;
+    STATS_SHARD merged;
+    UINT64 values[6], cumulative = 0;
+    size_t length = 0, bucket = 0;
+
+    StatsMerge(stats, &merged);
+    values[0] = merged.sent;
+    values[1] = merged.replies;
+    values[2] = merged.timeouts;
+    values[3] = merged.retransmits;
+    values[4] = merged.errors;
+    values[5] = merged.skipped;
+    for(int i = 0; i < 6; i++) {
+        StatsPrint(text, size, &length, "# HELP cpscan_%s_total %s\n# TYPE cpscan_%s_total counter\ncpscan_%s_total %llu\n",
+                   names[i], help[i], names[i], names[i], (unsigned long long)values[i]);
+    }
+    StatsPrint(text, size, &length, "# HELP cpscan_probes_planned Probes the scan sends before retransmits.\n"
+                                    "# TYPE cpscan_probes_planned gauge\ncpscan_probes_planned %llu\n", (unsigned long long)stats->total);
+    if(results != NULL) {
+        StatsPrint(text, size, &length, "# HELP cpscan_ports_total Ports classified, per state.\n# TYPE cpscan_ports_total counter\n");
+        for(int i = 0; i < 4; i++) {
+            StatsPrint(text, size, &length, "cpscan_ports_total{state=\"%s\"} %llu\n", RESULT_NAMES[i], (unsigned long long)AtomicLoad(&results->counts[i]));
+        }
+    }
+
+    StatsPrint(text, size, &length, "# HELP cpscan_rtt_seconds Connect round trips, from the log linear histogram.\n# TYPE cpscan_rtt_seconds histogram\n");
+    for(size_t i = 0; i < sizeof(STATS_BOUNDS) / sizeof(STATS_BOUNDS[0]); i++) {  // A bucket counts toward the first bound its largest value fits under.
+        while(bucket < STATS_RTT_BUCKETS && StatsBucketLimit(bucket) <= (UINT64)(STATS_BOUNDS[i] * 1e6)) cumulative += merged.rtt[bucket++];
+        StatsPrint(text, size, &length, "cpscan_rtt_seconds_bucket{le=\"%g\"} %llu\n", STATS_BOUNDS[i], (unsigned long long)cumulative);
+    }
+    StatsPrint(text, size, &length, "cpscan_rtt_seconds_bucket{le=\"+Inf\"} %llu\ncpscan_rtt_seconds_sum %.6f\ncpscan_rtt_seconds_count %llu\n",
+               (unsigned long long)merged.rttCount, merged.rttSum / 1e6, (unsigned long long)merged.rttCount);
+    return length;
+}
+
+/*
+Function answers one -metrics request if a client connects within the wait.
+Any request gets the metrics, the path is not looked at.
+Params:
+    PSTATS  stats       -       [The statistics, holding the listening socket.]
+    int     waitMs      -       [How long to wait for a client.]
+Returns nothing.
+*/
+static void StatsServe(PSTATS stats, int waitMs) {
+    struct pollfd pfd = {0};
+    char request[1024], body[16384], head[160];
+    size_t length = 0;
+    int headLength = 0;
+    SOCKET client = INVALID_SOCKET;
+
+    pfd.fd = stats->listener;
+    pfd.events = POLLIN;
+#ifdef _WIN32
+    if(WSAPoll(&pfd, 1, waitMs) <= 0) return;
+#else
+    if(poll(&pfd, 1, waitMs) <= 0) return;
+#endif
+    if((client = accept(stats->listener, NULL, NULL)) == INVALID_SOCKET) return;
+
+    pfd.fd = client;                                                // Let the request arrive, but never wait on a client for long.
+#ifdef _WIN32
+    if(WSAPoll(&pfd, 1, 1000) > 0) recv(client, request, sizeof(request), 0);
+#else
+    if(poll(&pfd, 1, 1000) > 0) recv(client, request, sizeof(request), 0);
+#endif
+    length = StatsMetrics(stats, body, sizeof(body));
+    headLength = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %u\r\n"
+                                              "Connection: close\r\n\r\n", (unsigned)length);
+    send(client, head, headLength, 0);
+    send(client, body, (int)length, 0);
+    closesocket(client);
+}
+
+/*
+Function runs the statistics thread. It prints the -progress line every
+second and answers -metrics requests in between.
+Params:
+    void    *arg        -       [The PSTATS to report.]
+Returns THREAD_RETURN.
+*/
+THREAD_RETURN StatsReporter(void *arg) {
+    PSTATS stats = arg;
+    UINT64 next = NowMicros() + STATS_INTERVAL_US;
+
+    while(AtomicLoad(&stats->closing) == 0) {
+        UINT64 now = NowMicros(), wait = 0;
+        if(now >= next) {
+            if(stats->config->progress == TRUE) StatsLine(stats, stderr);
+            next += STATS_INTERVAL_US;
+            continue;
+        }
+        wait = next - now < 10000 ? next - now : 10000;            // Notice the close within 10 ms.
+        if(stats->listener != INVALID_SOCKET) StatsServe(stats, (int)((wait + 999) / 1000));
+        else SleepMicros(wait);
+    }
+    return 0;
+}
+
+/*
+Function stops the statistics thread, prints a last progress line under
+-progress or -dbg and frees the shards.
+Params:
+    PSTATS  stats       -       [The statistics to close.]
+Returns nothing.
+*/
+void StatsClose(PSTATS stats) {
+    AtomicStore(&stats->closing, 1);
+    if(stats->reporting == TRUE) ThreadJoin(stats->reporter);
+    if(stats->shards != NULL && (stats->config->progress == TRUE || stats->config->debug == TRUE)) StatsLine(stats, stderr);
+    if(stats->listener != INVALID_SOCKET) closesocket(stats->listener);
+#ifdef _WIN32
+    _aligned_free(stats->shards);
+#else
+    free(stats->shards);
+#endif
+    memset(stats, 0, sizeof(STATS));
+}
+
+/*
+Function sets up the probe pacer from -rate, -hostrate and -netrate.
+Params:
+    PRATE_LIMITER   limiter     -       [The limiter to set up.]
+    PSCAN_CONFIG    config      -       [The caps in probes per second.]
+Returns BOOL.
+*/
+BOOL RateInit(PRATE_LIMITER limiter, PSCAN_CONFIG config) {
+    memset(limiter, 0, sizeof(RATE_LIMITER));
+    limiter->targets = &config->targets;
+    if(config->rate > 0) limiter->globalInterval = (UINT64)(1e9 / config->rate + 0.5);
+    if(config->hostRate > 0) limiter->hostInterval = (UINT64)(1e9 / config->hostRate + 0.5);
+    if(config->netRate > 0) limiter->netInterval = (UINT64)(1e9 / config->netRate + 0.5);
+    if(limiter->hostInterval > 0 && (limiter->hosts = calloc(RATE_BUCKETS, sizeof(UINT64))) == NULL) return FALSE;
+    if(limiter->netInterval > 0 && (limiter->nets = calloc(RATE_BUCKETS, sizeof(UINT64))) == NULL) return FALSE;
+    return TRUE;
+}
+
+/*
+Function takes a send slot from one token bucket. The bucket is kept as the
+time its next probe is due, the generic cell rate form of a token bucket, so
+taking a token is a single compare and swap and refilling needs no timer.
+A bucket that fell behind may send RATE_BURST probes early to catch up.
+Params:
+    volatile UINT64     *bucket     -       [When the bucket's next probe is due, in ns.]
+    UINT64              interval    -       [Nanoseconds per probe.]
+    UINT64              earliest    -       [The soonest the probe could go.]
+Returns UINT64, when the probe may be sent.
+*/
+static UINT64 RateTake(volatile UINT64 *bucket, UINT64 interval, UINT64 earliest) {
+    UINT64 tolerance = interval * RATE_BURST;
+    while(TRUE) {
+        UINT64 due = AtomicLoad64(bucket);
+        UINT64 base = due > earliest ? due : earliest;
+        if(AtomicCas64(bucket, due, base + interval) == TRUE) return due > earliest + tolerance ? due - tolerance : earliest;
+    }
+}
+
+/*
+Function reserves the send time of one probe against the per target, per
+network and global buckets. Ipv4 targets share a network per /24 and ipv6
+ones per /64. Each bucket is asked for a slot no sooner than the one before
+gave. The global bucket goes last, so its spacing applies to the time the
+probe really leaves; taken first, probes held back by different hosts could
+all leave at once, above -rate. Targets whose hashes share a bucket share
+its budget, which can only slow them down.
+Params:
+    PRATE_LIMITER   limiter     -       [The caps to respect.]
+    size_t          target      -       [The destination's index in the target set.]
+Returns UINT64, the NowNanos time the probe may be sent at.
+*/
+UINT64 RateReserve(PRATE_LIMITER limiter, size_t target) {
+    UINT64 at = NowNanos();
+    if(limiter->hostInterval > 0) at = RateTake(&limiter->hosts[MixSeed(target) & (RATE_BUCKETS - 1)], limiter->hostInterval, at);
+    if(limiter->netInterval > 0) {
+        UINT64 subnet, low;
+        if(target < limiter->targets->first6) subnet = ntohl(TargetAt(limiter->targets, target)) >> 8;
+        else {
+            unsigned char address[16];
+            TargetAt6(limiter->targets, target, address);
+            Address6Split(address, &subnet, &low);
+            subnet = ~subnet;                                       // Keeps a /64 off the /24 with the same number.
+        }
+        at = RateTake(&limiter->nets[MixSeed(subnet) & (RATE_BUCKETS - 1)], limiter->netInterval, at);
+    }
+    if(limiter->globalInterval > 0) at = RateTake(&limiter->global, limiter->globalInterval, at);
+    return at;
+}
+
+/*
+Function waits until a reserved send time. Long waits sleep until shortly
+before it and the rest is spun, so probes leave within a few microseconds of
+their slot instead of whenever the scheduler wakes the thread.
+Params:
+    UINT64  at      -       [The NowNanos time to wait for.]
+Returns nothing.
+*/
+void RateWait(UINT64 at) {
+    UINT64 now;
+    while((now = NowNanos()) < at) {
+        if(at - now > RATE_SPIN_NS) SleepMicros((at - now - RATE_SPIN_NS) / 1000);
+    }
+}
+
+/*
+Function frees the buckets allocated by RateInit.
+Params:
+    PRATE_LIMITER   limiter     -       [The limiter to free.]
+Returns nothing.
+*/
+void RateFree(PRATE_LIMITER limiter) {
+    free(limiter->hosts);
+    free(limiter->nets);
+    memset(limiter, 0, sizeof(RATE_LIMITER));
+}
+
+/*
+Function orders two delays for qsort.
+Params:
+    const void  *a      -       [The first UINT64.]
+    const void  *b      -       [The second UINT64.]
+Returns int.
+*/
+static int RateCompare(const void *a, const void *b) {
+    UINT64 x = *(const UINT64*)a, y = *(const UINT64*)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+Function measures the pacer. For several global rates one thread paces probes
+for a while and reports the rate reached, how late probes left their slot,
+and how much cpu the waiting took. A mixed pass reserves slots for many
+targets in scan order, held back by a low -hostrate, and reports the peak
+rate they leave at in any millisecond, which must stay near the global rate.
+A last pass times a reservation against all three bucket kinds with the caps
+set too high to ever wait.
+Params:
+    PSCAN_CONFIG    config      -       [The targets to charge the per target and per network buckets with.]
+Returns nothing.
+*/
+void RateBenchmark(PSCAN_CONFIG config) {
+    const double rates[] = {1000, 10000, 100000, 1000000};
+    double saved[3] = {config->rate, config->hostRate, config->netRate};
+
+    for(size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        RATE_LIMITER limiter;
+        size_t count = (size_t)(rates[r] * BENCH_SECONDS / 4);      // A quarter of the bench time per rate.
+        UINT64 *late = malloc(count * sizeof(UINT64));
+        if(late == NULL) return;
+        config->rate = rates[r];
+        config->hostRate = config->netRate = 0;
+        RateInit(&limiter, config);
+
+        clock_t cpu = clock();
+        UINT64 start = NowNanos();
+        for(size_t i = 0; i < count; i++) {
+            UINT64 at = RateReserve(&limiter, i % config->targets.count);
+            RateWait(at);
+            late[i] = NowNanos() - at;
+        }
+        UINT64 elapsed = NowNanos() - start;
+        double cpuSeconds = (double)(clock() - cpu) / CLOCKS_PER_SEC;
+
+        qsort(late, count, sizeof(UINT64), RateCompare);
+        printf("BENCH rate target=%.0f achieved=%.0f late_p50_ns=%llu late_p99_ns=%llu late_max_ns=%llu cpu=%.0f%%\n", rates[r],
+               count * 1e9 / elapsed, (unsigned long long)late[count / 2], (unsigned long long)late[count * 99 / 100],
+               (unsigned long long)late[count - 1], cpuSeconds * 1e9 / elapsed * 100);
+        fflush(stdout);
+        RateFree(&limiter);
+        free(late);
+    }
+
+    RATE_LIMITER limiter;
+    size_t count = config->targets.count * 8 < 100000 ? config->targets.count * 8 : 100000;
+    UINT64 *times = malloc(count * sizeof(UINT64));
+    if(times == NULL) return;
+    config->rate = 100000;
+    config->hostRate = 50;
+    config->netRate = 0;
+    RateInit(&limiter, config);
+    for(size_t i = 0; i < count; i++) times[i] = RateReserve(&limiter, MixSeed(i) % config->targets.count);
+    qsort(times, count, sizeof(UINT64), RateCompare);
+    size_t peak = 0;
+    for(size_t first = 0, last = 0; last < count; last++) {         // The most slots that fall in any one millisecond.
+        while(times[last] - times[first] >= 1000000) first++;
+        if(last - first + 1 > peak) peak = last - first + 1;
+    }
+    printf("BENCH rate mixed target=%.0f hostrate=%.0f hosts=%u peak=%u\n", config->rate, config->hostRate,
+           (unsigned)config->targets.count, (unsigned)(peak * 1000));
+    fflush(stdout);
+    RateFree(&limiter);
+    free(times);
+
+    UINT64 calls = 0, start = NowNanos(), elapsed = 0;
+    config->rate = config->hostRate = config->netRate = 1e9;        // One probe per ns, never a wait.
+    RateInit(&limiter, config);
+    while(elapsed < (UINT64)(BENCH_SECONDS / 4 * 1e9)) {
+        for(size_t n = 0; n < 4096; n++, calls++) RateReserve(&limiter, (size_t)(calls % config->targets.count));
+        elapsed = NowNanos() - start;
+    }
+    printf("BENCH rate reserve buckets=3 calls=%llu ns_per_call=%.1f\n", (unsigned long long)calls, (double)elapsed / calls);
+    fflush(stdout);
+    RateFree(&limiter);
+    config->rate = saved[0];
+    config->hostRate = saved[1];
+    config->netRate = saved[2];
+}
+
+/*
+Function moves a probe up the deadline heap until its parent expires first.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine owning the heap.]
+    size_t          index       -       [The heap position to sift.]
+Returns nothing.
+*/
+static void EngineSiftUp(PSCAN_ENGINE engine, size_t index) {
+    PPROBE_SLOT slot = engine->heap[index];
+    while(index > 0 && engine->heap[(index - 1) / 2]->deadline > slot->deadline) {
+        engine->heap[index] = engine->heap[(index - 1) / 2];
+        engine->heap[index]->heapIndex = index;
+        index = (index - 1) / 2;
+    }
+    engine->heap[index] = slot;
+    slot->heapIndex = index;
+}
+
+/*
+Function moves a probe down the deadline heap until both children expire after it.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine owning the heap.]
+    size_t          index       -       [The heap position to sift.]
+Returns nothing.
+*/
+static void EngineSiftDown(PSCAN_ENGINE engine, size_t index) {
+    PPROBE_SLOT slot = engine->heap[index];
+    while(TRUE) {
+        size_t child = index * 2 + 1;
+        if(child >= engine->heapSize) break;
+        if(child + 1 < engine->heapSize && engine->heap[child + 1]->deadline < engine->heap[child]->deadline) child++;
+        if(engine->heap[child]->deadline >= slot->deadline) break;
+        engine->heap[index] = engine->heap[child];
+        engine->heap[index]->heapIndex = index;
+        index = child;
+    }
+    engine->heap[index] = slot;
+    slot->heapIndex = index;
+}
+
+/*
+Function looks up the round trip estimate kept for a target. The table is a
+small direct mapped cache, so a colliding target simply takes the entry over.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine owning the estimates.]
+    size_t          target      -       [The target's index in the target set.]
+Returns PRTT_ENTRY.
+*/
+static PRTT_ENTRY EngineRtt(PSCAN_ENGINE engine, size_t target) {
+    ULONG hash = (ULONG)target * 2654435761u;
+    return &engine->rtt[(hash >> 16) % RTT_TABLE_SIZE];
+}
+
+/*
+Function works out how long to wait for a probe before giving up on it, from
+the target's smoothed round trip time the way tcp computes its RTO.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine owning the estimates.]
+    size_t          target      -       [The target's index in the target set.]
+    int             attempt     -       [How many times the probe was sent before, each doubles the wait.]
+Returns UINT64, in microseconds.
+*/
+static UINT64 EngineTimeout(PSCAN_ENGINE engine, size_t target, int attempt) {
+    PRTT_ENTRY entry = EngineRtt(engine, target);
+    UINT64 timeout = engine->initialTimeoutUs;                      // No replies yet, fall back to -t.
+    if(entry->samples > 0 && entry->target == target) {
+        timeout = entry->srtt + (4 * entry->rttvar > MIN_RTTVAR_US ? 4 * entry->rttvar : MIN_RTTVAR_US);
+    }
+    if(timeout < MIN_TIMEOUT_US) timeout = MIN_TIMEOUT_US;
+    if(timeout > MAX_TIMEOUT_US) timeout = MAX_TIMEOUT_US;
+    return timeout << attempt;
+}
+
+/*
+Function feeds a measured round trip into the target's SRTT and RTTVAR (rfc 6298).
+Params:
+    PSCAN_ENGINE    engine      -       [The engine owning the estimates.]
+    size_t          target      -       [The target's index in the target set.]
+    UINT64          sample      -       [The measured round trip in microseconds.]
+Returns nothing.
+*/
+static void EngineSampleRtt(PSCAN_ENGINE engine, size_t target, UINT64 sample) {
+    PRTT_ENTRY entry = EngineRtt(engine, target);
+    if(entry->samples == 0 || entry->target != target) {
+        entry->target = target;
+        entry->srtt = sample;
+        entry->rttvar = sample / 2;
+        entry->samples = 1;
+        return;
+    }
+    UINT64 delta = entry->srtt > sample ? entry->srtt - sample : sample - entry->srtt;
+    entry->rttvar = (3 * entry->rttvar + delta) / 4;
+    entry->srtt = (7 * entry->srtt + sample) / 8;
+    entry->samples++;
+}
+
+/*
+Function removes a probe from the deadline heap and returns its slot to the free list.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine owning the probe.]
+    PPROBE_SLOT     slot        -       [The probe to release.]
+Returns nothing.
+*/
+static void EngineRelease(PSCAN_ENGINE engine, PPROBE_SLOT slot) {
+    if(slot->heapIndex != NOT_QUEUED) {
+        size_t index = slot->heapIndex;
+        engine->heapSize--;
+        if(index < engine->heapSize) {
+            engine->heap[index] = engine->heap[engine->heapSize];
+            engine->heap[index]->heapIndex = index;
+            EngineSiftUp(engine, index);
+            EngineSiftDown(engine, engine->heap[index]->heapIndex);
+        }
+        slot->heapIndex = NOT_QUEUED;
+    }
+    if(slot->s != INVALID_SOCKET) closesocket(slot->s);
+    slot->s = INVALID_SOCKET;
+    slot->next = engine->freeList;
+    engine->freeList = slot;
+    engine->inFlight--;
+}
+
+/*
+Function opens the congestion window after a probe leaves the network. Silent
+ports count too, a timeout alone says nothing about congestion and treating it
+as loss would stall scans of filtered hosts.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine to grow.]
+Returns nothing.
+*/
+static void EngineGrow(PSCAN_ENGINE engine) {
+    if(engine->cwnd < engine->ssthresh) engine->cwnd += 1;          // Slow start.
+    else engine->cwnd += 1 / engine->cwnd;                          // Congestion avoidance.
+    if(engine->cwnd > engine->window) engine->cwnd = engine->window;
+}
+
+/*
+Function reports a finished probe and adjusts the round trip estimate and
+congestion window with what it learned.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine owning the probe.]
+    PPROBE_SLOT     slot        -       [The finished probe.]
+    PortState       state       -       [What the probe found.]
+Returns nothing.
+*/
+static void EngineComplete(PSCAN_ENGINE engine, PPROBE_SLOT slot, PortState state) {
+    UINT64 now = NowMicros();
+    EngineGrow(engine);
+    if(state == PortOpen || state == PortClosed) {                  // The target answered, so the round trip is known.
+        EngineSampleRtt(engine, slot->target, now - slot->sentAt);
+        StatsRtt(engine->stats, now - slot->sentAt);
+        StatAdd(&engine->stats->replies, 1);
+        PRTT_ENTRY entry = EngineRtt(engine, slot->target);
+        if(slot->attempt > 0 && now - engine->lastBackoff > entry->srtt) {
+            engine->ssthresh = engine->cwnd / 2 > MIN_CWND ? engine->cwnd / 2 : MIN_CWND;
+            engine->cwnd = engine->ssthresh;                        // A retransmit got the answer, so the first probe was dropped.
+            engine->lastBackoff = now;
+        }
+    }
+    if(ReportPortState(engine->config, slot->target, slot->port, state) == TRUE && state == PortOpen &&
+       engine->config->bannerStage != NULL && engine->config->pt == Tcp) {   // Hand the live connection to the banner stage.
+#ifdef _WIN32
+        setsockopt(slot->s, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, NULL, 0);  // Lets plain send and recv use a ConnectEx socket.
+#else
+        epoll_ctl(engine->epfd, EPOLL_CTL_DEL, slot->s, NULL);
+#endif
+        if(BannerOffer(engine->config->bannerStage, slot->target, slot->port, slot->s) == TRUE) slot->s = INVALID_SOCKET;
+    }
+    EngineRelease(engine, slot);
+}
+
+/*
+Function handles a probe whose deadline passed. It is queued to be sent again
+until the retries run out, after which the port is reported filtered.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine owning the probe.]
+    PPROBE_SLOT     slot        -       [The expired probe.]
+Returns nothing.
+*/
+static void EngineExpire(PSCAN_ENGINE engine, PPROBE_SLOT slot) {
+    StatAdd(&engine->stats->timeouts, 1);
+    if(slot->attempt >= engine->config->retries) {
+        EngineComplete(engine, slot, engine->config->pt == Udp ? PortOpenFiltered : PortFiltered);
+        return;
+    }
+    EngineGrow(engine);
+    PRETRY retry = &engine->retries[(engine->retryHead + engine->retryCount) % engine->window];
+    retry->target = slot->target;
+    retry->port = slot->port;
+    retry->attempt = slot->attempt + 1;
+    engine->retryCount++;
+    EngineRelease(engine, slot);
+}
+
+/*
+Function classifies a socket error collected when a connect completes.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine, used for the protocol.]
+    int             err         -       [The SO_ERROR value, 0 on success.]
+Returns PortState.
+*/
+static PortState EngineClassify(PSCAN_ENGINE engine, int err) {
+    if(err == 0) return PortOpen;
+#ifdef _WIN32
+    if(err == WSAECONNREFUSED || err == WSAECONNRESET || err == ERROR_CONNECTION_REFUSED) return PortClosed;
+#else
+    if(err == ECONNREFUSED || err == ECONNRESET) return PortClosed;
+#endif
+    return engine->config->pt == Udp ? PortOpenFiltered : PortFiltered;
+}
+
+/*
+Function sets up the event loop used to keep many connects in flight at once.
+Linux uses epoll, windows uses an io completion port driven by ConnectEx.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine to initalize.]
+    PSCAN_CONFIG    config      -       [The scan settings.]
+    size_t          window      -       [How many probes this engine may keep in flight.]
+Returns BOOL.
+*/
+BOOL EngineInit(PSCAN_ENGINE engine, PSCAN_CONFIG config, size_t window) {
+    memset(engine, 0, sizeof(SCAN_ENGINE));
+    engine->config = config;
+    engine->window = window < 1 ? 1 : window;
+    if(config->timeout <= 1) engine->initialTimeoutUs = DEFAULT_TIMEOUT*1000;               // Sets the portscan timeout until replies are measured.
+    else engine->initialTimeoutUs = (UINT64)config->timeout*1000;
+    engine->cwnd = engine->window < INITIAL_CWND ? engine->window : INITIAL_CWND;
+    engine->ssthresh = engine->window;
+    engine->stats = StatsShard(config->stats);
+
+#ifdef _WIN32
+    engine->iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if(engine->iocp == NULL) return FALSE;
+
+    GUID guid = WSAID_CONNECTEX;                                                              // ConnectEx has to be looked up at runtime.
+    DWORD bytes = 0;
+    SOCKET s = WSASocketA(AF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0, WSA_FLAG_OVERLAPPED);
+    if(s == INVALID_SOCKET) return FALSE;
+    int err = WSAIoctl(s, SIO_GET_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid),
+                       &engine->connectEx, sizeof(engine->connectEx), &bytes, NULL, NULL);
+    closesocket(s);
+    if(err != 0) return FALSE;
+#else
+    engine->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(engine->epfd < 0) return FALSE;
+#endif
+
+    engine->slots = calloc(engine->window, sizeof(PROBE_SLOT));
+    engine->heap = calloc(engine->window, sizeof(PPROBE_SLOT));
+    engine->retries = calloc(engine->window, sizeof(RETRY));
+    engine->rtt = calloc(RTT_TABLE_SIZE, sizeof(RTT_ENTRY));
+    if(engine->slots == NULL || engine->heap == NULL || engine->retries == NULL || engine->rtt == NULL) return FALSE;
+    for(size_t i = 0; i < engine->window; i++) {                                              // Chain every slot onto the free list.
+        engine->slots[i].s = INVALID_SOCKET;
+        engine->slots[i].heapIndex = NOT_QUEUED;
+        engine->slots[i].next = engine->freeList;
+        engine->freeList = &engine->slots[i];
+    }
+    return TRUE;
+}
+
+/*
+Function returns how many more probes the engine may start right now, which is
+the congestion window less what is already in flight.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine to check.]
+Returns size_t.
+*/
+size_t EngineCapacity(PSCAN_ENGINE engine) {
+    size_t limit = (size_t)engine->cwnd;
+    if(limit < 1) limit = 1;
+    if(limit > engine->window) limit = engine->window;
+    return engine->inFlight < limit ? limit - engine->inFlight : 0;
+}
+
+/*
+Function starts a non-blocking connect to a single port.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine to run the probe on.]
+    size_t          target      -       [The destination's index in the target set.]
+    WORD            port        -       [The destination port.]
+    int             attempt     -       [Zero for the first probe, then the retry number.]
+Returns int, 0 when the port was consumed or 1 when the engine is out of sockets and must be drained first.
+*/
+static int EngineStart(PSCAN_ENGINE engine, size_t target, WORD port, int attempt) {
+    PPROBE_SLOT slot = engine->freeList;
+    PRATE_LIMITER limiter = engine->config->limiter;
+    if(slot == NULL) return 1;
+    if(limiter != NULL) {                                           // Hold the probe until its paced send slot.
+        if(engine->reserved == FALSE || engine->reservedTarget != target) {
+            engine->paceAt = RateReserve(limiter, target);
+            engine->reservedTarget = target;
+            engine->reserved = TRUE;
+        }
+        if(engine->paceAt > NowNanos() + RATE_SPIN_NS + 1000000) return 1;  // More than a poll tick away, EnginePoll sleeps until then.
+        RateWait(engine->paceAt);
+        engine->reserved = FALSE;
+        engine->paceAt = 0;
+    }
+
+    BOOL udp = engine->config->pt == Udp;
+    TARGET_ADDRESS server;                                          // Destination host information, in the target's own family.
+    int serverLength = TargetAddress(&engine->config->targets, target, port, AF_UNSPEC, &server);
+
+#ifdef _WIN32
+    SOCKET s = WSASocketA(server.base.sa_family, udp ? SOCK_DGRAM : SOCK_STREAM, udp ? IPPROTO_UDP : IPPROTO_TCP, NULL, 0, WSA_FLAG_OVERLAPPED);
+    if(s == INVALID_SOCKET) {
+        StatAdd(&engine->stats->errors, 1);
+        if(engine->inFlight > 0) return 1;                          // Wait for sockets to be released.
+        printf("INVALID SOCKET\n");
+        return 0;
+    }
+    if(CreateIoCompletionPort((HANDLE)s, engine->iocp, 0, 0) == NULL) {
+        closesocket(s);
+        return engine->inFlight > 0 ? 1 : 0;
+    }
+#else
+    SOCKET s = socket(server.base.sa_family, (udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, udp ? IPPROTO_UDP : IPPROTO_TCP);
+    if(s < 0) {
+        StatAdd(&engine->stats->errors, 1);
+        if(engine->inFlight > 0) return 1;                          // Wait for descriptors to be released.
+        printf("INVALID SOCKET\n");
+        return 0;
+    }
+#endif
+
+    engine->freeList = slot->next;
+    slot->s = s;
+    slot->target = target;
+    slot->port = port;
+    slot->attempt = attempt;
+    slot->sentAt = NowMicros();
+    slot->deadline = slot->sentAt + EngineTimeout(engine, target, attempt);
+    engine->inFlight++;
+    StatAdd(&engine->stats->sent, 1);
+    if(attempt > 0) StatAdd(&engine->stats->retransmits, 1);
+
+#ifdef _WIN32
+    memset(&slot->ov, 0, sizeof(OVERLAPPED));
+    slot->cancelled = FALSE;
+    if(udp == FALSE) {
+        struct linger hardClose = {1, 0};                           // Reset on close so scanned ports don't pile up in TIME_WAIT.
+        setsockopt(s, SOL_SOCKET, SO_LINGER, (char*)&hardClose, sizeof(hardClose));
+        TARGET_ADDRESS local = {0};                                 // ConnectEx requires a bound socket.
+        local.base.sa_family = server.base.sa_family;
+        bind(s, &local.base, serverLength);
+        if(engine->connectEx(s, &server.base, serverLength, NULL, 0, NULL, &slot->ov) == FALSE &&
+           WSAGetLastError() != ERROR_IO_PENDING) {
+            EngineComplete(engine, slot, EngineClassify(engine, WSAGetLastError()));
+            return 0;
+        }
+    }
+    else {
+        DWORD flags = 0;
+        connect(s, &server.base, serverLength);                     // Connected udp sockets receive icmp unreachable as WSAECONNRESET.
+        send(s, "", 0, 0);
+        slot->wsaBuf.buf = &slot->recvByte;
+        slot->wsaBuf.len = 1;
+        if(WSARecv(s, &slot->wsaBuf, 1, NULL, &flags, &slot->ov, NULL) != 0 && WSAGetLastError() != WSA_IO_PENDING) {
+            EngineComplete(engine, slot, EngineClassify(engine, WSAGetLastError()));
+            return 0;
+        }
+    }
+#else
+    if(udp == FALSE) {
+        struct linger hardClose = {1, 0};                           // Reset on close so scanned ports don't pile up in TIME_WAIT.
+        setsockopt(s, SOL_SOCKET, SO_LINGER, &hardClose, sizeof(hardClose));
+    }
+
+    int err = connect(s, &server.base, serverLength);
+    if(err != 0 && errno == EADDRNOTAVAIL && engine->inFlight > 1) {
+        StatAdd(&engine->stats->errors, 1);
+        EngineRelease(engine, slot);                                // Ran out of local ports, retry once some probes finish.
+        return 1;
+    }
+    if(err != 0 && errno != EINPROGRESS) {
+        EngineComplete(engine, slot, EngineClassify(engine, errno));
+        return 0;
+    }
+    if(err == 0 && udp == FALSE) {
+        EngineComplete(engine, slot, PortOpen);                     // Loopback connects can finish straight away.
+        return 0;
+    }
+    if(udp == TRUE) send(s, "", 0, 0);                              // Closed udp ports answer with icmp unreachable.
+
+    struct epoll_event ev = {0};
+    ev.events = udp ? EPOLLIN : EPOLLOUT;
+    ev.data.ptr = slot;
+    if(epoll_ctl(engine->epfd, EPOLL_CTL_ADD, s, &ev) != 0) {
+        EngineComplete(engine, slot, EngineClassify(engine, errno));
+        return 0;
+    }
+#endif
+    engine->heap[engine->heapSize] = slot;                          // On windows the completion arrives even if the call finished inline.
+    EngineSiftUp(engine, engine->heapSize++);
+    return 0;
+}
+
+/*
+Function starts a first probe to a single port.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine to run the probe on.]
+    size_t          target      -       [The destination's index in the target set.]
+    WORD            port        -       [The destination port.]
+Returns int, 0 when the port was consumed or 1 when the engine is out of sockets and must be drained first.
+*/
+int EngineLaunch(PSCAN_ENGINE engine, size_t target, WORD port) {
+    return EngineStart(engine, target, port, 0);
+}
+
+/*
+Function sends timed out probes again while the congestion window has room.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine holding the retries.]
+Returns nothing.
+*/
+void EngineRelaunch(PSCAN_ENGINE engine) {
+    while(engine->retryCount > 0 && EngineCapacity(engine) > 0) {
+        PRETRY retry = &engine->retries[engine->retryHead];
+        if(EngineStart(engine, retry->target, retry->port, retry->attempt) != 0) return;
+        engine->retryHead = (engine->retryHead + 1) % engine->window;
+        engine->retryCount--;
+    }
+}
+
+/*
+Function waits for connects to complete or time out and reports each one.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine to drain.]
+Returns nothing.
+*/
+void EnginePoll(PSCAN_ENGINE engine) {
+    UINT64 now = NowMicros();
+    long waitMs = -1;
+    if(engine->heapSize > 0) {
+        if(engine->heap[0]->deadline <= now) waitMs = 0;
+        else waitMs = (long)((engine->heap[0]->deadline - now + 999) / 1000);
+    }
+    if(engine->paceAt != 0) {                                       // Wake in time for a probe held back by the pacer.
+        UINT64 nowNs = NowNanos();
+        long paceMs = engine->paceAt > nowNs + RATE_SPIN_NS ? (long)((engine->paceAt - nowNs - RATE_SPIN_NS) / 1000000) : 0;
+        if(waitMs < 0 || paceMs < waitMs) waitMs = paceMs;
+    }
+
+#ifdef _WIN32
+    OVERLAPPED_ENTRY entries[ENGINE_EVENT_BATCH];
+    ULONG removed = 0;
+    if(GetQueuedCompletionStatusEx(engine->iocp, entries, ENGINE_EVENT_BATCH, &removed,
+                                   waitMs < 0 ? INFINITE : (DWORD)waitMs, FALSE)) {
+        for(ULONG i = 0; i < removed; i++) {
+            PPROBE_SLOT slot = CONTAINING_RECORD(entries[i].lpOverlapped, PROBE_SLOT, ov);
+            DWORD bytes = 0, flags = 0;
+            int err = 0;
+            if(WSAGetOverlappedResult(slot->s, &slot->ov, &bytes, FALSE, &flags) == FALSE) err = WSAGetLastError();
+            if(slot->cancelled == TRUE && err != 0 && EngineClassify(engine, err) != PortClosed) EngineExpire(engine, slot);
+            else EngineComplete(engine, slot, EngineClassify(engine, err));
+        }
+    }
+
+    now = NowMicros();
+    while(engine->heapSize > 0 && engine->heap[0]->deadline <= now) {
+        PPROBE_SLOT slot = engine->heap[0];                          // The slot stays in flight until the aborted completion is dequeued.
+        engine->heap[0] = engine->heap[--engine->heapSize];
+        engine->heap[0]->heapIndex = 0;
+        if(engine->heapSize > 0) EngineSiftDown(engine, 0);
+        slot->heapIndex = NOT_QUEUED;
+        slot->cancelled = TRUE;
+        CancelIoEx((HANDLE)slot->s, &slot->ov);
+    }
+#else
+    struct epoll_event events[ENGINE_EVENT_BATCH];
+    int count = epoll_wait(engine->epfd, events, ENGINE_EVENT_BATCH, (int)waitMs);
+    for(int i = 0; i < count; i++) {
+        PPROBE_SLOT slot = events[i].data.ptr;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(slot->s, SOL_SOCKET, SO_ERROR, &err, &len);       // The connect result is reported through SO_ERROR.
+        if(err == 0 && engine->config->pt == Udp && (events[i].events & EPOLLIN) == 0) continue;
+        EngineComplete(engine, slot, EngineClassify(engine, err));
+    }
+
+    now = NowMicros();
+    while(engine->heapSize > 0 && engine->heap[0]->deadline <= now) EngineExpire(engine, engine->heap[0]);
+#endif
+}
+
+/*
+Function releases the event loop and any probes still in flight.
+Params:
+    PSCAN_ENGINE    engine      -       [The engine to free.]
+Returns nothing.
+*/
+void EngineFree(PSCAN_ENGINE engine) {
+    if(engine->slots != NULL) {
+        for(size_t i = 0; i < engine->window; i++) {
+            if(engine->slots[i].s != INVALID_SOCKET) closesocket(engine->slots[i].s);
+        }
+        free(engine->slots);
+    }
+    free(engine->heap);
+    free(engine->retries);
+    free(engine->rtt);
+#ifdef _WIN32
+    if(engine->iocp != NULL) CloseHandle(engine->iocp);
+#else
+    if(engine->epfd > 0) close(engine->epfd);
+#endif
+    memset(engine, 0, sizeof(SCAN_ENGINE));
+}
+
+/*
+Function displays the help menu.
+Params:
+    None.
+Returns nothing.
+*/
+void ShowSyntax() {
+    printf(
+            "\n"
+            "           8  .o88b. d8888b. .d8888.  .o88b.  .d8b.  d8b   db 8\n"
+            "           8 d8P  Y8 88  `8D 88'  YP d8P  Y8 d8' `8b 888o  88 8\n"
+            "           8 8P      88oodD' `8bo.   8P      88ooo88 88V8o 88 8\n"
+            "    C8888D   8b      88~~~     `Y8b. 8b      88~~~88 88 V8o88   C8888D\n"
+            "           8 Y8b  d8 88      db   8D Y8b  d8 88   88 88  V888 8\n"
+            "           8  `Y88P' 88      `8888Y'  `Y88P' YP   YP VP   V8P 8\n\n"
+            "           Author:  [%s]\n"
+            "           Version: [%s]\n\n"
+            "___________________________________Help___________________________________\n\n"
+            "           [ -p      ]              <Scan ports within a range>\n"
+            "           [ -proto  ]              <The protocol you want to use>\n"
+            "           [ -dbg    ]              <Show debug information>\n"
+            "           [ -t      ]              <Initial timeout in ms, adapts to measured round trips>\n"
+            "           [ -retries]              <Times a silent port is probed again (default %d)>\n"
+            "           [ -c      ]              <Max connects in flight (default %u)>\n"
+            "           [ -threads]              <Scan threads (default one per core)>\n"
+            "           [ -sS     ]              <Half-open SYN scan over raw sockets (linux, root)>\n"
+            "           [ -batch  ]              <Packets per send/receive call (default %u)>\n"
+            "           [ -ring   ]              <Send and receive through PACKET_MMAP rings on an interface>\n"
+            "           [ -bench  ]              <Run a benchmark instead of a scan: pps, targets, permute, results, rate, scan, target, banners>\n"
+            "           [ -random ]              <Probe every (target, port) pair in a random order>\n"
+            "           [ -seed   ]              <Seed for the random order, shards must share it>\n"
+            "           [ -shard  ]              <Scan only shard i of n, as i/n (implies -random)>\n"
+            "           [ -iL     ]              <Read targets from a file, - for stdin>\n"
+            "           [ -exclude]              <Addresses, ranges or cidr blocks to skip, separated by commas>\n"
+            "           [ -excludefile]          <Read addresses to skip from a file>\n"
+            "           [ -dns    ]              <Dns server to resolve names with, ip[:port] (default from the system)>\n"
+            "           [ -oJ     ]              <Stream results to a file as json lines, - for stdout>\n"
+            "           [ -oC     ]              <Stream results to a file as csv, - for stdout>\n"
+            "           [ -oB     ]              <Stream results to a file in the compact binary format>\n"
+            "           [ -rate   ]              <Most probes per second in total>\n"
+            "           [ -hostrate]             <Most probes per second to any one target>\n"
+            "           [ -netrate]              <Most probes per second to any one /24, or /64 for ipv6>\n"
+            "           [ -banners]              <Read banners from open tcp ports and name the service>\n"
+            "           [ -bc     ]              <Banner connections at once (default %u)>\n"
+            "           [ -bt     ]              <Time in ms a port gets to show its banner (default %ld)>\n"
+            "           [ -journal]              <Checkpoint results and progress to a file every second>\n"
+            "           [ -progress]             <Print progress, rates, counters and round trips to stderr every second>\n"
+            "           [ -metrics]              <Serve prometheus metrics on this 127.0.0.1 port>\n"
+            "           [ -resume ]              <Continue the scan saved in a journal, given on its own>\n"
+            "           [ -h      ]              <Show this menu>\n\n"
+            "           [Examples]\n"
+            "              stackmypancakes.com -proto tcp -p 1 1024\n"
+            "              doogle.com -dbg -proto udp -p 22 65535\n"
+            "              asdf.com -t 200 -proto tcp -p 440 450\n"
+            "              friendface.com -t 50 -dbg -p 50 100 -proto tcp\n"
+            "              127.0.0.1 -c 4096 -p 1 65535\n"
+            "              127.0.0.1,127.0.0.2,127.0.0.3 -threads 4 -p 1 1024\n"
+            "              10.0.0.5 -sS -p 1 65535\n"
+            "              10.0.0.5 -sS -batch 256 -ring eth0 -p 1 65535\n"
+            "              a.example.com,b.example.com -dns 1.1.1.1 -p 1 1024\n"
+            "              10.0.0.0/8,192.168.1.1-50 -exclude 10.0.0.0/24 -p 22 22\n"
+            "              -iL targets.txt -excludefile skip.txt -p 80 80\n"
+            "              10.0.0.0/16 -shard 0/4 -seed 7 -p 1 1024\n"
+            "              10.0.0.0/16 -oJ results.jsonl -oB results.bin -p 1 1024\n"
+            "              10.0.0.5 -banners -bc 128 -bt 3000 -p 1 1024\n"
+            "              10.0.0.0/8 -sS -rate 100000 -netrate 500 -p 443 443\n"
+            "              10.0.0.0/16 -journal scan.cpj -p 1 65535\n"
+            "              -resume scan.cpj\n"
+            "              10.0.0.0/16 -progress -metrics 9464 -p 1 1024\n"
+            "              127.0.0.1 -bench scan -p 20000 24095\n"
+            "              2001:db8::/120,10.0.0.5 -sS -p 1 1024\n"
+            "__________________________________________________________________________\n\n",
+            AUTHOR, VERSION, DEFAULT_RETRIES, (unsigned)DEFAULT_CONCURRENCY, (unsigned)DEFAULT_BATCH,
+            (unsigned)DEFAULT_BANNER_CONCURRENCY, DEFAULT_BANNER_TIMEOUT
+    );
+}
+
+/*
+Function hands a worker its next chunk of (target, port) indexes.
+Workers drain their own range from the front. Once it is empty they steal the
+back half of the largest range left, so a worker stuck on a slow host gives
+its unstarted work away instead of holding up the run.
+Params:
+    PSCAN_WORKER    worker      -       [The worker asking for work.]
+    size_t          *first      -       [Receives the first index of the chunk.]
+    size_t          *last       -       [Receives one past the last index of the chunk.]
+Returns BOOL, FALSE once every range is empty.
+*/
+BOOL SchedulerTake(PSCAN_WORKER worker, size_t *first, size_t *last) {
+    PSCAN_SCHEDULER scheduler = worker->scheduler;
+
+    while(TRUE) {
+        LockAcquire(&worker->lock);
+        if(worker->next < worker->end) {
+            *first = worker->next;
+            worker->next += CHUNK_SIZE < worker->end - worker->next ? CHUNK_SIZE : worker->end - worker->next;
+            *last = worker->next;
+            LockRelease(&worker->lock);
+            return TRUE;
+        }
+        LockRelease(&worker->lock);
+
+        PSCAN_WORKER victim = NULL;                                  // Pick the busiest worker without locking, then recheck under its lock.
+        size_t most = 0;
+        for(size_t i = 0; i < scheduler->workerCount; i++) {
+            PSCAN_WORKER other = &scheduler->workers[i];
+            size_t remaining = other->end > other->next ? other->end - other->next : 0;
+            if(other != worker && remaining > most) {
+                most = remaining;
+                victim = other;
+            }
+        }
+        if(victim == NULL) return FALSE;
+
+        size_t stolenFirst = 0, stolenLast = 0;
+        LockAcquire(&victim->lock);
+        if(victim->next < victim->end) {
+            stolenFirst = victim->next + (victim->end - victim->next) / 2;
+            stolenLast = victim->end;
+            victim->end = stolenFirst;
+        }
+        LockRelease(&victim->lock);
+        if(stolenFirst == stolenLast) continue;                     // Lost the race, look again.
+
+        LockAcquire(&worker->lock);
+        worker->next = stolenFirst;
+        worker->end = stolenLast;
+        LockRelease(&worker->lock);
+    }
+}
+
+/*
+Function runs one scan thread. Each worker owns its own event loop and keeps it
+full with chunks from the scheduler until there is nothing left to probe.
+Params:
+    void    *arg        -       [The PSCAN_WORKER to run.]
+Returns THREAD_RETURN.
+*/
+THREAD_RETURN ScanWorker(void *arg) {
+    PSCAN_WORKER worker = arg;
+    PSCAN_SCHEDULER scheduler = worker->scheduler;
+    PSCAN_CONFIG config = scheduler->config;
+    PSCAN_ENGINE engine = &worker->engine;
+    size_t first = 0, last = 0, probe = 0;                          // The chunk currently being launched.
+    PROBE_CURSOR cursor = {0};
+    BOOL more = TRUE, held = FALSE;                                 // Held is set when a probe is waiting for a free socket.
+
+    while(more == TRUE || engine->inFlight > 0 || engine->retryCount > 0) {
+        EngineRelaunch(engine);                                     // Retries go ahead of new ports.
+        while(engine->retryCount == 0 && EngineCapacity(engine) > 0 &&  // Top the window back up.
+              (held == TRUE || ProbeNext(config, &cursor, last, &probe) == TRUE)) {
+            size_t target = probe / scheduler->portCount;
+            WORD port = (WORD)(config->portStart + probe % scheduler->portCount);
+            if(held == FALSE && config->resume == TRUE && ResultGet(config->results, target, port) != 0) {
+                StatAdd(&engine->stats->skipped, 1);                // Done before the restart.
+                continue;
+            }
+            held = EngineLaunch(engine, target, port) != 0;
+            if(held == TRUE) break;
+        }
+        if(held == FALSE && cursor.position >= last && more == TRUE) {
+            more = SchedulerTake(worker, &first, &last);
+            if(more == TRUE) {
+                ProbeSeek(config, &cursor, first);
+                continue;
+            }
+        }
+        if(engine->inFlight > 0 || engine->paceAt != 0) EnginePoll(engine);  // Collect completions and timeouts, or wait for the pacer.
+    }
+    return 0;
+}
+
+/*
+Function computes the ones complement checksum used by ip and tcp headers.
+Params:
+    const void  *data       -       [The bytes to sum.]
+    size_t      length      -       [How many bytes to sum.]
+    ULONG       sum         -       [A partial sum to continue from, such as the tcp pseudo header.]
+Returns WORD, in network byte order.
+*/
+WORD Checksum(const void *data, size_t length, ULONG sum) {
+    const unsigned char *bytes = data;
+    size_t i = 0;
+    for(; i + 1 < length; i += 2) sum += (ULONG)bytes[i] << 8 | bytes[i + 1];
+    if(i < length) sum += (ULONG)bytes[i] << 8;
+    while(sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return htons((WORD)~sum);
+}
+
+/*
+Function derives the initial sequence number sent to a port. Replies carry it
+back in their acknowledgement, so the receiver can tell its own probes apart
+without remembering anything about them.
+Params:
+    PSYN_SCANNER    scanner     -       [The scanner, which holds the secret.]
+    ULONG           ipAddress   -       [The probed address in network byte order.]
+    WORD            port        -       [The probed port.]
+Returns ULONG.
+*/
+ULONG SynCookie(PSYN_SCANNER scanner, ULONG ipAddress, WORD port) {
+    UINT64 x = scanner->secret ^ ((UINT64)ipAddress << 32 | (UINT64)port << 16 | scanner->sourcePort);
+    x ^= x >> 33;                                                   // Murmur3 finalizer, cheap and well mixed.
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return (ULONG)x;
+}
+
+/*
+Function derives the initial sequence number sent to a port of an ipv6
+target, folding the address down to the 32 bits SynCookie mixes.
+Params:
+    PSYN_SCANNER            scanner     -       [The scanner, which holds the secret.]
+    const unsigned char     *address    -       [The 16 address bytes in network order.]
+    WORD                    port        -       [The probed port.]
+Returns ULONG.
+*/
+ULONG SynCookie6(PSYN_SCANNER scanner, const unsigned char *address, WORD port) {
+    UINT64 high, low;
+    Address6Split(address, &high, &low);
+    UINT64 x = MixSeed(high) ^ low;
+    return SynCookie(scanner, (ULONG)(x ^ x >> 32), port);
+}
+
+#ifdef __linux__
+/*
+Function fills in the parts of a SYN that every probe shares.
+Params:
+    PSYN_SCANNER    scanner     -       [The scanner, for the source port.]
+    PSYN_PACKET     packet      -       [The template to fill.]
+Returns nothing.
+*/
+static void SynInitPacket(PSYN_SCANNER scanner, PSYN_PACKET packet) {
+    memset(packet, 0, sizeof(SYN_PACKET));
+    packet->ip.versionLength = 0x45;
+    packet->ip.totalLength = htons(sizeof(SYN_PACKET));
+    packet->ip.fragment = htons(0x4000);
+    packet->ip.ttl = 64;
+    packet->ip.protocol = IPPROTO_TCP;
+    packet->tcp.sourcePort = htons(scanner->sourcePort);
+    packet->tcp.dataOffset = (sizeof(TCP_HEADER) + sizeof(packet->options)) / 4 << 4;
+    packet->tcp.flags = 0x02;
+    packet->tcp.window = htons(1024);
+    packet->options[0] = 2;
+    packet->options[1] = 4;
+    packet->options[2] = 0x05;
+    packet->options[3] = 0xb4;
+}
+
+/*
+Function maps a PACKET_MMAP ring onto an AF_PACKET socket bound to one interface.
+Params:
+    PPACKET_RING    ring        -       [Receives the mapped ring.]
+    int             option      -       [PACKET_TX_RING or PACKET_RX_RING.]
+    int             type        -       [SOCK_RAW to write link headers, SOCK_DGRAM to read from the ip header.]
+    const char      *iface      -       [The interface name.]
+Returns BOOL.
+*/
+static BOOL PacketRingOpen(PPACKET_RING ring, int option, int type, const char *iface) {
+    struct tpacket_req request = {0};
+    struct sockaddr_ll link = {0};
+    int version = TPACKET_V2;
+
+    memset(ring, 0, sizeof(PACKET_RING));
+    ring->s = socket(AF_PACKET, type, htons(0x0800));
+    if(ring->s < 0) return FALSE;
+
+    request.tp_block_size = PACKET_RING_BLOCK;
+    request.tp_block_nr = PACKET_RING_BLOCKS;
+    request.tp_frame_size = PACKET_FRAME_SIZE;
+    request.tp_frame_nr = PACKET_RING_BLOCK / PACKET_FRAME_SIZE * PACKET_RING_BLOCKS;
+    link.sll_family = AF_PACKET;
+    link.sll_protocol = htons(0x0800);
+    link.sll_ifindex = if_nametoindex(iface);
+    if(link.sll_ifindex == 0 ||
+       setsockopt(ring->s, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0 ||
+       setsockopt(ring->s, SOL_PACKET, option, &request, sizeof(request)) != 0) {
+        close(ring->s);
+        ring->s = INVALID_SOCKET;
+        return FALSE;
+    }
+
+    ring->frameSize = request.tp_frame_size;
+    ring->frameCount = request.tp_frame_nr;
+    ring->map = mmap(NULL, (size_t)request.tp_block_size * request.tp_block_nr, PROT_READ | PROT_WRITE, MAP_SHARED, ring->s, 0);
+    if(ring->map == MAP_FAILED || bind(ring->s, (struct sockaddr*)&link, sizeof(link)) != 0) {
+        if(ring->map != MAP_FAILED) munmap(ring->map, (size_t)request.tp_block_size * request.tp_block_nr);
+        close(ring->s);
+        ring->s = INVALID_SOCKET;
+        ring->map = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+Function unmaps a PACKET_MMAP ring and closes its socket.
+Params:
+    PPACKET_RING    ring        -       [The ring to close.]
+Returns nothing.
+*/
+static void PacketRingClose(PPACKET_RING ring) {
+    if(ring->map != NULL) munmap(ring->map, ring->frameSize * ring->frameCount);
+    if(ring->s > 0) close(ring->s);
+    memset(ring, 0, sizeof(PACKET_RING));
+}
+
+/*
+Function reads the routes that leave through the ring interface, once per
+scan, so the sender never parses the routing table.
+Params:
+    PSYN_SCANNER    scanner     -       [Receives the routes.]
+    const char      *iface      -       [The interface the packets leave on.]
+Returns nothing.
+*/
+static void LoadRoutes(PSYN_SCANNER scanner, const char *iface) {
+    char line[256], name[IF_NAMESIZE + 1];
+    FILE *routes = fopen("/proc/net/route", "r");
+    if(routes == NULL) return;
+    while(fgets(line, sizeof(line), routes) != NULL) {
+        unsigned int destination, gateway, flags, mask;
+        if(sscanf(line, "%16s %x %x %x %*d %*d %*d %x", name, &destination, &gateway, &flags, &mask) != 5) continue;
+        if(strcmp(name, iface) != 0) continue;
+        PROUTE_ENTRY grown = realloc(scanner->routes, (scanner->routeCount + 1) * sizeof(ROUTE_ENTRY));
+        if(grown == NULL) break;
+        scanner->routes = grown;
+        scanner->routes[scanner->routeCount].destination = destination;
+        scanner->routes[scanner->routeCount].mask = mask;
+        scanner->routes[scanner->routeCount++].gateway = (flags & 0x2) ? gateway : 0;
+    }
+    fclose(routes);
+}
+
+/*
+Function finds the next hop towards a target in the routes LoadRoutes read,
+the gateway of the longest matching route or the target itself when it is on
+link.
+Params:
+    PSYN_SCANNER    scanner     -       [The scanner holding the routes.]
+    ULONG           target      -       [The destination in network byte order.]
+Returns ULONG, the next hop in network byte order.
+*/
+static ULONG RouteNextHop(PSYN_SCANNER scanner, ULONG target) {
+    ULONG hop = target, bestMask = 0;
+    BOOL routed = FALSE;
+    for(size_t i = 0; i < scanner->routeCount; i++) {
+        PROUTE_ENTRY route = &scanner->routes[i];
+        if((target & route->mask) != route->destination) continue;
+        if(routed == TRUE && ntohl(route->mask) < ntohl(bestMask)) continue;
+        routed = TRUE;
+        bestMask = route->mask;
+        hop = route->gateway != 0 ? route->gateway : target;
+    }
+    return hop;
+}
+
+/*
+Function looks up the hardware address of a next hop in the kernel neighbour
+table. A neighbour that is not cached yet is poked with a udp datagram so the
+kernel resolves it, and looked up again every 100 ms while attempts remain.
+Params:
+    const char      *iface      -       [The interface the packets leave on.]
+    ULONG           hop         -       [The next hop in network byte order.]
+    unsigned char   mac[6]      -       [Receives the hardware address.]
+    int             attempts    -       [Lookups to make, one returns right after the poke.]
+Returns BOOL.
+*/
+static BOOL LookupNeighbour(const char *iface, ULONG hop, unsigned char mac[6], int attempts) {
+    char line[256], hopText[INET_ADDRSTRLEN];
+    struct in_addr hopAddress;
+
+    memset(mac, 0, 6);
+    hopAddress.s_addr = hop;
+    inet_ntop(AF_INET, &hopAddress, hopText, sizeof(hopText));
+    for(int attempt = 0; attempt < attempts; attempt++) {
+        FILE *neighbours = fopen("/proc/net/arp", "r");
+        if(neighbours == NULL) return FALSE;
+        while(fgets(line, sizeof(line), neighbours) != NULL) {
+            char ip[64], hw[64], device[64];
+            unsigned int flags, bytes[6];
+            if(sscanf(line, "%63s %*s %x %63s %*s %63s", ip, &flags, hw, device) != 4) continue;
+            if(strcmp(ip, hopText) != 0 || strcmp(device, iface) != 0 || (flags & 0x2) == 0) continue;
+            if(sscanf(hw, "%x:%x:%x:%x:%x:%x", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]) != 6) continue;
+            for(int i = 0; i < 6; i++) mac[i] = (unsigned char)bytes[i];
+            fclose(neighbours);
+            return TRUE;
+        }
+        fclose(neighbours);
+
+        struct sockaddr_in discard = {0};                            // Not cached, make the kernel arp for it.
+        discard.sin_family = AF_INET;
+        discard.sin_addr.s_addr = hop;
+        discard.sin_port = htons(9);
+        SOCKET s = socket(AF_INET, SOCK_DGRAM, 0);
+        if(s >= 0) {
+            sendto(s, "", 0, 0, (struct sockaddr*)&discard, sizeof(discard));
+            close(s);
+        }
+        if(attempt + 1 < attempts) poll(NULL, 0, 100);
+    }
+    return FALSE;
+}
+
+/*
+Function finds the local address and, in ring mode, the next hop hardware
+address for a destination. In ring mode answers are cached per next hop, so
+every target behind a gateway shares one entry, and otherwise per /24, since
+only the source address is needed and routes rarely split a /24. A neighbour
+that does not resolve is remembered for a reply wait, so its probes are
+dropped without a lookup until then and the resend rounds try it again.
+Params:
+    PSYN_SCANNER    scanner     -       [The scanner holding the cache.]
+    ULONG           ipAddress   -       [The destination in network byte order.]
+    int             attempts    -       [Neighbour lookups to make on a miss, see LookupNeighbour.]
+Returns PNEXT_HOP, NULL when the next hop can't be resolved.
+*/
+static PNEXT_HOP SynNextHop(PSYN_SCANNER scanner, ULONG ipAddress, int attempts) {
+    PSCAN_CONFIG config = scanner->config;
+    ULONG key = config->ringInterface != NULL ? RouteNextHop(scanner, ipAddress) : ipAddress & htonl(0xffffff00u);
+    PNEXT_HOP hop = &scanner->hops[(ntohl(key) * 2654435761u >> 8) % NEXT_HOP_CACHE_SIZE];
+    if(hop->key == key && hop->valid == TRUE) return hop;
+    if(hop->key == key && NowMicros() < hop->expires) return NULL;  // Failed lately, don't stall the sender on it again.
+
+    struct sockaddr_in route = {0};                                  // Ask the routing table which local address reaches it.
+    socklen_t length = sizeof(route);
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    route.sin_family = AF_INET;
+    route.sin_addr.s_addr = ipAddress;
+    route.sin_port = htons(53);
+    if(s >= 0 && connect(s, (struct sockaddr*)&route, sizeof(route)) == 0) getsockname(s, (struct sockaddr*)&route, &length);
+    else route.sin_addr.s_addr = 0;
+    if(s >= 0) close(s);
+
+    hop->key = key;
+    hop->source = route.sin_addr.s_addr;
+    hop->valid = TRUE;
+    if(scanner->ringLoopback == TRUE) memset(hop->mac, 0, 6);
+    else if(config->ringInterface != NULL && LookupNeighbour(config->ringInterface, key, hop->mac, attempts) == FALSE) {
+        hop->valid = FALSE;
+        hop->expires = NowMicros() + (config->timeout <= 1 ? DEFAULT_TIMEOUT*1000 : (UINT64)config->timeout*1000);
+        return NULL;
+    }
+    return hop;
+}
+
+/*
+Function opens the sockets and buffers for a SYN scan. Packets go out in
+batches through sendmmsg, or through a PACKET_MMAP ring when -ring names an
+interface, and replies are read with recvmmsg or the matching receive ring.
+Ipv6 targets go through a raw ipv6 socket of their own, which leaves the ip
+header and checksum to the kernel. The rings only carry ipv4.
+Params:
+    PSYN_SCANNER    scanner     -       [The scanner to set up.]
+    PSCAN_CONFIG    config      -       [The resolved targets, ports and batching options.]
+Returns BOOL.
+*/
+BOOL SynSetup(PSYN_SCANNER scanner, PSCAN_CONFIG config) {
+    memset(scanner, 0, sizeof(SYN_SCANNER));
+    scanner->config = config;
+    scanner->sendSocket = scanner->recvSocket = scanner->socket6 = INVALID_SOCKET;
+    scanner->portCount = config->portEnd - config->portStart + 1;
+    scanner->batch = config->batch < 1 ? 1 : config->batch;
+    scanner->sendStats = StatsShard(config->stats);
+    scanner->replyStats = StatsShard(config->stats);
+
+    BOOL v4 = config->targets.first6 > 0, v6 = config->targets.first6 < config->targets.count;
+    int bufferSize = 8 * 1024 * 1024;                                  // Replies arrive in bursts at full send rate.
+    if(config->ringInterface != NULL && v6 == TRUE) {
+        printf("Error: Packet rings only carry ipv4, scan ipv6 targets without -ring.\n");
+        return FALSE;
+    }
+    if(config->ringInterface != NULL) {
+        if(PacketRingOpen(&scanner->txRing, PACKET_TX_RING, SOCK_RAW, config->ringInterface) == FALSE ||
+           PacketRingOpen(&scanner->rxRing, PACKET_RX_RING, SOCK_DGRAM, config->ringInterface) == FALSE) {
+            printf("Error: Unable to map packet rings on [%s]. Check the interface name and run as root.\n", config->ringInterface);
+            return FALSE;
+        }
+        struct ifreq request = {0};
+        strncpy(request.ifr_name, config->ringInterface, IF_NAMESIZE - 1);
+        if(ioctl(scanner->txRing.s, SIOCGIFHWADDR, &request) == 0) memcpy(scanner->localMac, request.ifr_hwaddr.sa_data, 6);
+        if(ioctl(scanner->txRing.s, SIOCGIFFLAGS, &request) == 0 && (request.ifr_flags & IFF_LOOPBACK)) scanner->ringLoopback = TRUE;
+        LoadRoutes(scanner, config->ringInterface);
+        if(scanner->batch > scanner->txRing.frameCount / 2) scanner->batch = scanner->txRing.frameCount / 2;
+    }
+    else if(v4 == TRUE) {
+        scanner->sendSocket = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);  // IPPROTO_RAW implies we write the ip header ourselves.
+        scanner->recvSocket = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);  // Receives a copy of every incoming tcp segment.
+        if(scanner->sendSocket < 0 || scanner->recvSocket < 0) {
+            printf("Error: SYN scans need raw sockets. Run as root or grant CAP_NET_RAW.\n");
+            return FALSE;
+        }
+        setsockopt(scanner->recvSocket, SOL_SOCKET, SO_RCVBUFFORCE, &bufferSize, sizeof(bufferSize));
+        setsockopt(scanner->sendSocket, SOL_SOCKET, SO_SNDBUFFORCE, &bufferSize, sizeof(bufferSize));
+    }
+    if(v6 == TRUE) {
+        int offset = 16;                                               // Where the tcp checksum sits, the kernel fills it in, pseudo header and all.
+        scanner->socket6 = socket(AF_INET6, SOCK_RAW, IPPROTO_TCP);
+        if(scanner->socket6 < 0 || setsockopt(scanner->socket6, IPPROTO_IPV6, IPV6_CHECKSUM, &offset, sizeof(offset)) != 0) {
+            printf("Error: SYN scans need raw sockets. Run as root or grant CAP_NET_RAW.\n");
+            return FALSE;
+        }
+        setsockopt(scanner->socket6, SOL_SOCKET, SO_RCVBUFFORCE, &bufferSize, sizeof(bufferSize));
+        setsockopt(scanner->socket6, SOL_SOCKET, SO_SNDBUFFORCE, &bufferSize, sizeof(bufferSize));
+    }
+
+    scanner->ring = calloc(scanner->batch, sizeof(SYN_PACKET));
+    scanner->messages = calloc(scanner->batch, sizeof(struct mmsghdr));
+    scanner->vectors = calloc(scanner->batch, sizeof(struct iovec));
+    scanner->destinations = calloc(scanner->batch, sizeof(struct sockaddr_in));
+    scanner->segments6 = calloc(scanner->batch, sizeof(SYN_SEGMENT));
+    scanner->messages6 = calloc(scanner->batch, sizeof(struct mmsghdr));
+    scanner->vectors6 = calloc(scanner->batch, sizeof(struct iovec));
+    scanner->destinations6 = calloc(scanner->batch, sizeof(struct sockaddr_in6));
+    scanner->hops = calloc(NEXT_HOP_CACHE_SIZE, sizeof(NEXT_HOP));
+    if(scanner->ring == NULL || scanner->messages == NULL || scanner->vectors == NULL || scanner->destinations == NULL ||
+       scanner->segments6 == NULL || scanner->messages6 == NULL || scanner->vectors6 == NULL || scanner->destinations6 == NULL ||
+       scanner->hops == NULL) return FALSE;
+
+    ULONG first = v4 == TRUE ? TargetAt(&config->targets, 0) : 0;
+    if(config->ringInterface != NULL && SynNextHop(scanner, first, 10) == NULL) {               // Fail early rather than drop every probe.
+        printf("Error: No hardware address for the next hop to [%s] on [%s].\n", inet_ntoa(*(struct in_addr*)&first), config->ringInterface);
+        return FALSE;
+    }
+
+    srand((unsigned)NowMicros());
+    scanner->secret = (UINT64)rand() << 48 ^ (UINT64)rand() << 32 ^ (UINT64)rand() << 16 ^ (UINT64)rand() ^ NowMicros();
+    scanner->sourcePort = (WORD)(40000 + rand() % 20000);            // Replies to this port are ours, the kernel answers them with RST.
+
+    for(size_t i = 0; i < scanner->batch; i++) {                     // Point each message at its packet once, sends only change contents.
+        SynInitPacket(scanner, &scanner->ring[i]);
+        scanner->vectors[i].iov_base = &scanner->ring[i];
+        scanner->vectors[i].iov_len = sizeof(SYN_PACKET);
+        scanner->destinations[i].sin_family = AF_INET;
+        scanner->messages[i].msg_hdr.msg_iov = &scanner->vectors[i];
+        scanner->messages[i].msg_hdr.msg_iovlen = 1;
+        scanner->messages[i].msg_hdr.msg_name = &scanner->destinations[i];
+        scanner->messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        memcpy(&scanner->segments6[i], &scanner->ring[i].tcp, sizeof(SYN_SEGMENT));
+        scanner->vectors6[i].iov_base = &scanner->segments6[i];
+        scanner->vectors6[i].iov_len = sizeof(SYN_SEGMENT);
+        scanner->destinations6[i].sin6_family = AF_INET6;
+        scanner->messages6[i].msg_hdr.msg_iov = &scanner->vectors6[i];
+        scanner->messages6[i].msg_hdr.msg_iovlen = 1;
+        scanner->messages6[i].msg_hdr.msg_name = &scanner->destinations6[i];
+        scanner->messages6[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+    }
+    for(size_t i = 0; i < scanner->txRing.frameCount; i++) {         // Ring frames hold an ethernet header followed by the SYN.
+        unsigned char *data = scanner->txRing.map + i * scanner->txRing.frameSize + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+        memcpy(data + 6, scanner->localMac, 6);
+        data[12] = 0x08;
+        data[13] = 0x00;
+        SynInitPacket(scanner, (PSYN_PACKET)(data + 14));
+    }
+    return TRUE;
+}
+
+/*
+Function writes the next ipv6 SYN into its send batch. Only the destination
+and the cookie change, the kernel does the rest.
+Params:
+    PSYN_SCANNER    scanner     -       [The scanner to send with.]
+    size_t          target      -       [The destination's index in the target set, an ipv6 one.]
+    WORD            port        -       [The destination port.]
+Returns nothing.
+*/
+static void SynBuildSegment6(PSYN_SCANNER scanner, size_t target, WORD port) {
+    PSYN_SEGMENT segment = &scanner->segments6[scanner->pending6];
+    unsigned char *address = (unsigned char*)&scanner->destinations6[scanner->pending6].sin6_addr;
+    TargetAt6(&scanner->config->targets, target, address);
+    segment->tcp.destinationPort = htons(port);
+    segment->tcp.sequence = htonl(SynCookie6(scanner, address, port));
+    segment->tcp.checksum = 0;
+    if(++scanner->pending6 >= scanner->batch) SynFlush(scanner);
+}
+
+/*
+Function writes the next SYN into the send batch, flushing it once it is full.
+Params:
+    PSYN_SCANNER    scanner     -       [The scanner to send with.]
+    size_t          target      -       [The destination's index in the target set.]
+    WORD            port        -       [The destination port.]
+    ULONG           id          -       [A value for the ip id field, which ipv6 has none of.]
+Returns nothing.
+*/
+void SynBuildPacket(PSYN_SCANNER scanner, size_t target, WORD port, ULONG id) {
+    if(target >= scanner->config->targets.first6) {
+        SynBuildSegment6(scanner, target, port);
+        return;
+    }
+    ULONG ipAddress = TargetAt(&scanner->config->targets, target);
+    PSYN_PACKET packet;
+    struct tpacket2_hdr *frame = NULL;
+    PNEXT_HOP hop = SynNextHop(scanner, ipAddress, 1);
+    if(hop == NULL) return;                                          // No route, the port is left for the next round.
+
+    if(scanner->txRing.map != NULL) {
+        frame = (struct tpacket2_hdr*)(scanner->txRing.map + scanner->txRing.current * scanner->txRing.frameSize);
+        while(frame->tp_status != TP_STATUS_AVAILABLE) {             // The kernel has not sent this frame yet.
+            if(scanner->pending > 0) SynFlush(scanner);
+            struct pollfd pfd = {scanner->txRing.s, POLLOUT, 0};
+            poll(&pfd, 1, 1);
+        }
+        unsigned char *data = (unsigned char*)frame + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+        memcpy(data, hop->mac, 6);
+        packet = (PSYN_PACKET)(data + 14);
+    }
+    else {
+        packet = &scanner->ring[scanner->pending];
+        scanner->destinations[scanner->pending].sin_addr.s_addr = ipAddress;
+    }
+
+    packet->ip.source = hop->source;
+    packet->ip.destination = ipAddress;
+    packet->ip.id = htons((WORD)id);
+    packet->ip.checksum = 0;
+    packet->ip.checksum = Checksum(&packet->ip, sizeof(IP_HEADER), 0);
+
+    packet->tcp.destinationPort = htons(port);
+    packet->tcp.sequence = htonl(SynCookie(scanner, ipAddress, port));
+    packet->tcp.checksum = 0;
+    ULONG pseudo = (ntohl(packet->ip.source) >> 16) + (ntohl(packet->ip.source) & 0xffff) +
+                   (ntohl(packet->ip.destination) >> 16) + (ntohl(packet->ip.destination) & 0xffff) +
+                   IPPROTO_TCP + sizeof(TCP_HEADER) + sizeof(packet->options);
+    packet->tcp.checksum = Checksum(&packet->tcp, sizeof(TCP_HEADER) + sizeof(packet->options), pseudo);
+
+    if(frame != NULL) {
+        frame->tp_len = 14 + sizeof(SYN_PACKET);
+        frame->tp_status = TP_STATUS_SEND_REQUEST;
+        scanner->txRing.current = (scanner->txRing.current + 1) % scanner->txRing.frameCount;
+    }
+    if(++scanner->pending >= scanner->batch) SynFlush(scanner);
+}
+
+/*
+Function sends one batch of messages with as few sendmmsg calls as it takes.
+Params:
+    PSYN_SCANNER        scanner     -       [The scanner, for its stats.]
+    SOCKET              s           -       [The raw socket to send on.]
+    struct mmsghdr      *messages   -       [The batch.]
+    size_t              pending     -       [How many messages are in it.]
+Returns nothing.
+*/
+static void SynSendBatch(PSYN_SCANNER scanner, SOCKET s, struct mmsghdr *messages, size_t pending) {
+    size_t sent = 0;
+    while(sent < pending) {
+        int count = sendmmsg(s, messages + sent, pending - sent, 0);
+        if(count > 0) {
+            sent += count;
+            StatAdd(&scanner->sendStats->sent, count);
+        }
+        else if(errno == ENOBUFS || errno == EAGAIN || errno == EINTR) poll(NULL, 0, 1);  // The device queue is full, give it a moment.
+        else {
+            if(scanner->config->debug == TRUE) printf("Error: Unable to send SYN [%s]\n", strerror(errno));
+            StatAdd(&scanner->sendStats->errors, 1);
+            sent++;                                                  // Skip the packet the kernel refused.
+        }
+    }
+}
+
+/*
+Function hands the pending batches of SYNs to the kernel, a single call each.
+Params:
+    PSYN_SCANNER    scanner     -       [The scanner to flush.]
+Returns nothing.
+*/
+void SynFlush(PSYN_SCANNER scanner) {
+    if(scanner->txRing.map != NULL) {
+        while(send(scanner->txRing.s, NULL, 0, MSG_DONTWAIT) < 0 && (errno == ENOBUFS || errno == EINTR)) poll(NULL, 0, 1);
+        StatAdd(&scanner->sendStats->sent, scanner->pending);
+    }
+    else if(scanner->pending > 0) SynSendBatch(scanner, scanner->sendSocket, scanner->messages, scanner->pending);
+    if(scanner->pending6 > 0) SynSendBatch(scanner, scanner->socket6, scanner->messages6, scanner->pending6);
+    scanner->pending = scanner->pending6 = 0;
+}
+
+/*
+Function checks one received tcp segment and reports the port it answers for.
+Replies whose acknowledgement does not match the cookie are ignored.
+Params:
+    PSYN_SCANNER            scanner     -       [The scanner that sent the probes.]
+    const unsigned char     *segment    -       [The segment, starting at the tcp header.]
+    size_t                  length      -       [The segment length.]
+    const unsigned char     *source     -       [The sender's address in network order, 4 or 16 bytes.]
+    int                     family      -       [AF_INET or AF_INET6.]
+Returns nothing.
+*/
+static void SynHandleSegment(PSYN_SCANNER scanner, const unsigned char *segment, size_t length, const unsigned char *source, int family) {
+    PSCAN_CONFIG config = scanner->config;
+    if(length < sizeof(TCP_HEADER)) return;
+    PTCP_HEADER tcp = (PTCP_HEADER)segment;
+    if(tcp->destinationPort != htons(scanner->sourcePort)) return;
+    BOOL synAck = (tcp->flags & 0x12) == 0x12;
+    BOOL reset = (tcp->flags & 0x04) != 0;
+    if(synAck == FALSE && reset == FALSE) return;
+
+    WORD port = ntohs(tcp->sourcePort);
+    ULONG ipAddress = 0;
+    if(family == AF_INET) memcpy(&ipAddress, source, 4);
+    if(ntohl(tcp->acknowledgement) - 1 != (family == AF_INET ? SynCookie(scanner, ipAddress, port) : SynCookie6(scanner, source, port))) return;
+    size_t target = family == AF_INET ? TargetIndex(&config->targets, ipAddress) : TargetIndex6(&config->targets, source);
+    if(ReportPortState(config, target, port, synAck ? PortOpen : PortClosed) == FALSE) return;  // The store drops retransmitted SYN-ACKs.
+    StatAdd(&scanner->replyStats->replies, 1);
+    if(synAck == TRUE && config->bannerStage != NULL) {
+        BannerOffer(config->bannerStage, target, port, INVALID_SOCKET);  // The kernel reset the half-open connection, the stage connects again.
+    }
+}
+
+/*
+Function checks one received ip packet and reports the port it answers for.
+Params:
+    PSYN_SCANNER            scanner     -       [The scanner that sent the probes.]
+    const unsigned char     *buffer     -       [The packet, starting at the ip header.]
+    size_t                  length      -       [The packet length.]
+Returns nothing.
+*/
+void SynHandleReply(PSYN_SCANNER scanner, const unsigned char *buffer, size_t length) {
+    if(length < sizeof(IP_HEADER)) return;
+    PIP_HEADER ip = (PIP_HEADER)buffer;
+    size_t ipLength = (ip->versionLength & 0x0f) * 4;
+    if(ip->protocol != IPPROTO_TCP || length < ipLength) return;
+    SynHandleSegment(scanner, buffer + ipLength, length - ipLength, (const unsigned char*)&ip->source, AF_INET);
+}
+
+/*
+Function closes the sockets and frees the buffers opened by SynSetup.
+Params:
+    PSYN_SCANNER    scanner     -       [The scanner to release.]
+Returns nothing.
+*/
+void SynTeardown(PSYN_SCANNER scanner) {
+    if(scanner->sendSocket >= 0) close(scanner->sendSocket);
+    if(scanner->recvSocket >= 0) close(scanner->recvSocket);
+    if(scanner->socket6 >= 0) close(scanner->socket6);
+    PacketRingClose(&scanner->txRing);
+    PacketRingClose(&scanner->rxRing);
+    free(scanner->hops);
+    free(scanner->routes);
+    free(scanner->ring);
+    free(scanner->messages);
+    free(scanner->vectors);
+    free(scanner->destinations);
+    free(scanner->segments6);
+    free(scanner->messages6);
+    free(scanner->vectors6);
+    free(scanner->destinations6);
+    memset(scanner, 0, sizeof(SYN_SCANNER));
+}
+
+/*
+Function sends a SYN to every (target, port) pair in batches. After a reply
+wait the pairs that are still silent get their SYN again, up to -retries
+rounds, so a single lost SYN or SYN-ACK does not make a port filtered.
+Params:
+    void    *arg        -       [The PSYN_SCANNER to send for.]
+Returns THREAD_RETURN.
+*/
+THREAD_RETURN SynSender(void *arg) {
+    PSYN_SCANNER scanner = arg;
+    PSCAN_CONFIG config = scanner->config;
+    UINT64 timeoutUs = config->timeout <= 1 ? DEFAULT_TIMEOUT*1000 : (UINT64)config->timeout*1000;
+    PJOURNAL journal = config->results->journal;
+    size_t total = (size_t)ProbeCount(config), start = total > 0 ? JournalStart(config) : 0;  // Journal progress counts every round.
+
+    for(int round = total > 0 ? (int)(start / total) : 0; round <= config->retries; round++) {
+        size_t sent = 0, probe = 0;
+        PROBE_CURSOR cursor = {0};
+
+        ProbeSeek(config, &cursor, total > 0 && (size_t)round == start / total ? start % total : 0);
+        while(ProbeNext(config, &cursor, ProbeCount(config), &probe) == TRUE) {
+            size_t target = probe / scanner->portCount;
+            WORD port = (WORD)(config->portStart + probe % scanner->portCount);
+            if((round > 0 || config->resume == TRUE) && ResultGet(config->results, target, port) != 0) {
+                if(config->resume == TRUE && (size_t)round == start / total) StatAdd(&scanner->sendStats->skipped, 1);  // Answered before the restart.
+                continue;
+            }
+            if(config->limiter != NULL) {
+                UINT64 at = RateReserve(config->limiter, target);
+                if(scanner->pending + scanner->pending6 > 0 && at > NowNanos() + RATE_SPIN_NS) SynFlush(scanner);  // Don't hold a batch back across a long wait.
+                RateWait(at);
+            }
+            SynBuildPacket(scanner, target, port, (ULONG)probe);
+            if(round > 0) {                                         // The last round's SYN went unanswered.
+                StatAdd(&scanner->sendStats->timeouts, 1);
+                StatAdd(&scanner->sendStats->retransmits, 1);
+            }
+            sent++;
+            if(journal != NULL) AtomicStore(&journal->sent, round * total + (size_t)cursor.position);
+        }
+        if(scanner->pending + scanner->pending6 > 0) SynFlush(scanner);
+        if(sent == 0) break;                                         // Every pair has answered.
+        if(round < config->retries) SleepMicros(timeoutUs);          // The receiver keeps reading meanwhile.
+    }
+
+    scanner->sendFinished = NowMicros();
+    atomic_store(&scanner->sending, FALSE);
+    return 0;
+}
+
+/*
+Function reads SYN-ACK and RST replies, a batch at a time with recvmmsg or
+straight out of the receive ring, until the timeout after the last send.
+Params:
+    void    *arg        -       [The PSYN_SCANNER to receive for.]
+Returns THREAD_RETURN.
+*/
+THREAD_RETURN SynReceiver(void *arg) {
+    PSYN_SCANNER scanner = arg;
+    PSCAN_CONFIG config = scanner->config;
+    UINT64 timeoutUs = config->timeout <= 1 ? DEFAULT_TIMEOUT*1000 : (UINT64)config->timeout*1000;
+    size_t batch = scanner->batch;
+    unsigned char *buffers = malloc(batch * PACKET_FRAME_SIZE);
+    struct mmsghdr *messages = calloc(batch, sizeof(struct mmsghdr));
+    struct iovec *vectors = calloc(batch, sizeof(struct iovec));
+    struct sockaddr_in6 *sources = calloc(batch, sizeof(struct sockaddr_in6));  // Raw ipv6 sockets leave the ip header out.
+
+    for(size_t i = 0; i < batch; i++) {
+        vectors[i].iov_base = buffers + i * PACKET_FRAME_SIZE;
+        vectors[i].iov_len = PACKET_FRAME_SIZE;
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_name = &sources[i];
+    }
+
+    while(atomic_load(&scanner->sending) == TRUE || NowMicros() < scanner->sendFinished + timeoutUs) {
+        if(scanner->rxRing.map != NULL) {
+            struct tpacket2_hdr *frame = (struct tpacket2_hdr*)(scanner->rxRing.map + scanner->rxRing.current * scanner->rxRing.frameSize);
+            if((frame->tp_status & TP_STATUS_USER) == 0) {
+                struct pollfd pfd = {scanner->rxRing.s, POLLIN, 0};
+                poll(&pfd, 1, 20);
+                continue;
+            }
+            SynHandleReply(scanner, (unsigned char*)frame + frame->tp_net, frame->tp_snaplen);
+            frame->tp_status = TP_STATUS_KERNEL;                         // Hand the frame back.
+            scanner->rxRing.current = (scanner->rxRing.current + 1) % scanner->rxRing.frameCount;
+            continue;
+        }
+
+        struct pollfd pfds[2] = {{scanner->recvSocket, POLLIN, 0}, {scanner->socket6, POLLIN, 0}};  // Poll skips a closed family's -1.
+        if(poll(pfds, 2, 20) <= 0) continue;
+        for(int f = 0; f < 2; f++) {
+            int count;
+            if((pfds[f].revents & POLLIN) == 0) continue;
+            while(TRUE) {
+                for(size_t i = 0; i < batch; i++) messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+                if((count = recvmmsg(pfds[f].fd, messages, batch, MSG_DONTWAIT, NULL)) <= 0) break;
+                for(int i = 0; i < count; i++) {
+                    if(f == 0) SynHandleReply(scanner, vectors[i].iov_base, messages[i].msg_len);
+                    else SynHandleSegment(scanner, vectors[i].iov_base, messages[i].msg_len, (unsigned char*)&sources[i].sin6_addr, AF_INET6);
+                }
+            }
+        }
+    }
+
+    free(buffers);
+    free(messages);
+    free(vectors);
+    free(sources);
+    return 0;
+}
+#endif
+
+/*
+Function runs a half-open scan. A sender thread fires raw SYN packets and a
+receiver thread matches SYN-ACK and RST replies back to them by their cookie,
+so no socket or connection is created per probe. Needs CAP_NET_RAW on linux.
+Params:
+    PSCAN_CONFIG    config      -       [The resolved targets and port range to scan.]
+Returns nothing.
+*/
+void SynScan(PSCAN_CONFIG config) {
+#ifdef __linux__
+    SYN_SCANNER scanner;
+    THREAD sender, receiver;
+
+    if(SynSetup(&scanner, config) == FALSE) {
+        SynTeardown(&scanner);
+        return;
+    }
+
+    atomic_store(&scanner.sending, TRUE);
+    if(config->debug == TRUE) {
+        printf("SYN scanning [%u] targets from source port [%hu] in batches of [%u]%s\n", (unsigned)config->targets.count,
+               scanner.sourcePort, (unsigned)scanner.batch, scanner.txRing.map != NULL ? " through packet rings" : "");
+    }
+    if(ThreadStart(&receiver, SynReceiver, &scanner) == FALSE) printf("Error: Unable to start receiver thread.\n");
+    else {
+        if(ThreadStart(&sender, SynSender, &scanner) == FALSE) {
+            printf("Error: Unable to start sender thread.\n");
+            scanner.sendFinished = NowMicros();
+            atomic_store(&scanner.sending, FALSE);
+        }
+        else ThreadJoin(sender);
+        ThreadJoin(receiver);
+    }
+
+    PROBE_CURSOR cursor = {0};                                      // Anything that never answered was dropped on the way.
+    size_t bit = 0;
+    ProbeSeek(config, &cursor, 0);                                  // Only the pairs this shard sent.
+    while(ProbeNext(config, &cursor, ProbeCount(config), &bit) == TRUE) {
+        WORD port = (WORD)(config->portStart + bit % scanner.portCount);
+        if(ResultGet(config->results, bit / scanner.portCount, port) != 0) continue;
+        StatAdd(&scanner.sendStats->timeouts, 1);
+        ReportPortState(config, bit / scanner.portCount, port, PortFiltered);  // Printed only under -dbg, like the connect engine's.
+    }
+    SynTeardown(&scanner);
+#else
+    printf("Error: SYN scans need linux raw sockets, windows does not allow raw tcp.\n");
+#endif
+}
+
+/*
+Function measures how many SYN packets per second the send path reaches for
+several batch sizes, and through the packet ring when -ring is given. Point it
+at the far end of a veth pair so nothing real receives the flood.
+Params:
+    PSCAN_CONFIG    config      -       [The target and port range to send to.]
+Returns nothing.
+*/
+void SynBenchmark(PSCAN_CONFIG config) {
+#ifdef __linux__
+    const size_t batches[] = {1, 16, 64, 256, 1024};
+    char *ringInterface = config->ringInterface;
+    size_t configuredBatch = config->batch;
+
+    for(int ring = 0; ring < (ringInterface != NULL ? 2 : 1); ring++) {
+        config->ringInterface = ring == 1 ? ringInterface : NULL;
+        for(size_t i = 0; i < sizeof(batches) / sizeof(batches[0]); i++) {
+            SYN_SCANNER scanner;
+            config->batch = batches[i];
+            if(SynSetup(&scanner, config) == FALSE) {
+                SynTeardown(&scanner);
+                config->ringInterface = ringInterface;
+                config->batch = configuredBatch;
+                return;
+            }
+
+            UINT64 packets = 0;
+            UINT64 start = NowMicros(), elapsed = 0;
+            while(elapsed < (UINT64)(BENCH_SECONDS * 1000000)) {
+                for(size_t n = 0; n < 4096; n++, packets++) {
+                    SynBuildPacket(&scanner, (size_t)(packets % config->targets.count),
+                                   (WORD)(config->portStart + packets % scanner.portCount), (ULONG)packets);
+                }
+                elapsed = NowMicros() - start;
+            }
+            if(scanner.pending + scanner.pending6 > 0) SynFlush(&scanner);
+            elapsed = NowMicros() - start;
+
+            printf("BENCH pps mode=%s batch=%u packets=%llu seconds=%.3f pps=%.0f\n", ring == 1 ? "ring" : "sendmmsg",
+                   (unsigned)scanner.batch, (unsigned long long)packets, elapsed / 1e6, packets * 1e6 / elapsed);
+            fflush(stdout);
+            SynTeardown(&scanner);
+        }
+    }
+    config->ringInterface = ringInterface;
+    config->batch = configuredBatch;
+#else
+    printf("Error: The packet benchmark needs linux raw sockets.\n");
+#endif
+}
+
+/*
+Function pauses the calling thread.
+Params:
+    UINT64  micros      -       [How long to sleep in microseconds.]
+Returns nothing.
+*/
+void SleepMicros(UINT64 micros) {
+#ifdef _WIN32
+    Sleep((DWORD)((micros + 999) / 1000));
+#else
+    struct timespec ts;
+    ts.tv_sec = micros / 1000000;
+    ts.tv_nsec = (micros % 1000000) * 1000;
+    while(nanosleep(&ts, &ts) != 0 && errno == EINTR);
+#endif
+}
+
+#ifdef __linux__
+/*
+Function records what a udp port turned out to be, reporting it the first time.
+Params:
+    PUDP_SCANNER        scanner     -       [The scanner that sent the probes.]
+    PTARGET_ADDRESS     address     -       [The probed address and port, as the socket reported it.]
+    PortState           state       -       [PortOpen, PortClosed or PortFiltered.]
+Returns nothing.
+*/
+static void UdpRecord(PUDP_SCANNER scanner, PTARGET_ADDRESS address, PortState state) {
+    WORD port = ntohs(address->base.sa_family == AF_INET6 ? address->v6.sin6_port : address->v4.sin_port);
+    if(ReportPortState(scanner->config, TargetFind(&scanner->config->targets, &address->base), port, state) == FALSE) return;  // Already classified, a retransmit was answered twice.
+    atomic_fetch_add_explicit(&scanner->answers, 1, memory_order_relaxed);
+    StatAdd(&scanner->replyStats->replies, 1);
+}
+
+/*
+Function hands the pending batch of udp probes to the kernel.
+Params:
+    PUDP_SCANNER    scanner     -       [The scanner to flush.]
+Returns nothing.
+*/
+static void UdpFlush(PUDP_SCANNER scanner) {
+    size_t sent = 0;
+    while(sent < scanner->pending) {
+        int count = sendmmsg(scanner->s, scanner->messages + sent, scanner->pending - sent, 0);
+        if(count > 0) {
+            sent += count;
+            StatAdd(&scanner->sendStats->sent, count);
+            if(scanner->round > 0) StatAdd(&scanner->sendStats->retransmits, count);
+        }
+        else if(errno == ENOBUFS || errno == EAGAIN || errno == EINTR) poll(NULL, 0, 1);
+        else if(errno == ECONNREFUSED || errno == EHOSTUNREACH || errno == ENETUNREACH || errno == EHOSTDOWN) continue;  // A queued icmp error, read from the error queue.
+        else {
+            if(scanner->config->debug == TRUE) printf("Error: Unable to send udp probe [%s]\n", strerror(errno));
+            StatAdd(&scanner->sendStats->errors, 1);
+            sent++;
+        }
+    }
+    scanner->pending = 0;
+}
+
+/*
+Function sends a probe to every udp port that has not answered yet, in rounds.
+Each round waits twice as long as the last for stragglers, and when a round
+recovers answers the previous one lost, the send rate is halved so icmp rate
+limits and small buffers stop eating replies.
+Params:
+    void    *arg        -       [The PUDP_SCANNER to send for.]
+Returns THREAD_RETURN.
+*/
+THREAD_RETURN UdpSender(void *arg) {
+    PUDP_SCANNER scanner = arg;
+    PSCAN_CONFIG config = scanner->config;
+    UINT64 timeoutUs = config->timeout <= 1 ? DEFAULT_TIMEOUT*1000 : (UINT64)config->timeout*1000;
+    UINT64 gapUs = 0;                                                // Pause per packet, zero sends flat out.
+    PJOURNAL journal = config->results->journal;
+    size_t total = (size_t)ProbeCount(config), start = total > 0 ? JournalStart(config) : 0;  // Journal progress counts every round.
+
+    for(int round = total > 0 ? (int)(start / total) : 0; round <= UDP_RETRIES; round++) {
+        unsigned long long answersBefore = atomic_load(&scanner->answers);
+        size_t sent = 0, index = 0;
+        PROBE_CURSOR cursor = {0};
+
+        scanner->round = round;
+        ProbeSeek(config, &cursor, total > 0 && (size_t)round == start / total ? start % total : 0);
+        while(ProbeNext(config, &cursor, ProbeCount(config), &index) == TRUE) {
+            WORD port = (WORD)(config->portStart + index % scanner->portCount);
+            if(ResultGet(config->results, index / scanner->portCount, port) != 0) {
+                if(config->resume == TRUE && (size_t)round == start / total) StatAdd(&scanner->sendStats->skipped, 1);  // Answered before the restart.
+                continue;
+            }
+            unsigned char payload = scanner->payloadIndex[port];
+            size_t target = index / scanner->portCount;
+            if(config->limiter != NULL) {
+                UINT64 at = RateReserve(config->limiter, target);
+                if(scanner->pending > 0 && at > NowNanos() + RATE_SPIN_NS) UdpFlush(scanner);  // Don't hold a batch back across a long wait.
+                RateWait(at);
+            }
+
+            scanner->messages[scanner->pending].msg_hdr.msg_namelen =
+                TargetAddress(&config->targets, target, port, scanner->family, &scanner->destinations[scanner->pending]);
+            scanner->vectors[scanner->pending].iov_base = payload ? (void*)UDP_PAYLOADS[payload - 1].data : NULL;
+            scanner->vectors[scanner->pending].iov_len = payload ? UDP_PAYLOADS[payload - 1].length : 0;
+            sent++;
+            if(journal != NULL) AtomicStore(&journal->sent, round * total + (size_t)cursor.position);
+            if(++scanner->pending >= scanner->batch) {
+                UdpFlush(scanner);
+                if(gapUs > 0) SleepMicros(gapUs * scanner->batch);
+            }
+        }
+        if(scanner->pending > 0) UdpFlush(scanner);
+        if(sent == 0) break;                                         // Every port has been classified.
+
+        SleepMicros(timeoutUs << round);
+        unsigned long long recovered = atomic_load(&scanner->answers) - answersBefore;
+        StatAdd(&scanner->sendStats->timeouts, sent > recovered ? sent - recovered : 0);  // Probes this round that went unanswered.
+        if(round > 0 && recovered > 0) {                             // Retransmits were answered, so the last round lost replies.
+            gapUs = gapUs == 0 ? 50 : gapUs * 2;
+            if(config->debug == TRUE) printf("Retransmits recovered [%llu] ports, slowing to [%llu] us per probe\n", recovered, (unsigned long long)gapUs);
+        }
+    }
+
+    atomic_store(&scanner->sending, FALSE);
+    return 0;
+}
+
+/*
+Function reads udp replies and the icmp errors queued on the shared socket.
+A reply means the port is open. An icmp port unreachable, which IP_RECVERR
+delivers with the original destination attached, means it is closed, and any
+other unreachable code means it is filtered. A dual stack socket reports both
+icmp and icmpv6 errors through IPV6_RECVERR.
+Params:
+    void    *arg        -       [The PUDP_SCANNER to listen for.]
+Returns THREAD_RETURN.
+*/
+THREAD_RETURN UdpListener(void *arg) {
+    PUDP_SCANNER scanner = arg;
+    size_t batch = scanner->batch;
+    unsigned char *buffers = malloc(batch * PACKET_FRAME_SIZE);
+    struct mmsghdr *messages = calloc(batch, sizeof(struct mmsghdr));
+    struct iovec *vectors = calloc(batch, sizeof(struct iovec));
+    PTARGET_ADDRESS sources = calloc(batch, sizeof(TARGET_ADDRESS));
+
+    for(size_t i = 0; i < batch; i++) {
+        vectors[i].iov_base = buffers + i * PACKET_FRAME_SIZE;
+        vectors[i].iov_len = PACKET_FRAME_SIZE;
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_name = &sources[i];
+    }
+
+    while(atomic_load(&scanner->sending) == TRUE) {
+        struct pollfd pfd = {scanner->s, POLLIN, 0};
+        if(poll(&pfd, 1, 20) <= 0) continue;
+
+        while(TRUE) {                                                // Drain the icmp errors first.
+            TARGET_ADDRESS destination;
+            char control[512], data[64];
+            struct iovec vector = {data, sizeof(data)};
+            struct msghdr message = {0};
+            message.msg_name = &destination;
+            message.msg_namelen = sizeof(destination);
+            message.msg_iov = &vector;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            if(recvmsg(scanner->s, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+
+            for(struct cmsghdr *c = CMSG_FIRSTHDR(&message); c != NULL; c = CMSG_NXTHDR(&message, c)) {
+                if((c->cmsg_level != IPPROTO_IP || c->cmsg_type != IP_RECVERR) && (c->cmsg_level != IPPROTO_IPV6 || c->cmsg_type != IPV6_RECVERR)) continue;
+                struct sock_extended_err *error = (struct sock_extended_err*)CMSG_DATA(c);
+                if(error->ee_origin == SO_EE_ORIGIN_ICMP && error->ee_type == 3) {
+                    UdpRecord(scanner, &destination, error->ee_code == 3 ? PortClosed : PortFiltered);
+                }
+                else if(error->ee_origin == SO_EE_ORIGIN_ICMP6 && error->ee_type == 1) {  // Destination unreachable, code 4 is the port.
+                    UdpRecord(scanner, &destination, error->ee_code == 4 ? PortClosed : PortFiltered);
+                }
+            }
+        }
+
+        for(size_t i = 0; i < batch; i++) messages[i].msg_hdr.msg_namelen = sizeof(TARGET_ADDRESS);
+        int count = recvmmsg(scanner->s, messages, batch, MSG_DONTWAIT, NULL);
+        for(int i = 0; i < count; i++) UdpRecord(scanner, &sources[i], PortOpen);
+    }
+
+    free(buffers);
+    free(messages);
+    free(vectors);
+    free(sources);
+    return 0;
+}
+#endif
+
+/*
+Function runs a udp scan from one shared socket. Probes carry a payload the
+service on that port is likely to answer, go out in batches, and ports that
+never answer are retried before being reported open|filtered. With ipv6
+targets the socket is dual stack and ipv4 targets go out as mapped addresses.
+Params:
+    PSCAN_CONFIG    config      -       [The resolved targets and port range to scan.]
+Returns nothing.
+*/
+void UdpScan(PSCAN_CONFIG config) {
+#ifdef __linux__
+    UDP_SCANNER scanner = {0};
+    THREAD sender, listener;
+    int enable = 1, bufferSize = 8 * 1024 * 1024;
+
+    scanner.config = config;
+    scanner.portCount = config->portEnd - config->portStart + 1;
+    scanner.batch = config->batch < 1 ? 1 : config->batch;
+    scanner.sendStats = StatsShard(config->stats);
+    scanner.replyStats = StatsShard(config->stats);
+    scanner.family = config->targets.first6 < config->targets.count ? AF_INET6 : AF_INET;
+    scanner.s = socket(scanner.family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    if(scanner.s < 0) {
+        printf("INVALID SOCKET\n");
+        return;
+    }
+    setsockopt(scanner.s, IPPROTO_IP, IP_RECVERR, &enable, sizeof(enable));  // Queue icmp errors with the datagram they answer.
+    if(scanner.family == AF_INET6) {
+        int disable = 0;
+        setsockopt(scanner.s, IPPROTO_IPV6, IPV6_V6ONLY, &disable, sizeof(disable));
+        setsockopt(scanner.s, IPPROTO_IPV6, IPV6_RECVERR, &enable, sizeof(enable));
+    }
+    setsockopt(scanner.s, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    setsockopt(scanner.s, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+
+    scanner.payloadIndex = calloc(65536, 1);
+    scanner.messages = calloc(scanner.batch, sizeof(struct mmsghdr));
+    scanner.vectors = calloc(scanner.batch, sizeof(struct iovec));
+    scanner.destinations = calloc(scanner.batch, sizeof(TARGET_ADDRESS));
+    for(size_t i = 0; i < sizeof(UDP_PAYLOADS) / sizeof(UDP_PAYLOADS[0]); i++) scanner.payloadIndex[UDP_PAYLOADS[i].port] = (unsigned char)(i + 1);
+    for(size_t i = 0; i < scanner.batch; i++) {                     // Sends fill in each destination and its length.
+        scanner.messages[i].msg_hdr.msg_iov = &scanner.vectors[i];
+        scanner.messages[i].msg_hdr.msg_iovlen = 1;
+        scanner.messages[i].msg_hdr.msg_name = &scanner.destinations[i];
+    }
+
+    atomic_store(&scanner.sending, TRUE);
+    if(config->debug == TRUE) printf("UDP scanning [%u] targets in batches of [%u]\n", (unsigned)config->targets.count, (unsigned)scanner.batch);
+    if(ThreadStart(&listener, UdpListener, &scanner) == FALSE) printf("Error: Unable to start listener thread.\n");
+    else {
+        if(ThreadStart(&sender, UdpSender, &scanner) == FALSE) {
+            printf("Error: Unable to start sender thread.\n");
+            atomic_store(&scanner.sending, FALSE);
+        }
+        else ThreadJoin(sender);
+        ThreadJoin(listener);
+
+        PROBE_CURSOR cursor = {0};                                  // Only the pairs this shard sent.
+        size_t index = 0;
+        ProbeSeek(config, &cursor, 0);
+        while(ProbeNext(config, &cursor, ProbeCount(config), &index) == TRUE) {
+            WORD port = (WORD)(config->portStart + index % scanner.portCount);
+            if(ResultGet(config->results, index / scanner.portCount, port) != 0) continue;
+            ReportPortState(config, index / scanner.portCount, port, PortOpenFiltered);
+        }
+    }
+
+    close(scanner.s);
+    free(scanner.payloadIndex);
+    free(scanner.messages);
+    free(scanner.vectors);
+    free(scanner.destinations);
+#endif
+}
+
+/*
+Function starts the banner stage. Its thread takes open tcp ports off a
+bounded queue and holds up to -bc connections of its own. Each one reads
+what the service says first, or sends it a hello when it stays silent, and
+the reply is named from the signature table.
+Params:
+    PBANNER_STAGE   stage       -       [The stage to set up.]
+    PSCAN_CONFIG    config      -       [The banner concurrency and timeout, and the result store.]
+Returns BOOL.
+*/
+BOOL BannerInit(PBANNER_STAGE stage, PSCAN_CONFIG config) {
+    size_t signatures = sizeof(BANNER_SIGNATURES) / sizeof(BANNER_SIGNATURES[0]);
+
+    memset(stage, 0, sizeof(BANNER_STAGE));
+    stage->config = config;
+    stage->window = config->bannerConcurrency;
+    stage->timeoutUs = (UINT64)config->bannerTimeout * 1000;
+    stage->jobs = calloc(BANNER_QUEUE_SIZE, sizeof(BANNER_JOB));
+    stage->connections = calloc(stage->window, sizeof(BANNER_CONNECTION));
+    stage->polls = calloc(stage->window, sizeof(struct pollfd));
+    stage->chain = malloc(signatures * sizeof(short));
+    stage->probeIndex = calloc(65536, 1);
+    if(stage->jobs == NULL || stage->connections == NULL || stage->polls == NULL || stage->chain == NULL || stage->probeIndex == NULL) {
+        printf("Error: Unable to allocate the banner stage.\n");
+        BannerClose(stage);
+        return FALSE;
+    }
+
+    for(size_t i = 0; i < BANNER_QUEUE_SIZE; i++) stage->jobs[i].sequence = i;
+    for(int i = 0; i < 256; i++) stage->first[i] = -1;
+    for(size_t i = signatures; i-- > 0;) {                          // Walk backwards so every chain keeps the table order.
+        unsigned char lead = (unsigned char)BANNER_SIGNATURES[i].prefix[0];
+        stage->chain[i] = stage->first[lead];
+        stage->first[lead] = (short)i;
+    }
+    for(size_t i = 1; i < sizeof(BANNER_PROBES) / sizeof(BANNER_PROBES[0]); i++) stage->probeIndex[BANNER_PROBES[i].port] = (unsigned char)i;
+
+    if(ThreadStart(&stage->thread, BannerWorker, stage) == FALSE) {
+        printf("Error: Unable to start the banner thread.\n");
+        BannerClose(stage);
+        return FALSE;
+    }
+    stage->running = TRUE;
+    return TRUE;
+}
+
+/*
+Function hands an open port to the banner stage. It never waits: when the
+queue is full the port is counted and skipped.
+Params:
+    PBANNER_STAGE   stage       -       [The stage to hand the port to.]
+    size_t          target      -       [The host's index in the target set.]
+    WORD            port        -       [The open port.]
+    SOCKET          s           -       [The connection discovery made, or INVALID_SOCKET for the stage to connect.]
+Returns BOOL, TRUE when the stage took the port and the socket with it.
+*/
+BOOL BannerOffer(PBANNER_STAGE stage, size_t target, WORD port, SOCKET s) {
+    size_t position = 0;
+    PBANNER_JOB job = RingClaim(&stage->tail, stage->jobs, sizeof(BANNER_JOB), BANNER_QUEUE_SIZE, &position);
+    if(job == NULL) {
+        AtomicAdd(&stage->dropped, 1);
+        return FALSE;
+    }
+    job->s = s;
+    job->target = target;
+    job->port = port;
+    AtomicStore(&job->sequence, position + 1);
+    return TRUE;
+}
+
+/*
+Function finds text inside a reply that need not be nul terminated.
+Params:
+    const unsigned char     *data       -       [The reply.]
+    size_t                  length      -       [The reply length.]
+    const char              *text       -       [The text to look for.]
+Returns const unsigned char *, NULL when the text is missing.
+*/
+static const unsigned char *BannerFind(const unsigned char *data, size_t length, const char *text) {
+    size_t size = strlen(text);
+    for(size_t i = 0; i + size <= length; i++) {
+        if(memcmp(data + i, text, size) == 0) return data + i;
+    }
+    return NULL;
+}
+
+/*
+Function names the service behind a reply and turns the reply into printable
+text. Only the signatures filed under the reply's first byte are tried.
+Params:
+    PBANNER_STAGE           stage       -       [The stage holding the signature index.]
+    const unsigned char     *reply      -       [What the service sent.]
+    size_t                  length      -       [The reply length.]
+    char                    *text       -       [Receives BANNER_TEXT_SIZE bytes at most of banner text.]
+    BOOL                    *complete   -       [Set when a signature matched and its line has fully arrived, or a binary reply has shown all it will.]
+Returns const char *, the service name or "unknown".
+*/
+static const char *BannerMatch(PBANNER_STAGE stage, const unsigned char *reply, size_t length, char *text, BOOL *complete) {
+    PBANNER_SIGNATURE found = NULL;
+    *complete = FALSE;
+    text[0] = 0;
+    if(length == 0) return "unknown";
+
+    for(short i = stage->first[reply[0]]; i >= 0; i = stage->chain[i]) {
+        PBANNER_SIGNATURE signature = (PBANNER_SIGNATURE)&BANNER_SIGNATURES[i];
+        if(length < signature->prefixLength || memcmp(reply, signature->prefix, signature->prefixLength) != 0) continue;
+        if(signature->contains != NULL && BannerFind(reply, length, signature->contains) == NULL) continue;
+        found = signature;
+        break;
+    }
+
+    if((found != NULL && found->binary == TRUE) || (found == NULL && (reply[0] < 0x20 || reply[0] > 0x7e))) {
+        for(size_t i = 0; i < length && i < BANNER_HEX_BYTES; i++) sprintf(text + i * 2, "%02x", reply[i]);  // Binary replies show their first bytes.
+        *complete = found != NULL || length >= BANNER_HEX_BYTES;    // More bytes would not change the banner.
+    }
+    else {
+        const unsigned char *start = reply, *end = reply + length, *line;
+        size_t size = 0;
+        if(found != NULL && found->field != NULL) {
+            start = BannerFind(reply, length, found->field) + strlen(found->field);
+            while(start < end && *start == ' ') start++;
+        }
+        if(start < end && (line = memchr(start, '\n', (size_t)(end - start))) != NULL) {
+            end = line;
+            *complete = found != NULL;
+        }
+        while(end > start && (end[-1] == '\r' || end[-1] == ' ')) end--;
+        for(; start < end && size < BANNER_TEXT_SIZE - 1; start++) text[size++] = *start >= 0x20 && *start <= 0x7e ? (char)*start : '.';
+        text[size] = 0;
+    }
+    return found != NULL ? found->service : "unknown";
+}
+
+/*
+Function takes on a port from the queue, adopting the discovery connection or
+starting a new one.
+Params:
+    PBANNER_STAGE   stage       -       [The stage with a free connection slot.]
+    PBANNER_JOB     job         -       [The open port.]
+Returns nothing.
+*/
+static void BannerStart(PBANNER_STAGE stage, PBANNER_JOB job) {
+    PBANNER_CONNECTION connection = &stage->connections[stage->active];
+    UINT64 now = NowMicros();
+    SOCKET s = job->s;
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+#endif
+
+    connection->target = job->target;
+    connection->port = job->port;
+    connection->length = 0;
+    connection->expires = now + stage->timeoutUs;
+    connection->phase = BannerListening;
+    if(s == INVALID_SOCKET) {                                       // Raw SYN scans leave no connection behind.
+        TARGET_ADDRESS server;
+        struct linger hardClose = {1, 0};
+        int err, length = TargetAddress(&stage->config->targets, job->target, job->port, AF_UNSPEC, &server);
+#ifdef _WIN32
+        s = socket(server.base.sa_family, SOCK_STREAM, IPPROTO_TCP);
+        if(s == INVALID_SOCKET) return;
+        ioctlsocket(s, FIONBIO, &nonBlocking);
+        setsockopt(s, SOL_SOCKET, SO_LINGER, (char*)&hardClose, sizeof(hardClose));
+        err = connect(s, &server.base, length) == 0 ? 0 : WSAGetLastError();
+        if(err == WSAEWOULDBLOCK) connection->phase = BannerConnecting;
+#else
+        s = socket(server.base.sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+        if(s < 0) return;
+        setsockopt(s, SOL_SOCKET, SO_LINGER, &hardClose, sizeof(hardClose));
+        err = connect(s, &server.base, length) == 0 ? 0 : errno;
+        if(err == EINPROGRESS) connection->phase = BannerConnecting;
+#endif
+        else if(err != 0) {
+            closesocket(s);
+            return;
+        }
+    }
+#ifdef _WIN32
+    else ioctlsocket(s, FIONBIO, &nonBlocking);                     // ConnectEx sockets start out blocking.
+#endif
+
+    connection->s = s;
+    connection->deadline = connection->phase == BannerConnecting ? connection->expires : now + stage->timeoutUs / 4;
+    stage->active++;
+}
+
+/*
+Function moves a banner connection along after poll reported on it or its
+deadline passed. Services get a quarter of the budget to speak first, then
+get the hello for their port and the rest of the budget to answer it.
+Params:
+    PBANNER_STAGE           stage       -       [The stage owning the connection.]
+    PBANNER_CONNECTION      connection  -       [The connection.]
+    short                   events      -       [What poll reported, zero for none.]
+    UINT64                  now         -       [The current time.]
+Returns BOOL, TRUE once the connection is done.
+*/
+static BOOL BannerStep(PBANNER_STAGE stage, PBANNER_CONNECTION connection, short events, UINT64 now) {
+    if(connection->phase == BannerConnecting) {
+        int err = 0;
+        socklen_t length = sizeof(err);
+        if(events == 0) return connection->deadline <= now;
+        getsockopt(connection->s, SOL_SOCKET, SO_ERROR, (char*)&err, &length);
+        if(err != 0) return TRUE;
+        connection->phase = BannerListening;
+        connection->deadline = now + stage->timeoutUs / 4;
+        return FALSE;
+    }
+
+    if(events != 0) {
+        char text[BANNER_TEXT_SIZE];
+        BOOL complete = FALSE;
+        int received = recv(connection->s, (char*)connection->buffer + connection->length, (int)(BANNER_BUFFER_SIZE - connection->length), 0);
+        if(received <= 0) return TRUE;                              // Closed, reset, or nothing to wait for.
+        connection->length += received;
+        BannerMatch(stage, connection->buffer, connection->length, text, &complete);
+        if(complete == TRUE || connection->length == BANNER_BUFFER_SIZE) return TRUE;
+        if(connection->phase == BannerListening && memchr(connection->buffer, '\n', connection->length) != NULL) return TRUE;  // A whole greeting line.
+        connection->deadline = connection->expires;                 // Part of a reply, wait for the rest.
+        return FALSE;
+    }
+
+    if(connection->deadline > now) return FALSE;
+    if(connection->phase == BannerListening && connection->length == 0 && now < connection->expires) {  // Silent, say hello.
+        PBANNER_PROBE probe = (PBANNER_PROBE)&BANNER_PROBES[stage->probeIndex[connection->port]];
+        if(send(connection->s, probe->data, (int)probe->length, 0) <= 0) return TRUE;
+        connection->phase = BannerProbing;
+        connection->deadline = connection->expires;
+        return FALSE;
+    }
+    return TRUE;                                                    // Out of time, whatever arrived is the banner.
+}
+
+/*
+Function reports what a finished connection read and frees its slot.
+Params:
+    PBANNER_STAGE   stage       -       [The stage owning the connection.]
+    size_t          index       -       [The connection's slot.]
+Returns nothing.
+*/
+static void BannerFinish(PBANNER_STAGE stage, size_t index) {
+    PBANNER_CONNECTION connection = &stage->connections[index];
+    if(connection->length > 0) {
+        char text[BANNER_TEXT_SIZE];
+        BOOL complete = FALSE;
+        const char *service = BannerMatch(stage, connection->buffer, connection->length, text, &complete);
+        char *banner = malloc(strlen(text) + 1);
+        if(banner != NULL) {
+            strcpy(banner, text);
+            ResultBanner(stage->config->results, connection->target, connection->port, service, banner);
+            stage->grabbed++;
+        }
+    }
+    closesocket(connection->s);
+    if(index != --stage->active) *connection = stage->connections[stage->active];  // Keep the live connections packed.
+}
+
+/*
+Function waits on every banner connection at once and steps the ones that
+are ready or out of time.
+Params:
+    PBANNER_STAGE   stage       -       [The stage to drive.]
+Returns nothing.
+*/
+static void BannerPoll(PBANNER_STAGE stage) {
+    UINT64 now = NowMicros(), next = now + 10000;                   // Wake up for newly queued ports too.
+    for(size_t i = 0; i < stage->active; i++) {
+        stage->polls[i].fd = stage->connections[i].s;
+        stage->polls[i].events = stage->connections[i].phase == BannerConnecting ? POLLOUT : POLLIN;
+        stage->polls[i].revents = 0;
+        if(stage->connections[i].deadline < next) next = stage->connections[i].deadline;
+    }
+#ifdef _WIN32
+    WSAPoll(stage->polls, (ULONG)stage->active, next > now ? (int)((next - now + 999) / 1000) : 0);
+#else
+    poll(stage->polls, stage->active, next > now ? (int)((next - now + 999) / 1000) : 0);
+#endif
+
+    now = NowMicros();
+    for(size_t i = stage->active; i-- > 0;) {                       // Backwards, so a slot filled from the end was already stepped.
+        if(BannerStep(stage, &stage->connections[i], stage->polls[i].revents, now) == TRUE) BannerFinish(stage, i);
+    }
+}
+
+/*
+Function runs the banner stage until it is closed and every queued port has
+been seen to.
+Params:
+    void    *arg        -       [The PBANNER_STAGE to run.]
+Returns THREAD_RETURN.
+*/
+THREAD_RETURN BannerWorker(void *arg) {
+    PBANNER_STAGE stage = arg;
+    while(TRUE) {
+        size_t closing = AtomicLoad(&stage->closing);               // Read first, so nothing queued before the close is missed.
+        PBANNER_JOB job;
+        while(stage->active < stage->window && (job = RingTake(stage->jobs, sizeof(BANNER_JOB), BANNER_QUEUE_SIZE, stage->head)) != NULL) {
+            BannerStart(stage, job);
+            AtomicStore(&job->sequence, stage->head + BANNER_QUEUE_SIZE);
+            stage->head++;
+        }
+        if(stage->active > 0) BannerPoll(stage);
+        else if(closing != 0) break;
+        else SleepMicros(RESULT_IDLE_US);
+    }
+    return 0;
+}
+
+/*
+Function lets the banner stage finish the ports it was given and frees it.
+Call it once discovery has stopped offering ports.
+Params:
+    PBANNER_STAGE   stage       -       [The stage to close.]
+Returns nothing.
+*/
+void BannerClose(PBANNER_STAGE stage) {
+    AtomicStore(&stage->closing, 1);
+    if(stage->running == TRUE) ThreadJoin(stage->thread);
+    if(stage->config->debug == TRUE && stage->running == TRUE) {
+        printf("Banners [%u] read", (unsigned)stage->grabbed);
+        if(stage->dropped > 0) printf(", [%u] open ports skipped while the queue was full", (unsigned)stage->dropped);
+        printf("\n");
+    }
+    free(stage->jobs);
+    free(stage->connections);
+    free(stage->polls);
+    free(stage->chain);
+    free(stage->probeIndex);
+    memset(stage, 0, sizeof(BANNER_STAGE));
+}
+
+/*
+Function runs a connect scan, splitting the (target, port) pairs between
+worker threads that each drive their own scan engine.
+Params:
+    PSCAN_CONFIG    config      -       [The resolved targets, port range, concurrency and thread count to scan with.]
+Returns nothing.
+*/
+void ConnectScan(PSCAN_CONFIG config) {
+    SCAN_SCHEDULER scheduler = {0};                                                             // Splits the work between threads.
+    size_t total = 0;
+    scheduler.config = config;
+    scheduler.portCount = config->portEnd - config->portStart + 1;
+    total = (size_t)ProbeCount(config);
+    scheduler.workerCount = config->threads > 0 ? config->threads : CpuCount();
+    if(scheduler.workerCount > MAX_THREADS) scheduler.workerCount = MAX_THREADS;
+    if(scheduler.workerCount > (total + CHUNK_SIZE - 1) / CHUNK_SIZE) scheduler.workerCount = (total + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    scheduler.window = ClampConcurrency(config->concurrency) / scheduler.workerCount;             // The in-flight budget is shared by all workers.
+    if(scheduler.window < 1) scheduler.window = 1;
+    scheduler.workers = calloc(scheduler.workerCount, sizeof(SCAN_WORKER));
+
+    for(size_t i = 0; i < scheduler.workerCount; i++) {                                         // Give every worker an even slice up front.
+        PSCAN_WORKER worker = &scheduler.workers[i];
+        LockInit(&worker->lock);
+        worker->scheduler = &scheduler;
+        worker->next = total * i / scheduler.workerCount;
+        worker->end = total * (i + 1) / scheduler.workerCount;
+        if(EngineInit(&worker->engine, config, scheduler.window) == FALSE) {
+            printf("Error: Unable to start the scan engine.\n");
+            worker->next = worker->end;                                                          // The others will steal its share.
+        }
+    }
+    if(config->debug == TRUE) {
+        printf("Scanning [%u] targets with [%u] threads and [%u] probes in flight each\n",
+               (unsigned)config->targets.count, (unsigned)scheduler.workerCount, (unsigned)scheduler.window);
+    }
+
+    for(size_t i = 0; i < scheduler.workerCount; i++) {
+        PSCAN_WORKER worker = &scheduler.workers[i];
+        if(worker->engine.slots == NULL) continue;
+        if(ThreadStart(&worker->thread, ScanWorker, worker) == FALSE) {
+            worker->engine.window = 0;                                                          // Mark the worker as never started.
+            printf("Error: Unable to start scan thread.\n");
+        }
+    }
+    for(size_t i = 0; i < scheduler.workerCount; i++) {
+        PSCAN_WORKER worker = &scheduler.workers[i];
+        if(worker->engine.slots != NULL && worker->engine.window > 0) ThreadJoin(worker->thread);
+        EngineFree(&worker->engine);
+        LockFree(&worker->lock);
+    }
+
+    free(scheduler.workers);
+}
+
+/*
+Function runs discovery against the loaded targets into config->results,
+with the pacer, the banner stage and the statistics around it.
+Params:
+    PSCAN_CONFIG    config      -       [The loaded targets and scan settings, with the result store open.]
+Returns nothing.
+*/
+void ScanRun(PSCAN_CONFIG config) {
+    BANNER_STAGE banners;                                                                       // Reads what answers on open ports.
+    RATE_LIMITER limiter;                                                                       // Paces probes under -rate, -hostrate and -netrate.
+    STATS stats;                                                                                // Counters behind -progress and -metrics.
+
+    if(config->rate > 0 || config->hostRate > 0 || config->netRate > 0) {
+        if(RateInit(&limiter, config) == TRUE) config->limiter = &limiter;
+        else printf("Error: Unable to allocate the rate limiter, probes will not be paced.\n");
+    }
+    if(config->banners == TRUE && config->pt == Tcp && BannerInit(&banners, config) == TRUE) config->bannerStage = &banners;
+    if(config->resume == TRUE) JournalReplay(config);                                          // Stream what the earlier run found.
+    if(StatsInit(&stats, config) == TRUE) config->stats = &stats;
+
+    if(ProbeCount(config) == 0) {                                                               // More shards than (target, port) pairs.
+        if(config->debug == TRUE) printf("Shard [%u/%u] owns no (target, port) pairs, nothing to scan\n", (unsigned)config->shard, (unsigned)config->shardCount);
+    }
+    else
+#ifdef __linux__
+    if(config->pt == Udp) UdpScan(config);                                                      // Udp probes share one socket instead of the connect engine.
+    else
+#endif
+    if(config->synScan == TRUE) SynScan(config);                                                // Half-open scans bypass the connect engine.
+    else ConnectScan(config);
+
+    if(config->stats != NULL) StatsClose(config->stats);                                       // Discovery is over, print the last progress line.
+    config->stats = NULL;
+    if(config->bannerStage != NULL) BannerClose(config->bannerStage);                          // Discovery is done, let the last banners finish.
+    config->bannerStage = NULL;
+    if(config->limiter != NULL) RateFree(config->limiter);
+    config->limiter = NULL;
+}
+
+#ifdef __linux__
+/*
+Function gives the state the benchmark target serves a port in. The layout
+only depends on the port range, so a target running elsewhere agrees on it.
+Params:
+    PSCAN_CONFIG    config      -       [The port range.]
+    WORD            port        -       [The port, inside the range.]
+Returns int, 1 open, 2 closed or 3 filtered, the codes ResultGet uses.
+*/
+static int BenchLayout(PSCAN_CONFIG config, WORD port) {
+    size_t offset = port - config->portStart;
+    if(offset % BENCH_OPEN_EVERY == 0) return 1;
+    if(offset % BENCH_FILTERED_EVERY == 8) return 3;
+    return 2;
+}
+
+/*
+Function binds the benchmark layout on one address. Open tcp ports listen,
+filtered ones listen with an accept queue filled up front so the kernel drops
+every further SYN, and closed ones are bound without listening so nothing
+else can take them. Open udp ports are served, filtered ones are bound but
+never read, and closed ones are only checked to be free.
+Params:
+    PSCAN_CONFIG    config      -       [The address to serve on, the first target, and the port range.]
+    unsigned char   *taken      -       [Set per port to 1 when tcp could be served, 2 when udp could, 3 for both.]
+Returns int, the epoll descriptor of the open ports for BenchServe or -1.
+*/
+static int BenchBind(PSCAN_CONFIG config, unsigned char *taken) {
+    TARGET_ADDRESS address;
+    int enable = 1, poller = epoll_create1(EPOLL_CLOEXEC);
+
+    ClampConcurrency(MAX_CONCURRENCY);                              // Raises the descriptor limit, every port holds one.
+    for(size_t port = config->portStart; port <= config->portEnd; port++) {
+        struct epoll_event event = {0};
+        int state = BenchLayout(config, (WORD)port);
+        int length = TargetAddress(&config->targets, 0, (WORD)port, AF_UNSPEC, &address);
+        SOCKET tcp = socket(address.base.sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+        SOCKET udp = socket(address.base.sa_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+        if(poller < 0 || tcp == INVALID_SOCKET || udp == INVALID_SOCKET) {
+            printf("Error: Unable to open the benchmark target sockets at port [%u] [%s], use a smaller range.\n", (unsigned)port, strerror(errno));
+            return -1;
+        }
+        event.events = EPOLLIN;
+        taken[port - config->portStart] = 0;
+        setsockopt(tcp, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));  // Connections of earlier runs may still sit in TIME_WAIT.
+        if(bind(tcp, &address.base, length) == 0 && (state == 2 || listen(tcp, state == 1 ? SOMAXCONN : 0) == 0)) {
+            event.data.fd = tcp;
+            if(state == 1) epoll_ctl(poller, EPOLL_CTL_ADD, tcp, &event);
+            for(int i = 0; state == 3 && i < 2; i++) {              // The first fills the queue of one, the second is already dropped.
+                SOCKET filler = socket(address.base.sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+                if(filler != INVALID_SOCKET) connect(filler, &address.base, length);
+            }
+            taken[port - config->portStart] |= 1;
+        }
+        else if(errno == EADDRNOTAVAIL) {
+            printf("Error: The benchmark target address is not local.\n");
+            return -1;
+        }
+        else closesocket(tcp);                                      // Someone else serves this port, leave it out of the accuracy.
+        if(bind(udp, &address.base, length) == 0) {
+            event.data.fd = udp;
+            if(state == 1) epoll_ctl(poller, EPOLL_CTL_ADD, udp, &event);
+            if(state == 2) closesocket(udp);                        // The kernel answers closed ports with icmp.
+            taken[port - config->portStart] |= 2;
+        }
+        else closesocket(udp);
+    }
+    return poller;
+}
+
+/*
+Function answers on the open ports of the benchmark target until the process
+is killed. Tcp connections are accepted and closed, udp datagrams echoed.
+Params:
+    int     poller      -       [The epoll descriptor BenchBind returned.]
+Returns nothing.
+*/
+static void BenchServe(int poller) {
+    struct epoll_event events[256];
+    char buffer[2048];
+    while(TRUE) {
+        int count = epoll_wait(poller, events, 256, -1);
+        for(int i = 0; i < count; i++) {
+            SOCKET s = events[i].data.fd, client;
+            TARGET_ADDRESS peer;
+            socklen_t length = sizeof(peer);
+            ssize_t received;
+            while((client = accept4(s, NULL, NULL, SOCK_CLOEXEC)) != INVALID_SOCKET) closesocket(client);
+            while((received = recvfrom(s, buffer, sizeof(buffer), 0, &peer.base, &length)) >= 0) {
+                sendto(s, buffer, received > 0 ? (size_t)received : 1, 0, &peer.base, length);
+                length = sizeof(peer);
+            }
+        }
+    }
+}
+
+/*
+Function runs one scan of the benchmark target and checks every port it
+controls against the layout.
+Params:
+    PSCAN_CONFIG    config      -       [The target, port range and mode to scan with.]
+    unsigned char   *taken      -       [What BenchServe managed to serve, per port.]
+Returns BENCH_OUTCOME.
+*/
+static BENCH_OUTCOME BenchScan(PSCAN_CONFIG config, unsigned char *taken) {
+    BENCH_OUTCOME outcome = {0};
+    RESULT_STORE results;
+    unsigned char served = config->pt == Udp ? 2 : 1;
+
+    if(ResultInit(&results, config) == FALSE) return outcome;
+    results.text = FALSE;                                           // Thousands of lines would time the terminal.
+    config->results = &results;
+    UINT64 start = NowMicros();
+    ScanRun(config);
+    outcome.micros = NowMicros() - start;
+
+    for(size_t port = config->portStart; port <= config->portEnd; port++) {
+        int expected = BenchLayout(config, (WORD)port), found = ResultGet(&results, 0, (WORD)port);
+        if((taken[port - config->portStart] & served) == 0) continue;
+        outcome.checked++;
+        if(found == expected) outcome.correct++;
+        else if(found == 1) outcome.falseOpen++;
+        else if(found == 2) outcome.falseClosed++;
+        else outcome.falseFiltered++;
+    }
+    BOOL debug = config->debug;
+    config->debug = FALSE;                                          // Keep the summary line out of the bench output.
+    ResultClose(&results);
+    config->debug = debug;
+    config->results = NULL;
+    return outcome;
+}
+
+/*
+Function binds the banner benchmark services on the target address.
+Params:
+    PSCAN_CONFIG    config      -       [The address to serve on, the first target, and the first port.]
+Returns int, the epoll descriptor of the listeners for BenchBannerServe or -1.
+*/
+static int BenchBannerBind(PSCAN_CONFIG config) {
+    int enable = 1, poller = epoll_create1(EPOLL_CLOEXEC);
+    for(size_t i = 0; poller >= 0 && i < sizeof(BENCH_SERVICES) / sizeof(BENCH_SERVICES[0]); i++) {
+        TARGET_ADDRESS address;
+        struct epoll_event event = {0};
+        int length = TargetAddress(&config->targets, 0, (WORD)(config->portStart + i), AF_UNSPEC, &address);
+        SOCKET s = socket(address.base.sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+        if(s == INVALID_SOCKET || bind(s, &address.base, length) != 0 || listen(s, SOMAXCONN) != 0) {
+            printf("Error: Unable to serve the banner benchmark on port [%u] [%s].\n", (unsigned)(config->portStart + i), strerror(errno));
+            return -1;
+        }
+        event.events = EPOLLIN;
+        event.data.u64 = 1ULL << 63 | (UINT64)i << 32 | (UINT64)s;  // Listeners are flagged, connections carry their service too.
+        epoll_ctl(poller, EPOLL_CTL_ADD, s, &event);
+    }
+    return poller;
+}
+
+/*
+Function serves the banner benchmark until the process is killed. Each
+connection gets its service's greeting on accept and its reply for every
+hello, and stays open until the client hangs up.
+Params:
+    int     poller      -       [The epoll descriptor BenchBannerBind returned.]
+Returns nothing.
+*/
+static void BenchBannerServe(int poller) {
+    struct epoll_event events[64];
+    char buffer[2048];
+    while(TRUE) {
+        int count = epoll_wait(poller, events, 64, -1);
+        for(int i = 0; i < count; i++) {
+            UINT64 data = events[i].data.u64;
+            SOCKET s = (SOCKET)(data & 0xffffffffu), client;
+            size_t service = (size_t)(data >> 32 & 0xffff);
+            PBENCH_SERVICE served = (PBENCH_SERVICE)&BENCH_SERVICES[service];
+            if(data >> 63) {
+                while((client = accept4(s, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != INVALID_SOCKET) {
+                    struct epoll_event event = {0};
+                    if(served->greetingLength > 0) send(client, served->greeting, served->greetingLength, MSG_NOSIGNAL);
+                    event.events = EPOLLIN;
+                    event.data.u64 = (UINT64)service << 32 | (UINT64)client;
+                    epoll_ctl(poller, EPOLL_CTL_ADD, client, &event);
+                }
+                continue;
+            }
+            ssize_t received = recv(s, buffer, sizeof(buffer), 0);
+            if(received == 0 || (received < 0 && errno != EAGAIN)) closesocket(s);  // Closing also takes it out of epoll.
+            else if(received > 0 && served->replyLength > 0) send(s, served->reply, served->replyLength, MSG_NOSIGNAL);
+        }
+    }
+}
+#endif
+
+/*
+Function serves the scan benchmark layout on the target address until it is
+killed, for running the target in another network namespace where netem
+can delay and drop its packets.
+Params:
+    PSCAN_CONFIG    config      -       [The address to serve on and the port range.]
+Returns nothing.
+*/
+void BenchTarget(PSCAN_CONFIG config) {
+#ifdef __linux__
+    size_t portCount = config->portEnd - config->portStart + 1, missing = 0;
+    unsigned char *taken = malloc(portCount);
+    char address[INET6_ADDRSTRLEN];
+    int poller = taken != NULL ? BenchBind(config, taken) : -1;
+
+    if(poller >= 0) {
+        for(size_t i = 0; i < portCount; i++) missing += taken[i] != 3;
+        TargetText(&config->targets, 0, address);
+        printf("Serving the scan benchmark on [%s] ports [%u-%u], [%u] ports are taken by other programs\n", address,
+               (unsigned)config->portStart, (unsigned)config->portEnd, (unsigned)missing);
+        fflush(stdout);
+        BenchServe(poller);
+    }
+    free(taken);
+#else
+    printf("Error: The benchmark target needs linux.\n");
+#endif
+}
+
+/*
+Function measures whole scans. The benchmark target is started on the target
+address when it is local, otherwise one started with -bench target is
+expected there. Every mode then scans it BENCH_SCAN_RUNS times, each run in
+its own process so its cpu time and peak memory can be read apart, and every
+run is one line with the port rate and the ports reported wrong.
+Params:
+    PSCAN_CONFIG    config      -       [The target and port range, plus the scan settings to measure with.]
+Returns nothing.
+*/
+void ScanBenchmark(PSCAN_CONFIG config) {
+#ifdef __linux__
+    const char *modes[] = {"connect", "syn", "udp"};
+    size_t portCount = config->portEnd - config->portStart + 1;
+    TARGET_ADDRESS address;
+    BOOL local = FALSE;
+    pid_t target = -1;
+    unsigned char *taken = NULL;
+
+    if(config->targets.count != 1) {
+        printf("Error: The scan benchmark takes a single target.\n");
+        return;
+    }
+    int length = TargetAddress(&config->targets, 0, 0, AF_UNSPEC, &address);
+    SOCKET probe = socket(address.base.sa_family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    local = probe != INVALID_SOCKET && bind(probe, &address.base, length) == 0;
+    if(probe != INVALID_SOCKET) closesocket(probe);
+
+    taken = mmap(NULL, portCount, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);  // Shared with the target process.
+    if(taken == MAP_FAILED) return;
+    memset(taken, 3, portCount);                                    // A target elsewhere is taken to serve every port.
+    if(local == TRUE) {
+        int ready[2];
+        char byte = 0;
+        if(pipe(ready) != 0) {
+            munmap(taken, portCount);
+            return;
+        }
+        fflush(stdout);
+        target = fork();
+        if(target == 0) {
+            int poller = -1;
+            close(ready[0]);
+            prctl(PR_SET_PDEATHSIG, SIGKILL);                       // Never outlive the benchmark.
+            poller = BenchBind(config, taken);
+            if(poller >= 0 && write(ready[1], "1", 1) == 1) BenchServe(poller);
+            fflush(stdout);                                         // _exit leaves the reason unwritten otherwise.
+            _exit(1);
+        }
+        close(ready[1]);
+        if(target < 0 || read(ready[0], &byte, 1) != 1) {           // Closed without a byte, the target already said why.
+            if(target > 0) waitpid(target, NULL, 0);
+            close(ready[0]);
+            munmap(taken, portCount);
+            return;
+        }
+        close(ready[0]);
+    }
+
+    size_t counts[4] = {0}, missing = 0;
+    for(size_t i = 0; i < portCount; i++) {
+        if(taken[i] != 3) missing++;
+        else counts[BenchLayout(config, (WORD)(config->portStart + i))]++;
+    }
+    printf("BENCH scan target=%s ports=%u open=%u closed=%u filtered=%u taken_elsewhere=%u timeout_ms=%ld retries=%d concurrency=%u\n",
+           local == TRUE ? "local" : "remote", (unsigned)portCount, (unsigned)counts[1], (unsigned)counts[2], (unsigned)counts[3],
+           (unsigned)missing, config->timeout, config->retries, (unsigned)config->concurrency);
+    fflush(stdout);
+
+    Protocol protocol = config->pt;
+    BOOL synScan = config->synScan;
+    for(int mode = 0; mode < 3; mode++) {
+        if(mode == 1) {                                             // Half-open scans need raw sockets.
+            SOCKET raw = socket(address.base.sa_family, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_TCP);
+            if(raw == INVALID_SOCKET) {
+                printf("BENCH scan mode=syn skipped=no_raw_sockets\n");
+                continue;
+            }
+            closesocket(raw);
+        }
+        for(int run = 0; run < BENCH_SCAN_RUNS; run++) {
+            BENCH_OUTCOME outcome = {0};
+            struct rusage usage = {0};
+            int channel[2], status = 0;
+            if(pipe(channel) != 0) break;
+            fflush(stdout);
+            pid_t child = fork();
+            if(child == 0) {
+                close(channel[0]);
+                config->pt = mode == 2 ? Udp : Tcp;
+                config->synScan = mode == 1;
+                outcome = BenchScan(config, taken);
+                fflush(stdout);
+                _exit(write(channel[1], &outcome, sizeof(outcome)) == sizeof(outcome) ? 0 : 1);
+            }
+            close(channel[1]);
+            BOOL received = child > 0 && read(channel[0], &outcome, sizeof(outcome)) == sizeof(outcome);
+            close(channel[0]);
+            if(child > 0) wait4(child, &status, 0, &usage);
+            if(received == FALSE || outcome.micros == 0) {
+                printf("BENCH scan mode=%s run=%d failed=1\n", modes[mode], run);
+                continue;
+            }
+            double cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+            printf("BENCH scan mode=%s run=%d ports=%u seconds=%.3f rate=%.0f cpu_seconds=%.3f peak_rss_kb=%ld checked=%u correct=%u "
+                   "false_open=%u false_closed=%u false_filtered=%u accuracy=%.4f\n", modes[mode], run, (unsigned)portCount,
+                   outcome.micros / 1e6, portCount * 1e6 / outcome.micros, cpu, usage.ru_maxrss, (unsigned)outcome.checked,
+                   (unsigned)outcome.correct, (unsigned)outcome.falseOpen, (unsigned)outcome.falseClosed, (unsigned)outcome.falseFiltered,
+                   outcome.checked > 0 ? (double)outcome.correct / outcome.checked : 0.0);
+            fflush(stdout);
+        }
+    }
+    config->pt = protocol;
+    config->synScan = synScan;
+
+    if(target > 0) {
+        kill(target, SIGKILL);
+        waitpid(target, NULL, 0);
+    }
+    munmap(taken, portCount);
+#else
+    printf("Error: The scan benchmark needs linux.\n");
+#endif
+}
+
+/*
+Function checks the banner stage against services on a local address. A
+child process serves BENCH_SERVICES from the first port of the range, the
+stage is handed one port at a time, and the services it names are read back
+from a json output. Each service prints one line with what was expected,
+what was found and how long its banner took. Every banner but the silent
+one has to end before the -bt budget runs out.
+Params:
+    PSCAN_CONFIG    config      -       [The local target, the port range and the banner budget.]
+Returns nothing.
+*/
+void BannerBenchmark(PSCAN_CONFIG config) {
+#ifdef __linux__
+    size_t services = sizeof(BENCH_SERVICES) / sizeof(BENCH_SERVICES[0]), correct = 0;
+    char path[] = "/tmp/cpscan-banners-XXXXXX", line[1024], found[sizeof(BENCH_SERVICES) / sizeof(BENCH_SERVICES[0])][32] = {{0}};
+    UINT64 micros[sizeof(BENCH_SERVICES) / sizeof(BENCH_SERVICES[0])] = {0};
+    char *jsonFile = config->jsonFile;
+    RESULT_STORE results;
+    int ready[2], file = -1;
+    char byte = 0;
+
+    if(config->targets.count != 1 || (size_t)(config->portEnd - config->portStart + 1) < services) {
+        printf("Error: The banner benchmark takes a single local target and a range of at least [%u] ports.\n", (unsigned)services);
+        return;
+    }
+    if(pipe(ready) != 0) return;
+    fflush(stdout);
+    pid_t server = fork();
+    if(server == 0) {
+        close(ready[0]);
+        prctl(PR_SET_PDEATHSIG, SIGKILL);                           // Never outlive the benchmark.
+        int poller = BenchBannerBind(config);
+        if(poller >= 0 && write(ready[1], "1", 1) == 1) BenchBannerServe(poller);
+        fflush(stdout);
+        _exit(1);
+    }
+    close(ready[1]);
+    BOOL serving = server > 0 && read(ready[0], &byte, 1) == 1;     // Closed without a byte, the server already said why.
+    close(ready[0]);
+    if(serving == FALSE || (file = mkstemp(path)) < 0) {
+        if(server > 0) {
+            kill(server, SIGKILL);
+            waitpid(server, NULL, 0);
+        }
+        return;
+    }
+    close(file);
+
+    config->jsonFile = path;
+    if(ResultInit(&results, config) == TRUE) {
+        results.text = FALSE;
+        config->results = &results;
+        for(size_t i = 0; i < services; i++) {                      // One at a time, so each banner is timed on its own.
+            BANNER_STAGE stage;
+            UINT64 start = NowMicros();
+            if(BannerInit(&stage, config) == FALSE) break;
+            BannerOffer(&stage, 0, (WORD)(config->portStart + i), INVALID_SOCKET);
+            BannerClose(&stage);
+            micros[i] = NowMicros() - start;
+        }
+        BOOL debug = config->debug;
+        config->debug = FALSE;                                      // Keep the summary line out of the bench output.
+        ResultClose(&results);
+        config->debug = debug;
+        config->results = NULL;
+    }
+    config->jsonFile = jsonFile;
+
+    FILE *written = fopen(path, "r");
+    while(written != NULL && fgets(line, sizeof(line), written) != NULL) {
+        unsigned int port = 0;
+        char *at = strstr(line, "\"port\":"), *service = strstr(line, "\"service\":\"");
+        if(at == NULL || service == NULL || sscanf(at + 7, "%u", &port) != 1) continue;
+        if(port < config->portStart || port - config->portStart >= services) continue;
+        sscanf(service + 11, "%31[^\"]", found[port - config->portStart]);
+    }
+    if(written != NULL) fclose(written);
+    unlink(path);
+    kill(server, SIGKILL);
+    waitpid(server, NULL, 0);
+
+    for(size_t i = 0; i < services; i++) {
+        const char *name = found[i][0] != 0 ? found[i] : "none";
+        BOOL silent = strcmp(BENCH_SERVICES[i].service, "none") == 0;
+        BOOL right = strcmp(name, BENCH_SERVICES[i].service) == 0 && (silent == TRUE || micros[i] < (UINT64)config->bannerTimeout * 1000);
+        correct += right;
+        printf("BENCH banners service=%s port=%u found=%s seconds=%.3f correct=%d\n", BENCH_SERVICES[i].service,
+               (unsigned)(config->portStart + i), name, micros[i] / 1e6, right == TRUE);
+    }
+    printf("BENCH banners services=%u correct=%u budget_ms=%ld\n", (unsigned)services, (unsigned)correct, config->bannerTimeout);
+    fflush(stdout);
+#else
+    printf("Error: The banner benchmark needs linux.\n");
+#endif
+}
+
+/*
+Function runs the main loop for scanning and preparing ports to be scanned.
+Params:
+    char            *domain      -       [Targets separated by commas, or NULL when they all come from -iL.]
+    PSCAN_CONFIG    config       -       [The port range, protocol, timeout, concurrency and thread count to scan with.]
+Returns nothing.
+*/
+void ScanTarget(char *domain, PSCAN_CONFIG config) {
+    RESULT_STORE results;                                                                       // Every outcome, streamed to the outputs.
+
+    if(LoadTargets(config, domain) == FALSE) {                                                  // Nothing to scan, exit.
+        TargetFree(&config->targets);
+        return;
+    }
+
+    if(config->randomOrder == TRUE) {                                                           // Walk the (target, port) space in a seeded random order.
+        if(config->seedSet == FALSE) config->seed = config->shardCount > 1 ? 0 : MixSeed(NowMicros());  // Shards must agree on the order.
+        PermutationInit(&config->permutation, (UINT64)config->targets.count * (config->portEnd - config->portStart + 1),
+                        config->seed, config->shard, config->shardCount);
+        if(config->debug == TRUE) {
+            printf("Probing in random order with seed [%llu], shard [%u/%u] takes [%llu] of [%llu] positions\n",
+                   (unsigned long long)config->seed, (unsigned)config->shard, (unsigned)config->shardCount,
+                   (unsigned long long)config->permutation.positions, (unsigned long long)(config->permutation.prime - 1));
+        }
+    }
+    if(config->bench != NULL && stricmp(config->bench, "permute") == 0) {                      // Permutation coverage check instead of a scan.
+        PermutationBenchmark(config);
+        TargetFree(&config->targets);
+        return;
+    }
+    if(config->bench != NULL && stricmp(config->bench, "targets") == 0) {                      // Target expansion benchmark instead of a scan.
+        TargetBenchmark(config);
+        TargetFree(&config->targets);
+        return;
+    }
+    if(config->bench != NULL && stricmp(config->bench, "pps") == 0) {                          // Packet rate benchmark instead of a scan.
+        SynBenchmark(config);
+        TargetFree(&config->targets);
+        return;
+    }
+    if(config->bench != NULL && stricmp(config->bench, "rate") == 0) {                         // Pacer accuracy and cost instead of a scan.
+        RateBenchmark(config);
+        TargetFree(&config->targets);
+        return;
+    }
+    if(config->bench != NULL && stricmp(config->bench, "results") == 0) {                      // Result store benchmark instead of a scan.
+        ResultBenchmark(config);
+        TargetFree(&config->targets);
+        return;
+    }
+    if(config->bench != NULL && stricmp(config->bench, "scan") == 0) {                         // Whole scans of a local fake target instead of a scan.
+        ScanBenchmark(config);
+        TargetFree(&config->targets);
+        return;
+    }
+    if(config->bench != NULL && stricmp(config->bench, "target") == 0) {                       // Serve the scan benchmark layout for a run elsewhere.
+        BenchTarget(config);
+        TargetFree(&config->targets);
+        return;
+    }
+    if(config->bench != NULL && stricmp(config->bench, "banners") == 0) {                      // Banner grabbing against local services instead of a scan.
+        BannerBenchmark(config);
+        TargetFree(&config->targets);
+        return;
+    }
+    if(ResultInit(&results, config) == FALSE) {
+        TargetFree(&config->targets);
+        return;
+    }
+    config->results = &results;
+    ScanRun(config);
+    ResultClose(&results);
+    config->results = NULL;
+    TargetFree(&config->targets);
+}
+
+/*
+Function checks if the port range makes sense.
+Params:
+    size_t arg1     -       [The starting port range.]
+    size_t arg2     -       [The ending port range.]
+Returns BOOL.
+*/
+BOOL arePortsCorrect(size_t arg1, size_t arg2) {
+    if(arg1 > arg2) printf("[StartPort (%u) cannot be greater than EndPort (%u)]\n", (unsigned)arg1, (unsigned)arg2);
+    else if(arg2 > 65535) printf("[EndPort (%u) You may not scan ports greater than %u]\n", (unsigned)arg2, (unsigned)MAX_PORT);
+    else return TRUE;
+    return FALSE;
+}
+
+/*
+Function reads the command line flags that follow the target. The target may
+be left out when -iL supplies them.
+Params:
+    int             argc        -       [The argument count.]
+    char            *argv[]     -       [The arguments, argv[1] being the target or the first flag.]
+    PSCAN_CONFIG    config      -       [Receives the parsed settings.]
+Returns int, 0 on success, -1 on a syntax error or 1 when a value was rejected and already reported.
+*/
+int ParseArguments(int argc, char *argv[], PSCAN_CONFIG config) {
+    for(int i = argv[1][0] == '-' ? 1 : 2; i < argc; i++) {
+        if(stricmp("-dbg", argv[i]) == 0) config->debug = TRUE;
+        else if(stricmp("-t", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) {
+            config->timeout = atol(argv[++i]);
+        }
+        else if(stricmp("-retries", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) {
+            config->retries = atoi(argv[++i]);
+            if(config->retries < 0 || config->retries > MAX_RETRIES) {
+                printf("[Retries (%s) must be between 0 and %d]\n", argv[i], MAX_RETRIES);
+                return 1;
+            }
+        }
+        else if(stricmp("-c", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) {
+            config->concurrency = (size_t)atoll(argv[++i]);
+            if(config->concurrency < 1 || config->concurrency > MAX_CONCURRENCY) {
+                printf("[Concurrency (%s) must be between 1 and %u]\n", argv[i], (unsigned)MAX_CONCURRENCY);
+                return 1;
+            }
+        }
+        else if(stricmp("-threads", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) {
+            config->threads = (size_t)atoll(argv[++i]);
+            if(config->threads < 1 || config->threads > MAX_THREADS) {
+                printf("[Threads (%s) must be between 1 and %u]\n", argv[i], (unsigned)MAX_THREADS);
+                return 1;
+            }
+        }
+        else if(strcmp("-sS", argv[i]) == 0) config->synScan = TRUE;
+        else if(stricmp("-batch", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) {
+            config->batch = (size_t)atoll(argv[++i]);
+            if(config->batch < 1 || config->batch > MAX_BATCH) {
+                printf("[Batch (%s) must be between 1 and %u]\n", argv[i], (unsigned)MAX_BATCH);
+                return 1;
+            }
+        }
+        else if(stricmp("-ring", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) config->ringInterface = argv[++i];
+        else if(stricmp("-bench", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) config->bench = argv[++i];
+        else if(stricmp("-random", argv[i]) == 0) config->randomOrder = TRUE;
+        else if(stricmp("-seed", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) {
+            config->seed = strtoull(argv[++i], NULL, 0);
+            config->seedSet = TRUE;
+        }
+        else if((stricmp("-shard", argv[i]) == 0 || stricmp("--shard", argv[i]) == 0) && i + 1 < argc && strlen(argv[i + 1]) > 0) {
+            unsigned long shard = 0, shardCount = 0;
+            if(sscanf(argv[++i], "%lu/%lu", &shard, &shardCount) != 2 || shardCount < 1 || shard >= shardCount) {
+                printf("[Shard (%s) must be i/n with 0 <= i < n]\n", argv[i]);
+                return 1;
+            }
+            config->shard = shard;
+            config->shardCount = shardCount;
+            config->randomOrder = TRUE;                                 // Shards split the permuted cycle.
+        }
+        else if(strcmp("-oJ", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) config->jsonFile = argv[++i];
+        else if(strcmp("-oC", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) config->csvFile = argv[++i];
+        else if(strcmp("-oB", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) config->binaryFile = argv[++i];
+        else if(stricmp("-banners", argv[i]) == 0 || stricmp("--banners", argv[i]) == 0) config->banners = TRUE;
+        else if(stricmp("-bc", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) {
+            config->bannerConcurrency = (size_t)atoll(argv[++i]);
+            if(config->bannerConcurrency < 1 || config->bannerConcurrency > MAX_BANNER_CONCURRENCY) {
+                printf("[Banner concurrency (%s) must be between 1 and %u]\n", argv[i], (unsigned)MAX_BANNER_CONCURRENCY);
+                return 1;
+            }
+        }
+        else if(stricmp("-bt", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) {
+            config->bannerTimeout = atol(argv[++i]);
+            if(config->bannerTimeout < 1) {
+                printf("[Banner timeout (%s) must be at least 1 ms]\n", argv[i]);
+                return 1;
+            }
+        }
+        else if((stricmp("-rate", argv[i]) == 0 || stricmp("--rate", argv[i]) == 0 || stricmp("-hostrate", argv[i]) == 0 ||
+                 stricmp("-netrate", argv[i]) == 0) && i + 1 < argc && strlen(argv[i + 1]) > 0) {
+            double rate = atof(argv[i + 1]);
+            if(rate <= 0 || rate > 1e9) {
+                printf("[Rate (%s) must be between 0 and 1000000000 probes per second]\n", argv[i + 1]);
+                return 1;
+            }
+            if(stricmp("-hostrate", argv[i]) == 0) config->hostRate = rate;
+            else if(stricmp("-netrate", argv[i]) == 0) config->netRate = rate;
+            else config->rate = rate;
+            i++;
+        }
+        else if(stricmp("-progress", argv[i]) == 0 || stricmp("--progress", argv[i]) == 0) config->progress = TRUE;
+        else if((stricmp("-metrics", argv[i]) == 0 || stricmp("--metrics", argv[i]) == 0) && i + 1 < argc && strlen(argv[i + 1]) > 0) {
+            int port = atoi(argv[i + 1]);
+            if(port < 1 || port > 65535) {
+                printf("[Metrics port (%s) must be between 1 and 65535]\n", argv[i + 1]);
+                return 1;
+            }
+            config->metricsPort = (WORD)port;
+            i++;
+        }
+        else if((stricmp("-journal", argv[i]) == 0 || stricmp("--journal", argv[i]) == 0) && i + 1 < argc && strlen(argv[i + 1]) > 0) {
+            config->journalFile = argv[++i];
+        }
+        else if(stricmp("-resume", argv[i]) == 0 || stricmp("--resume", argv[i]) == 0) {
+            printf("[-resume takes the journal file and nothing else, the scan settings come from the journal]\n");
+            return 1;
+        }
+        else if(stricmp("-iL", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) config->targetFile = argv[++i];
+        else if(stricmp("-exclude", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) config->exclude = argv[++i];
+        else if(stricmp("-excludefile", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) config->excludeFile = argv[++i];
+        else if(stricmp("-dns", argv[i]) == 0 && i + 1 < argc && strlen(argv[i + 1]) > 0) {
+            char server[64] = {0};
+            char *port = NULL;
+            strncpy(server, argv[++i], sizeof(server) - 1);
+            if((port = strchr(server, ':')) != NULL) {
+                *port++ = 0;
+                config->dnsPort = (WORD)atoi(port);
+            }
+            if(inet_pton(AF_INET, server, &config->dnsServer) != 1 || (port != NULL && config->dnsPort == 0)) {
+                printf("[Dns server (%s) must be an ipv4 address with an optional :port]\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(stricmp("-proto", argv[i]) == 0 && i + 1 < argc) {
+            i++;
+            if(stricmp("tcp", argv[i]) == 0) config->pt = Tcp;
+            else if(stricmp("udp", argv[i]) == 0) config->pt = Udp;
+            else return -1;
+        }
+        else if(stricmp("-p", argv[i]) == 0 && i + 2 < argc && strlen(argv[i + 1]) > 0 && strlen(argv[i + 2]) > 0) {
+            config->portStart = atoll(argv[i + 1]);
+            config->portEnd = atoll(argv[i + 2]);
+            i += 2;
+            if(arePortsCorrect(config->portStart, config->portEnd) != TRUE) return 1;
+        }
+        else return -1;
+    }
+    if(argv[1][0] == '-' && config->targetFile == NULL) return -1;  // No target at all.
+    if((config->jsonFile != NULL && strcmp(config->jsonFile, "-") == 0) + (config->csvFile != NULL && strcmp(config->csvFile, "-") == 0) +
+       (config->binaryFile != NULL && strcmp(config->binaryFile, "-") == 0) > 1) {
+        printf("[Only one output format can go to stdout]\n");
+        return 1;
+    }
+    if(config->synScan == TRUE && config->pt == Udp) {
+        printf("[-sS only works with -proto tcp]\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    SCAN_CONFIG config = {0};                                                    // Settings for the scan.
+    config.portStart = DEFAULT_START_PORT;                                       // The default start port.
+    config.portEnd = DEFAULT_END_PORT;                                           // The default end port.
+    config.timeout = DEFAULT_TIMEOUT;                                            // The default timeout value.
+    config.retries = DEFAULT_RETRIES;                                            // The default number of times a silent port is probed again.
+    config.concurrency = DEFAULT_CONCURRENCY;                                    // The default number of probes in flight.
+    config.batch = DEFAULT_BATCH;                                                // The default number of packets per send call.
+    config.shardCount = 1;                                                       // The whole scan runs in this process.
+    config.bannerConcurrency = DEFAULT_BANNER_CONCURRENCY;                       // The default number of banner connections.
+    config.bannerTimeout = DEFAULT_BANNER_TIMEOUT;                               // The default time a port gets to show its banner.
+    config.pt = Tcp;
+    config.debug = FALSE;
+    InitWinSock();                                                               // Initalizes the winsock2 library.
+
+    if(argc <= 1 || strlen(argv[1]) == 0 || stricmp("-h", argv[1]) == 0) ShowSyntax();
+    else if(argc == 3 && (stricmp("-resume", argv[1]) == 0 || stricmp("--resume", argv[1]) == 0)) {
+        char **saved = JournalArguments(argv[2], &config.argc);    // Run the journal's own command line again.
+        if(saved != NULL) {
+            int err = 0;
+            config.argv = saved;
+            err = ParseArguments(config.argc, saved, &config);
+            config.journalFile = argv[2];                           // The journal may have been moved since.
+            config.resume = TRUE;
+            if(err == 0) ScanTarget(saved[1][0] == '-' ? NULL : saved[1], &config);
+            else if(err < 0) ShowSyntax();
+            free(saved);
+        }
+    }
+    else {
+        int err = 0;
+        config.argc = argc;
+        config.argv = argv;
+        err = ParseArguments(argc, argv, &config);
+        if(err == 0) ScanTarget(argv[1][0] == '-' ? NULL : argv[1], &config);
+        else if(err < 0) ShowSyntax();
+    }
+
+    WSACleanup();                                                                // Deallocates memory to the winsock2 library.
+    return 0;
+}